@@ -0,0 +1,44 @@
+#ifndef FLASH_DEVICES_H
+#define FLASH_DEVICES_H
+
+/* The sub-chip erase sizes a device has */
+#define ERASE_4K	0x01
+#define ERASE_32K	0x02
+#define ERASE_64K	0x04
+
+/*
+ * The Flash devices we know by JEDEC ID, with their datasheet parameters. This is the one place a part is described -
+ * the firmware, the Host emulator's model and flashprog each define FLASH_DEVICE() to pick out what they need and
+ * expand FLASH_DEVICES into their own tables. Devices not listed here are driven from their SFDP tables if they have them.
+ *
+ * FLASH_DEVICE(name, manufacturer, type, capacity, size, pageSize, eraseSizes, clockMax,
+ *   tPP, tPPMax, tSSE, tSSEMax, tBE32, tBE32Max, tSE, tSEMax, tBE, tBEMax, protect, relock, sfdp)
+ *   name         The part, which is also its FlashDevice_t (DEV_name) in the firmware
+ *   manufacturer, type, capacity
+ *                The three bytes of its RDID answer
+ *   size         Bytes
+ *   pageSize     The most a single Page Program takes
+ *   eraseSizes   ERASE_4K etc
+ *   clockMax     The fastest SPI clock in Hz FAST_READ runs at
+ *   tPP          Typical and maximum Page Program times in microseconds
+ *   tSSE, tBE32, tSE, tBE
+ *                Typical and maximum 4K, 32K, 64K and whole chip erase times in milliseconds (0 when not supported)
+ *   protect      The status register bits that write protect blocks
+ *   relock       Whether to set the protect bits again once programmed, for boards that expect the device locked
+ *   sfdp         Whether the device has SFDP tables
+ */
+#define FLASH_DEVICES \
+	FLASH_DEVICE(M25P80, 0x20, 0x71, 0x14, 0x00100000, 256, ERASE_64K, 40000000, \
+		1400, 5000, 0, 0, 0, 0, 600, 3000, 8000, 20000, 0x1C, true, false) \
+	FLASH_DEVICE(M25P16, 0x20, 0x20, 0x15, 0x00200000, 256, ERASE_64K, 50000000, \
+		1400, 5000, 0, 0, 0, 0, 600, 3000, 13000, 40000, 0x1C, false, false) \
+	FLASH_DEVICE(W25Q80BV, 0xEF, 0x40, 0x14, 0x00100000, 256, ERASE_4K | ERASE_32K | ERASE_64K, 104000000, \
+		700, 3000, 30, 200, 120, 800, 150, 1000, 2000, 6000, 0x7C, false, true) \
+	FLASH_DEVICE(W25Q32JV, 0xEF, 0x40, 0x16, 0x00400000, 256, ERASE_4K | ERASE_32K | ERASE_64K, 133000000, \
+		400, 3000, 45, 400, 120, 1600, 150, 2000, 10000, 50000, 0x7C, false, true) \
+	FLASH_DEVICE(GD25Q64C, 0xC8, 0x40, 0x17, 0x00800000, 256, ERASE_4K | ERASE_32K | ERASE_64K, 120000000, \
+		600, 2400, 50, 400, 150, 800, 200, 1200, 25000, 60000, 0x7C, false, true) \
+	FLASH_DEVICE(W25Q256JV, 0xEF, 0x40, 0x19, 0x02000000, 256, ERASE_4K | ERASE_32K | ERASE_64K, 133000000, \
+		400, 3000, 45, 400, 120, 1600, 150, 2000, 80000, 400000, 0x7C, false, true)
+
+#endif /*FLASH_DEVICES_H*/
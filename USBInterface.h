@@ -8,9 +8,94 @@ typedef enum usbCommand
 	CMD_STOP,
 	CMD_ABORT,
 	CMD_ERASE,
+	CMD_FRAME,
+	CMD_SKIP,
+	CMD_READ,
+	CMD_BAUD,
 	CMD_INVALID = 0xFF
 } usbCommand;
 
+/*
+ * CMD_START is followed by the uint32_t image length, a byte of these flags and the uint32_t SPI clock hint.
+ * The device replies CMD_START, RPL_OK, the number of pages it can buffer, the uint32_t SPI clock it settled on,
+ * the Flash's 3 byte JEDEC ID and uint32_t size, then uint32_t typical times for a page program in microseconds,
+ * for erasing the whole chip up front in milliseconds and for erasing as it goes in milliseconds (either erase 0 if unused).
+ * An image bigger than the Flash is refused with CMD_START, RPL_FAIL, as programming it would wrap over the start.
+ * The CMD_ERASE reply to a poll is RPL_FAIL if the erase ran past its datasheet maximum.
+ * START_FLAG_CRC replaces the read back of each page with a CRC32 of the image as received and
+ * a CRC32 of a single read of it back out of the Flash, both sent after the usual CMD_STOP reply.
+ */
+#define START_FLAG_CRC	0x01
+/*
+ * START_FLAG_LANES asks for the outcome on each device of a programmer that gang programs several at once
+ * (the LPC4370's LANES=n), sent after the rest of the CMD_STOP reply as a uint8_t number of lanes and
+ * a uint8_t mask of those that failed, bit n for lane n. A programmer with one device reports it as lane 0.
+ * Lanes other than 0 drop out of the session as they fail, while it carries on with the rest, so the CMD_STOP
+ * reply is RPL_OK only if every lane got the image.
+ */
+#define START_FLAG_LANES	0x02
+
+/*
+ * CMD_READ + 12 bytes => uint32_t address, uint32_t length to read back (0 == to the end of the device),
+ *   uint32_t SPI clock hint
+ *   Device replies CMD_READ, RPL_OK, the uint32_t SPI clock it settled on, the uint32_t length it will send,
+ *   and then that much data in one stream.
+ */
+
+/*
+ * At the start of each CMD_START or CMD_READ session, the device calibrates its SPI clock to the Flash,
+ * stepping down from the fastest it supports until the device reads back reliably. A non-zero hint in Hz,
+ * such as the clock the host saw last time with this fixture, is checked first and used if it holds up.
+ */
+
+/*
+ * The UART link starts out at BAUD_DEFAULT, and the host may then negotiate a faster rate:
+ * CMD_BAUD + 4 bytes => uint32_t baud rate to switch to
+ *   Device replies CMD_BAUD, RPL_FAIL if it can't make the rate, or CMD_BAUD, RPL_OK and switches over.
+ *   At the new rate, the host sends the BAUD_PROBE_LEN byte probe pattern, the device echoes it back,
+ *   and the host confirms with RPL_OK. Each step must arrive intact within BAUD_PROBE_TIMEOUT ms of the last,
+ *   or the side waiting on it drops back to the old rate - the device only once the line has gone quiet.
+ * The new rate lasts until the end of the next CMD_START or CMD_READ session.
+ */
+#define BAUD_DEFAULT	115200
+#define BAUD_PROBE_LEN	16
+#define BAUD_PROBE_TIMEOUT	250
+/* Runs of alternating, all-0, all-1 and unbalanced bits, to catch both bit and framing errors */
+#define BAUD_PROBE_PATTERN	{ 0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0x33, 0xCC, 0x01, 0x80, 0xFE, 0x7F, 0x5A, 0xA5, 0x69, 0x96 }
+
+/*
+ * A CMD_FRAME message packs several pages into a single bulk transfer:
+ * CMD_FRAME + 1 byte => uint8_t number of records that follow (not 0)
+ * Each record is then a complete CMD_PAGE message - CMD_PAGE, uint8_t page length (0 == 256), page data
+ *   or a CMD_SKIP message.
+ *
+ * A CMD_SKIP message stands in for a run of pages that are entirely 0xFF and so need no programming:
+ * CMD_SKIP + 1 byte => uint8_t number of pages to skip over (0 == 256)
+ * The run is still erased, and is acknowledged with a single CMD_PAGE reply.
+ */
+#define FRAME_HEADER_LEN	2
+#define FRAME_RECORD_LEN(pageLen)	(2 + (pageLen))
+#define SKIP_RECORD_LEN	2
+
+/*
+ * A programmer that is its own USB device, rather than a UART behind a bridge such as the Launchpad's ICDI,
+ * enumerates as SPIFP_USB_VID:SPIFP_USB_PID with a vendor specific interface holding one bulk endpoint each way.
+ * Those carry this protocol unchanged, but with no UART in the way there is no rate for CMD_BAUD to negotiate.
+ * A device may offer the interface in a configuration of its own, such as the LPC4370's second alongside its
+ * CDC ACM one, which the host then has to switch to. An interrupt IN endpoint beside the bulk pair is reserved
+ * for events the device raises unasked - none are defined yet, so today it never sends on it.
+ * The IDs are the pid.codes test pair, to be replaced should the project be allocated its own.
+ */
+#define SPIFP_USB_VID	0x1209
+#define SPIFP_USB_PID	0x0001
+/*
+ * The vendor specific interface also carries this subclass and protocol, which is how flashprog tells it apart on
+ * a device with some other VID:PID (such as one given it as usb:vid:pid), where a vendor specific interface with
+ * bulk endpoints could be anything - the ICDI's debug interface, for one.
+ */
+#define SPIFP_USB_SUBCLASS	0x53
+#define SPIFP_USB_PROTOCOL	0x01
+
 typedef enum usbReplys
 {
 	RPL_FAIL = 0,
@@ -0,0 +1,95 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The host build's LEDs are reported on stderr, and sending the process SIGUSR1 presses the buttons.
+ */
+
+#include <stdio.h>
+#include <signal.h>
+#include "GPIO.h"
+#include "Host.h"
+
+/* How long the result stays on show before going back to idle, as with the Tiva C's Timer 0 */
+#define IDLE_TIMEOUT_NS	500000000ULL
+
+static volatile sig_atomic_t buttonPressed;
+static bool timerRunning;
+static uint64_t timerStart;
+
+static void gpioButton(int signal)
+{
+	(void)signal;
+	buttonPressed = 1;
+}
+
+static void gpioLED(const char *colour)
+{
+	fprintf(stderr, "SPIFP: LED %s\n", colour);
+}
+
+void gpioInit()
+{
+	signal(SIGUSR1, gpioButton);
+	gpioLED("blue");
+}
+
+void gpioStopTimer()
+{
+	timerRunning = false;
+}
+
+void gpioStartTimer()
+{
+	timerStart = hostTimeNs();
+	timerRunning = true;
+}
+
+void gpioCheckIdle()
+{
+	if (timerRunning && (hostTimeNs() - timerStart) >= IDLE_TIMEOUT_NS)
+	{
+		gpioLED("blue");
+		timerRunning = false;
+	}
+}
+
+bool gpioCanTransfer()
+{
+	const bool pressed = buttonPressed != 0;
+	buttonPressed = 0;
+	return pressed;
+}
+
+void gpioBeginTransfer()
+{
+	gpioLED("red");
+}
+
+void gpioSignalTransfer()
+{
+}
+
+void gpioEndTransfer()
+{
+}
+
+void gpioShowOK()
+{
+	gpioLED("green");
+}
@@ -0,0 +1,66 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include "Host.h"
+#include "Clock.h"
+
+#define NSECS_IN_SEC	1000000000ULL
+
+uint64_t hostTimeNs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * NSECS_IN_SEC) + now.tv_nsec;
+}
+
+/* The host build's clock ticks are nanoseconds */
+uint32_t clockSystem()
+{
+	return NSECS_IN_SEC;
+}
+
+uint32_t clockTicks()
+{
+	return hostTimeNs() & 0xFFFFFFFF;
+}
+
+void hostPace(uint64_t *busClock, const uint64_t cost, const uint64_t slack)
+{
+	const uint64_t now = hostTimeNs();
+	/* An idle bus doesn't bank time */
+	if (*busClock < now)
+		*busClock = now;
+	*busClock += cost;
+	/* Sleeping for each byte would cost far more than the byte, so only catch up in slack sized steps */
+	if ((*busClock - now) > slack)
+	{
+		const uint64_t ahead = *busClock - now;
+		struct timespec req = { ahead / NSECS_IN_SEC, ahead % NSECS_IN_SEC };
+		nanosleep(&req, NULL);
+	}
+}
+
+uint64_t hostEnvNumber(const char *name, const uint64_t fallback)
+{
+	const char *value = getenv(name);
+	if (value == NULL || *value == 0)
+		return fallback;
+	return strtoull(value, NULL, 0);
+}
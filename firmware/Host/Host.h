@@ -0,0 +1,39 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+
+/*
+ * Support for the host (emulator) build of the firmware.
+ * Everything is configured through SPIFP_* environment variables, documented where they are used.
+ */
+
+/* Monotonic time in nanoseconds */
+extern uint64_t hostTimeNs();
+/*
+ * Charges cost nanoseconds of simulated bus time to the bus whose clock is *busClock,
+ * sleeping when the bus gets more than slack nanoseconds ahead of real time.
+ */
+extern void hostPace(uint64_t *busClock, const uint64_t cost, const uint64_t slack);
+/* Reads a numeric environment variable, returning fallback when it's not set */
+extern uint64_t hostEnvNumber(const char *name, const uint64_t fallback);
+
+#endif /*HOST_H*/
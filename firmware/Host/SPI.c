@@ -0,0 +1,608 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Behavioural model of a 25 series SPI Flash device, standing in for the SSI peripheral in the host build.
+ *
+ * The model is configured from the environment:
+ *   SPIFP_FLASH       The device to model - any of FlashDevices.h, M25P16 by default.
+ *                     Those that have SFDP tables get them generated from their parameters.
+ *   SPIFP_FLASH_ID    A different JEDEC ID for the device to answer with, such as one the firmware doesn't know
+ *                     so that it has to go by the SFDP tables
+ *   SPIFP_FLASH_FILE  File to keep the device's contents in, so they can be inspected and survive a restart.
+ *                     It is created erased (0xFF) if it doesn't exist. Without one, the contents live in memory.
+ *   SPIFP_NO_4BAIT    Leave the 4-byte instructions of a device past 16MB out of its SFDP tables, and out of the model,
+ *                     so that it has to be switched to 4-byte addresses with EN4B
+ *   SPIFP_SPI_HZ      The clock the SPI divides down from, 80MHz by default as on the Tiva C. 0 runs unthrottled.
+ *   SPIFP_SPI_MAX_HZ  The fastest SPI clock the modelled board carries cleanly. Above it, what the device sends
+ *                     comes back a bit late, as down a long trace. Unlimited by default.
+ *   SPIFP_TPP, SPIFP_TSSE, SPIFP_TBE32, SPIFP_TSE, SPIFP_TBE
+ *                     Page program, 4kB, 32kB and 64kB erase, and bulk erase times in microseconds that the model
+ *                     takes and lists in its SFDP tables, in place of the device's typical datasheet times.
+ *                     The firmware still waits out the times in its own table for a device it knows, so they only
+ *                     shorten a run for one it goes by the SFDP tables for, such as under SPIFP_FLASH_ID.
+ *   SPIFP_TRACE       Set to log each instruction the firmware issues to stderr
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "FlashDevices.h"
+#include "SPI.h"
+#include "Host.h"
+
+#define WREN	0x06
+#define WRDI	0x04
+#define RDID	0x9F
+#define RDSR	0x05
+#define WRSR	0x01
+#define READ	0x03
+#define FAST_READ	0x0B
+#define PP		0x02
+#define SSE		0x20
+#define BE32	0x52
+#define SE		0xD8
+#define BE		0xC7
+#define BE_ALT	0x60
+#define RDSFDP	0x5A
+#define READ4	0x13
+#define FAST_READ4	0x0C
+#define PP4		0x12
+#define SSE4	0x21
+#define SE4		0xDC
+#define EN4B	0xB7
+#define EX4B	0xE9
+
+/* Devices past this size take 4-byte addresses */
+#define SIZE_3BYTE	0x01000000
+
+#define SR_WIP	0x01
+#define SR_WEL	0x02
+#define SR_BP	0x1C
+
+typedef struct
+{
+	const char *name;
+	uint8_t did[3];
+	uint32_t size;
+	/* Which of the optional 4kB and 32kB erases the device has - all have 64kB sector and bulk erase */
+	uint8_t eraseSizes;
+	/* Typical times in microseconds */
+	uint32_t tPP, tSSE, tBE32, tSE, tBE;
+	/* And the maximums, which only go in the SFDP tables */
+	uint32_t tPPMax, tSEMax;
+	/* Whether the device answers RDSFDP */
+	bool sfdp;
+} hostFlash_t;
+
+#define FLASH_DEVICE(name, manufacturer, type, capacity, size, pageSize, eraseSizes, clockMax, \
+	tPP, tPPMax, tSSE, tSSEMax, tBE32, tBE32Max, tSE, tSEMax, tBE, tBEMax, protect, relock, sfdp) \
+	{ #name, { manufacturer, type, capacity }, size, eraseSizes, tPP, tSSE * 1000, tBE32 * 1000, tSE * 1000, \
+		tBE * 1000, tPPMax, tSEMax * 1000, sfdp },
+static const hostFlash_t hostFlashes[] =
+{
+	FLASH_DEVICES
+	{ NULL, { 0, 0, 0 }, 0, 0, 0, 0, 0, 0, 0, 0, 0, false }
+};
+#undef FLASH_DEVICE
+
+/*
+ * Where the model's Basic Flash Parameter Table sits in the SFDP space, and how many DWORDs it is (JESD216B),
+ * then the same for the 4-byte Address Instruction Table devices past 16MB have
+ */
+#define SFDP_BFPT	0x30
+#define SFDP_BFPT_LEN	16
+#define SFDP_4BAIT	(SFDP_BFPT + (SFDP_BFPT_LEN * 4))
+#define SFDP_4BAIT_LEN	2
+
+static const hostFlash_t *flash;
+static uint32_t tPP, tSSE, tBE32, tSE, tBE;
+static uint8_t did[3];
+static uint8_t *flashData;
+static uint64_t spiByteNs, spiClock;
+static uint32_t spiSource, spiMaxHz;
+static bool spiThrottled, spiLate;
+static uint8_t spiLastBit;
+static bool trace, have4ByteOps;
+
+/* Device state - the status register, when the operation that set WIP will complete, and whether EN4B is in effect */
+static uint8_t status;
+static uint64_t busyUntil;
+static bool addr4;
+
+/*
+ * Instruction state - the instruction as issued and as the 3-byte one it's a form of, the number of address bytes
+ * it takes, how many bytes into it we are, the address, and the page to program
+ */
+static bool selected, ignored;
+static uint8_t opcode, instruction, addrLen;
+static uint32_t count, address;
+static uint8_t page[256];
+static uint16_t pageMask[256 / 16];
+/* The device's SFDP tables */
+static uint8_t sfdp[SFDP_4BAIT + (SFDP_4BAIT_LEN * 4)];
+
+/* Picks the smallest of the BFPT's units that an erase time in microseconds can be counted in, encoding them */
+static uint32_t sfdpTime(const uint32_t time, const uint32_t *unitTimes)
+{
+	uint8_t unit;
+	uint32_t units = 1;
+	for (unit = 0; unit < 4; unit++)
+	{
+		units = (time + unitTimes[unit] - 1) / unitTimes[unit];
+		if (units <= 32)
+			break;
+	}
+	if (unit == 4)
+	{
+		unit = 3;
+		units = 32;
+	}
+	return (unit << 5) | (units != 0 ? units - 1 : 0);
+}
+
+/* Page program times are counted in 8us units, or 64us ones for slower parts */
+static uint32_t sfdpProgramTime(const uint32_t time)
+{
+	uint32_t units = (time + 7) / 8;
+	if (units <= 32)
+		return units != 0 ? units - 1 : 0;
+	units = (time + 63) / 64;
+	return (1 << 5) | ((units <= 32 ? units : 32) - 1);
+}
+
+/* The BFPT gives maximum times as the typical ones multiplied by 2 * (N + 1) */
+static uint32_t sfdpMultiplier(const uint32_t typical, const uint32_t max)
+{
+	uint32_t multiplier = (max + (2 * typical) - 1) / (2 * typical);
+	if (multiplier == 0)
+		multiplier = 1;
+	return multiplier > 16 ? 15 : multiplier - 1;
+}
+
+static void sfdpDword(const uint32_t table, const uint8_t index, const uint32_t value)
+{
+	uint8_t *dword = sfdp + table + ((index - 1) * 4);
+	dword[0] = value & 0xFF;
+	dword[1] = (value >> 8) & 0xFF;
+	dword[2] = (value >> 16) & 0xFF;
+	dword[3] = value >> 24;
+}
+
+/*
+ * Builds the SFDP header and a JESD216B Basic Flash Parameter Table describing the model, and for devices past 16MB
+ * a 4-byte Address Instruction Table - the dual and quad reads are listed, as the parts have them,
+ * even though the model only does single line ones
+ */
+static void sfdpInit()
+{
+	static const uint32_t eraseUnits[4] = { 1000, 16000, 128000, 1000000 };
+	static const uint32_t chipUnits[4] = { 16000, 256000, 4000000, 64000000 };
+	static const uint8_t header[24] =
+	{
+		'S', 'F', 'D', 'P', 0x06, 0x01, 0x00, 0xFF,
+		0x00, 0x06, 0x01, SFDP_BFPT_LEN, SFDP_BFPT, 0x00, 0x00, 0xFF,
+		0x84, 0x00, 0x01, SFDP_4BAIT_LEN, SFDP_4BAIT, 0x00, 0x00, 0xFF
+	};
+	const bool large = flash->size > SIZE_3BYTE;
+	uint32_t dword;
+
+	memset(sfdp, 0xFF, sizeof(sfdp));
+	memcpy(sfdp, header, sizeof(header));
+	/* The second parameter header, for the 4BAIT, only counts if there is one */
+	sfdp[6] = large && have4ByteOps ? 1 : 0;
+	/* 4kB erase, 1-1-2, 1-2-2, 1-4-4 and 1-1-4 reads, and 3-byte addressing or 3 or 4-byte */
+	dword = 0xFF800000 | (1 << 22) | (1 << 21) | (1 << 20) | (1 << 16) | (large ? 1 << 17 : 0) | 0x04;
+	dword |= (flash->eraseSizes & ERASE_4K) != 0 ? (SSE << 8) | 0x01 : 0xFF03;
+	sfdpDword(SFDP_BFPT, 1, dword);
+	/* The density in bits, less one or as a power of 2 once that won't fit */
+	if (flash->size < 0x10000000)
+		sfdpDword(SFDP_BFPT, 2, (flash->size << 3) - 1);
+	else
+		sfdpDword(SFDP_BFPT, 2, 0x80000000 | (__builtin_ctz(flash->size) + 3));
+	/* 1-4-4 as 0xEB with 2 mode and 4 dummy clocks, 1-1-4 as 0x6B with 8 dummy clocks */
+	sfdpDword(SFDP_BFPT, 3, 0x6B08EB44);
+	/* 1-1-2 as 0x3B with 8 dummy clocks, 1-2-2 as 0xBB with 4 mode clocks */
+	sfdpDword(SFDP_BFPT, 4, 0xBB803B08);
+	/* Erase types 1 to 3 are 4kB, 32kB and 64kB, leaving out those the device doesn't have */
+	dword = 0;
+	if (flash->eraseSizes & ERASE_4K)
+		dword |= (SSE << 8) | 12;
+	if (flash->eraseSizes & ERASE_32K)
+		dword |= ((BE32 << 8) | 15) << 16;
+	sfdpDword(SFDP_BFPT, 8, dword);
+	sfdpDword(SFDP_BFPT, 9, (SE << 8) | 16);
+	/* Their typical times, and the multiplier to the maximum ones */
+	dword = sfdpMultiplier(flash->tSE, flash->tSEMax);
+	dword |= sfdpTime(tSSE, eraseUnits) << 4;
+	dword |= sfdpTime(tBE32, eraseUnits) << 11;
+	dword |= sfdpTime(tSE, eraseUnits) << 18;
+	sfdpDword(SFDP_BFPT, 10, dword);
+	/* 256 byte pages, the page program and chip erase times, and the multiplier to their maximums */
+	dword = (sfdpTime(tBE, chipUnits) << 24) | (sfdpProgramTime(tPP) << 8) | (8 << 4);
+	sfdpDword(SFDP_BFPT, 11, dword | sfdpMultiplier(flash->tPP, flash->tPPMax));
+	/* EN4B (without a WREN) and EX4B switch between 3 and 4-byte addresses, for those that take both */
+	sfdpDword(SFDP_BFPT, 16, large ? (0x01 << 24) | (0x001 << 14) : 0);
+
+	/*
+	 * The 4-byte instructions the model has - READ4, FAST_READ4, the 1-1-2, 1-2-2, 1-1-4 and 1-4-4 reads and PP4,
+	 * and the 4kB and 64kB erases (erase types 1 and 3), as the 32kB one has no 4-byte form
+	 */
+	if (large && have4ByteOps)
+	{
+		sfdpDword(SFDP_4BAIT, 1, 0x7F | (1 << 9) | (1 << 11));
+		sfdpDword(SFDP_4BAIT, 2, 0xFF00FF00 | (SE4 << 16) | SSE4);
+	}
+}
+
+void spiInit()
+{
+	const char *name = getenv("SPIFP_FLASH");
+	const char *file = getenv("SPIFP_FLASH_FILE");
+	uint64_t hz, id;
+
+	for (flash = hostFlashes; flash->name != NULL; flash++)
+	{
+		if (name == NULL ? strcmp(flash->name, "M25P16") == 0 : strcasecmp(flash->name, name) == 0)
+			break;
+	}
+	if (flash->name == NULL)
+	{
+		fprintf(stderr, "SPIFP: Unknown Flash device %s\n", name);
+		exit(1);
+	}
+	id = hostEnvNumber("SPIFP_FLASH_ID", (flash->did[0] << 16) | (flash->did[1] << 8) | flash->did[2]);
+	did[0] = (id >> 16) & 0xFF;
+	did[1] = (id >> 8) & 0xFF;
+	did[2] = id & 0xFF;
+	tPP = hostEnvNumber("SPIFP_TPP", flash->tPP);
+	tSSE = hostEnvNumber("SPIFP_TSSE", flash->tSSE);
+	tBE32 = hostEnvNumber("SPIFP_TBE32", flash->tBE32);
+	tSE = hostEnvNumber("SPIFP_TSE", flash->tSE);
+	tBE = hostEnvNumber("SPIFP_TBE", flash->tBE);
+	hz = hostEnvNumber("SPIFP_SPI_HZ", 80000000);
+	spiThrottled = hz != 0;
+	spiSource = hz != 0 ? hz : 80000000;
+	spiMaxHz = hostEnvNumber("SPIFP_SPI_MAX_HZ", 0);
+	trace = getenv("SPIFP_TRACE") != NULL;
+	have4ByteOps = flash->size > SIZE_3BYTE && getenv("SPIFP_NO_4BAIT") == NULL;
+	if (flash->sfdp)
+		sfdpInit();
+
+	if (file == NULL)
+	{
+		flashData = malloc(flash->size);
+		if (flashData == NULL)
+		{
+			fprintf(stderr, "SPIFP: Could not allocate the Flash contents\n");
+			exit(1);
+		}
+		memset(flashData, 0xFF, flash->size);
+	}
+	else
+	{
+		struct stat fileStat;
+		int fd = open(file, O_RDWR | O_CREAT, 0644);
+		if (fd == -1 || fstat(fd, &fileStat) != 0 || ftruncate(fd, flash->size) != 0)
+		{
+			fprintf(stderr, "SPIFP: Could not open %s to keep the Flash contents in\n", file);
+			exit(1);
+		}
+		flashData = mmap(NULL, flash->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (flashData == MAP_FAILED)
+		{
+			fprintf(stderr, "SPIFP: Could not map %s\n", file);
+			exit(1);
+		}
+		/* Anything the file didn't already hold starts out erased */
+		if ((uint64_t)fileStat.st_size < flash->size)
+			memset(flashData + fileStat.st_size, 0xFF, flash->size - fileStat.st_size);
+	}
+	fprintf(stderr, "SPIFP: Modelling a %s (%ukB)\n", flash->name, flash->size >> 10);
+	spiSetRate(SPI_RATE_SAFE);
+}
+
+/* Divides the clock down by an even number, as the Tiva C's SSI does */
+uint32_t spiSetRate(uint32_t rate)
+{
+	uint32_t divisor, actual;
+	if (rate == 0)
+		rate = 1;
+	divisor = spiSource / rate;
+	if (divisor == 0 || spiSource / divisor > rate)
+		divisor++;
+	divisor = divisor < 2 ? 2 : (divisor + 1) & ~1;
+	actual = spiSource / divisor;
+	/* Each byte is 8 clocks */
+	spiByteNs = spiThrottled ? 8000000000ULL / actual : 0;
+	spiLate = spiMaxHz != 0 && actual > spiMaxHz;
+	if (trace)
+		fprintf(stderr, "SPIFP: SPI clock set to %uHz%s\n", actual, spiLate ? ", too fast for the board" : "");
+	return actual;
+}
+
+static void updateStatus()
+{
+	/* Once the operation in progress completes, WIP and WEL both clear */
+	if ((status & SR_WIP) != 0 && hostTimeNs() >= busyUntil)
+		status &= ~(SR_WIP | SR_WEL);
+}
+
+static void setBusy(const uint32_t time)
+{
+	status |= SR_WIP;
+	busyUntil = hostTimeNs() + (time * 1000ULL);
+}
+
+/* The Block Protect bits protect the top 64kB << (BP - 1) of the device */
+static bool isProtected(const uint32_t addr, const uint32_t len)
+{
+	const uint8_t bp = (status & SR_BP) >> 2;
+	uint32_t protectedLen;
+	if (bp == 0)
+		return false;
+	protectedLen = 0x00010000 << (bp - 1);
+	if (protectedLen > flash->size)
+		protectedLen = flash->size;
+	return (addr + len) > (flash->size - protectedLen);
+}
+
+static void erase(const uint32_t size, const uint32_t time)
+{
+	const uint32_t addr = (address % flash->size) & ~(size - 1);
+	if (isProtected(addr, size))
+	{
+		fprintf(stderr, "SPIFP: Erase of protected block %06X, ignored\n", addr);
+		return;
+	}
+	memset(flashData + addr, 0xFF, size);
+	setBusy(time);
+}
+
+/* Write instructions take effect when the device is deselected */
+static void execute()
+{
+	uint16_t i;
+	if (trace)
+		fprintf(stderr, "SPIFP: %02X %06X (%u bytes)\n", opcode, address, count);
+	switch (instruction)
+	{
+		case WREN:
+			status |= SR_WEL;
+			return;
+		case WRDI:
+			status &= ~SR_WEL;
+			return;
+		case RDSR:
+		case RDID:
+		case READ:
+		case FAST_READ:
+		case RDSFDP:
+			return;
+		case EN4B:
+		case EX4B:
+			if (flash->size <= SIZE_3BYTE || count != 1)
+				break;
+			addr4 = instruction == EN4B;
+			return;
+	}
+
+	/* Everything else needs the device write enabled, and the right number of bytes */
+	if ((status & SR_WEL) == 0)
+	{
+		fprintf(stderr, "SPIFP: Instruction %02X issued without WREN, ignored\n", instruction);
+		return;
+	}
+	switch (instruction)
+	{
+		case WRSR:
+			if (count >= 2)
+				setBusy(15000);
+			return;
+		case PP:
+			if (count < addrLen + 2U)
+				break;
+			address = (address % flash->size) & ~0xFF;
+			if (isProtected(address, 256))
+			{
+				fprintf(stderr, "SPIFP: Page program to protected page %06X, ignored\n", address);
+				return;
+			}
+			/* Programming can only clear bits */
+			for (i = 0; i < 256; i++)
+			{
+				if ((pageMask[i >> 4] & (1 << (i & 0x0F))) != 0)
+					flashData[address + i] &= page[i];
+			}
+			setBusy(tPP);
+			return;
+		case SSE:
+			if (count != addrLen + 1U || (flash->eraseSizes & ERASE_4K) == 0)
+				break;
+			erase(0x1000, tSSE);
+			return;
+		case BE32:
+			if (count != addrLen + 1U || (flash->eraseSizes & ERASE_32K) == 0)
+				break;
+			erase(0x8000, tBE32);
+			return;
+		case SE:
+			if (count != addrLen + 1U)
+				break;
+			erase(0x10000, tSE);
+			return;
+		case BE:
+		case BE_ALT:
+			if (count != 1 || (status & SR_BP) != 0)
+				break;
+			memset(flashData, 0xFF, flash->size);
+			setBusy(tBE);
+			return;
+	}
+	fprintf(stderr, "SPIFP: Instruction %02X with %u bytes is not valid for a %s, ignored\n",
+		opcode, count, flash->name);
+	status &= ~SR_WEL;
+}
+
+/* Maps the 4-byte instructions the device has onto the 3-byte ones they're forms of */
+static uint8_t to3ByteInstruction(const uint8_t issued)
+{
+	if (!have4ByteOps)
+		return issued;
+	switch (issued)
+	{
+		case READ4:
+			return READ;
+		case FAST_READ4:
+			return FAST_READ;
+		case PP4:
+			return PP;
+		case SSE4:
+			return SSE;
+		case SE4:
+			return SE;
+	}
+	return issued;
+}
+
+static uint8_t transfer(const uint8_t data)
+{
+	uint8_t result = 0xFF;
+	hostPace(&spiClock, spiByteNs, 1000000);
+	if (!selected)
+		return result;
+	updateStatus();
+
+	if (count == 0)
+	{
+		opcode = data;
+		instruction = to3ByteInstruction(data);
+		/* The 4-byte instructions and, once EN4B is in effect, the rest take 4 address bytes - SFDP reads never do */
+		addrLen = instruction != opcode || (addr4 && instruction != RDSFDP) ? 4 : 3;
+		address = 0;
+		memset(pageMask, 0, sizeof(pageMask));
+		/* Only RDSR works while an operation is in progress, the device ignores everything else */
+		ignored = (status & SR_WIP) != 0 && instruction != RDSR;
+		if (ignored)
+			fprintf(stderr, "SPIFP: Instruction %02X issued while busy, ignored\n", opcode);
+	}
+	else if (instruction == RDSR)
+		result = status;
+	else if (ignored)
+		result = 0xFF;
+	else if (instruction == RDID)
+		result = count <= 3 ? did[count - 1] : 0x00;
+	else if (instruction == WRSR)
+	{
+		/* Only the BP bits are writable here */
+		if (count == 1 && (status & SR_WEL) != 0)
+			status = (status & ~SR_BP) | (data & SR_BP);
+	}
+	else if (count <= addrLen)
+		address = (address << 8) | data;
+	else if (instruction == READ || (instruction == FAST_READ && count > addrLen + 1U))
+	{
+		/* Reads carry on through the device, wrapping at the end */
+		result = flashData[address % flash->size];
+		address++;
+	}
+	else if (instruction == RDSFDP && flash->sfdp)
+	{
+		/* SFDP reads take a dummy byte like FAST_READ, and read back unwritten past the tables */
+		if (count > 4)
+		{
+			result = address < sizeof(sfdp) ? sfdp[address] : 0xFF;
+			address++;
+		}
+	}
+	else if (instruction == PP)
+	{
+		/* Page programs wrap within the page */
+		const uint8_t offset = (address + count - addrLen - 1) & 0xFF;
+		page[offset] = data;
+		pageMask[offset >> 4] |= 1 << (offset & 0x0F);
+	}
+	count++;
+	/* Too fast a clock for the board samples each bit the device sends one bit period late */
+	if (spiLate)
+	{
+		const uint8_t lastBit = result & 0x01;
+		result = (result >> 1) | (spiLastBit << 7);
+		spiLastBit = lastBit;
+	}
+	return result;
+}
+
+void spiWrite(uint8_t data)
+{
+	transfer(data);
+}
+
+uint8_t spiRead()
+{
+	return transfer(0);
+}
+
+/* The model takes a byte at a time, paced at the bus clock, so bursts are simply back to back bytes */
+void spiWriteBlock(const uint8_t *data, size_t dataLen)
+{
+	size_t i;
+	for (i = 0; i < dataLen; i++)
+		transfer(data[i]);
+}
+
+void spiReadBlock(uint8_t *data, size_t dataLen)
+{
+	size_t i;
+	for (i = 0; i < dataLen; i++)
+		data[i] = transfer(0);
+}
+
+/* The model has no DMA to hand the block to, so it's done by the time we return */
+void spiBlockStart(const uint8_t *tx, uint8_t *rx, size_t dataLen)
+{
+	size_t i;
+	for (i = 0; i < dataLen; i++)
+	{
+		const uint8_t data = transfer(tx != NULL ? tx[i] : 0);
+		if (rx != NULL)
+			rx[i] = data;
+	}
+}
+
+bool spiBlockDone()
+{
+	return true;
+}
+
+void spiChipSelect(bool select)
+{
+	if (select && !selected)
+		count = 0;
+	else if (!select && selected && count != 0)
+	{
+		if (!ignored)
+			execute();
+	}
+	selected = select;
+}
@@ -0,0 +1,254 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The host build's UART is a pseudo-terminal, which flashprog's tty transport can open like any serial port,
+ * or a socket, taking one connection at a time from flashprog's socket transports.
+ *
+ * The UART is configured from the environment:
+ *   SPIFP_PTY       Path to make a symlink to the pty at, as its name changes from run to run
+ *   SPIFP_SOCKET    Listen on unix:/path or tcp:port instead of using a pty
+ *   SPIFP_BAUD      The baud rate to simulate, 115200 by default as the Tiva C runs it. 0 runs unthrottled.
+ *   SPIFP_BAUD_MAX  The fastest rate the line carries intact, above which every byte arrives corrupted,
+ *                   to exercise flashprog's fallback. 0 (the default) means there is no limit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include "USBInterface.h"
+#include "UART.h"
+#include "Host.h"
+
+/* Depth of the real UART's FIFOs, which is how far we let transmission get ahead */
+#define UART_FIFO_LEN	16
+
+/* uartFD is the pty, or the connected socket if there is one */
+static int uartFD = -1, peerFD = -1, listenFD = -1;
+static uint64_t uartByteNs, txClock, rxClock, baudMax;
+static bool throttled, garbled;
+
+static void uartOpenPty()
+{
+	struct termios attrs;
+	const char *link = getenv("SPIFP_PTY");
+
+	uartFD = posix_openpt(O_RDWR | O_NOCTTY);
+	if (uartFD == -1 || grantpt(uartFD) != 0 || unlockpt(uartFD) != 0)
+	{
+		fprintf(stderr, "SPIFP: Could not create a pty for the UART\n");
+		exit(1);
+	}
+	/* Hold the other end open ourselves so the pty doesn't hang up between flashprog runs */
+	peerFD = open(ptsname(uartFD), O_RDWR | O_NOCTTY);
+	if (peerFD == -1 || tcgetattr(peerFD, &attrs) != 0)
+	{
+		fprintf(stderr, "SPIFP: Could not open the pty for the UART\n");
+		exit(1);
+	}
+	cfmakeraw(&attrs);
+	tcsetattr(peerFD, TCSANOW, &attrs);
+
+	if (link != NULL)
+	{
+		unlink(link);
+		if (symlink(ptsname(uartFD), link) != 0)
+			fprintf(stderr, "SPIFP: Could not link %s to the UART\n", link);
+	}
+	fprintf(stderr, "SPIFP: UART is %s\n", ptsname(uartFD));
+}
+
+static void uartListen(const char *spec)
+{
+	const int reuse = 1;
+	if (strncmp(spec, "unix:", 5) == 0 && strlen(spec + 5) < sizeof(((struct sockaddr_un *)NULL)->sun_path))
+	{
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, spec + 5);
+		unlink(addr.sun_path);
+		listenFD = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listenFD == -1 || bind(listenFD, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+			listenFD = -1;
+	}
+	else if (strncmp(spec, "tcp:", 4) == 0)
+	{
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(strtoul(spec + 4, NULL, 10));
+		/* Only local stand-ins are expected to connect */
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		listenFD = socket(AF_INET, SOCK_STREAM, 0);
+		if (listenFD != -1)
+			setsockopt(listenFD, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		if (listenFD == -1 || bind(listenFD, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+			listenFD = -1;
+	}
+	if (listenFD == -1 || listen(listenFD, 1) != 0)
+	{
+		fprintf(stderr, "SPIFP: Could not listen on %s, which must be unix:/path or tcp:port\n", spec);
+		exit(1);
+	}
+	/* A client going away mid-write must not take us with it */
+	signal(SIGPIPE, SIG_IGN);
+	fprintf(stderr, "SPIFP: UART is listening on %s\n", spec);
+}
+
+void uartInit()
+{
+	const char *socketSpec = getenv("SPIFP_SOCKET");
+	const uint64_t baud = hostEnvNumber("SPIFP_BAUD", BAUD_DEFAULT);
+
+	if (socketSpec != NULL)
+		uartListen(socketSpec);
+	else
+		uartOpenPty();
+	baudMax = hostEnvNumber("SPIFP_BAUD_MAX", 0);
+	throttled = baud != 0;
+	uartSetBaud(throttled ? baud : BAUD_DEFAULT);
+}
+
+bool uartBaudSupported(uint32_t baud)
+{
+	return baud != 0;
+}
+
+bool uartSetBaud(uint32_t baud)
+{
+	if (!uartBaudSupported(baud))
+		return false;
+	/* 8 data bits, 1 start and 1 stop bit */
+	uartByteNs = throttled ? 10000000000ULL / baud : 0;
+	garbled = baudMax != 0 && baud > baudMax;
+	return true;
+}
+
+/* Picks up the next connection when listening on a socket, waiting for one if asked to */
+static bool uartConnected(const bool wait)
+{
+	if (uartFD != -1)
+		return true;
+	if (!wait)
+	{
+		struct pollfd pollFD = { listenFD, POLLIN, 0 };
+		if (poll(&pollFD, 1, 0) != 1)
+			return false;
+	}
+	uartFD = accept(listenFD, NULL, NULL);
+	return uartFD != -1;
+}
+
+static void uartDisconnect()
+{
+	/* Only sockets disconnect - the pty stays up for the next flashprog */
+	if (listenFD == -1)
+		return;
+	close(uartFD);
+	uartFD = -1;
+}
+
+void uartWrite(uint8_t data)
+{
+	hostPace(&txClock, uartByteNs, uartByteNs * UART_FIFO_LEN);
+	if (garbled)
+		data ^= 0x5A;
+	/* With nothing connected, the byte goes nowhere - as it would on a real UART */
+	if (!uartConnected(false))
+		return;
+	while (write(uartFD, &data, 1) != 1)
+	{
+		struct pollfd pollFD = { uartFD, POLLOUT, 0 };
+		if (errno != EAGAIN && errno != EINTR)
+		{
+			uartDisconnect();
+			return;
+		}
+		poll(&pollFD, 1, -1);
+	}
+}
+
+static bool uartWait(const int timeout)
+{
+	struct pollfd pollFD = { uartFD, POLLIN, 0 };
+	return poll(&pollFD, 1, timeout) == 1 && (pollFD.revents & (POLLIN | POLLHUP)) != 0;
+}
+
+uint8_t uartRead()
+{
+	uint8_t data;
+	ssize_t res;
+	/* Bytes can't arrive any faster than the line can carry them */
+	hostPace(&rxClock, uartByteNs, uartByteNs * UART_FIFO_LEN);
+	while (true)
+	{
+		if (!uartConnected(true))
+			continue;
+		res = read(uartFD, &data, 1);
+		if (res == 1)
+			return garbled ? data ^ 0x5A : data;
+		else if (res == 0 || (errno != EAGAIN && errno != EINTR))
+		{
+			if (listenFD == -1)
+				usleep(10000);
+			uartDisconnect();
+		}
+		else
+			uartWait(-1);
+	}
+}
+
+bool uartHaveData()
+{
+	/*
+	 * The next byte isn't in yet until the last one has finished arriving, so a loop draining
+	 * the UART comes up empty between bytes and gets on with its other work, as on the real part
+	 */
+	return rxClock <= hostTimeNs() && uartConnected(false) && uartWait(0);
+}
+
+uint8_t uartPeak()
+{
+	/* Like reading the Tiva C's data register, this consumes the byte */
+	return uartRead();
+}
+
+bool uartWaitData(uint16_t timeout)
+{
+	const uint64_t deadline = hostTimeNs() + (timeout * 1000000ULL);
+	while (!uartHaveData())
+	{
+		const uint64_t now = hostTimeNs();
+		if (now >= deadline)
+			return false;
+		/* Let the line's pacing or the other end catch up without spinning */
+		if (!uartConnected(false) || !uartWait(1))
+			usleep(1000);
+	}
+	return true;
+}
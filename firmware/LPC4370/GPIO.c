@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <LPC4370.h>
 #include "GPIO.h"
+#include "Clock.h"
 
 void gpioInit()
 {
@@ -31,7 +32,7 @@ void gpioInit()
 	Timer0->TCR &= ~TIMER_TCR_CEN;
 	Timer0->CTCR = TIMER_CTCR_MODE_TIMER;
 	/* Set the timeout for 500ms */
-	Timer0->MR0 = 8000000;
+	Timer0->MR0 = clockSystem() / 2;
 	/* This makes the timer one-shot and enables + clears the interrupt for the match */
 	Timer0->MCR = TIMER_MCR_MR0SE | TIMER_MCR_MR0IE;
 	Timer0->IR = TIMER_IR_CH0;
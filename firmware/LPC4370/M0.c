@@ -0,0 +1,134 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The startup code and main loop for the LPC4370's Cortex-M0 application core in a DUALCORE build.
+ * The M4 loads us into ARAM1 and starts us once it has the clocks up, after which we own USB0 and run the
+ * controller side of the bulk data path entirely from interrupts - USB0's own and the event the M4 raises
+ * each time it moves one of the link's rings.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <LPC4370.h>
+#include "USB.h"
+#include "USBLink.h"
+
+#ifndef NULL
+#define NULL	(void *)0
+#endif
+
+void irqReset();
+void irqEmptyDef();
+void irqM4Core();
+extern void irqUSB();
+
+extern uint32_t _stack_top;
+extern uint32_t _start_bss, _end_bss;
+
+typedef void (*irqFunction)();
+irqFunction vectorTable[] __attribute__((section(".nvic_table"))) =
+{
+	(irqFunction)&_stack_top, /* Startup value for stack pointer */
+	irqReset, /* Reset handler */
+	irqEmptyDef, /* NMI handler */
+	irqEmptyDef, /* Hard Fault handler */
+
+	NULL, /* Reserved */
+	NULL, /* Reserved */
+	NULL, /* Reserved */
+	NULL, /* Reserved */
+	NULL, /* Reserved */
+	NULL, /* Reserved */
+	NULL, /* Reserved */
+	irqEmptyDef, /* SV Call */
+	NULL, /* Reserved */
+	NULL, /* Reserved */
+	irqEmptyDef, /* Pending SV */
+	irqEmptyDef, /* Sys Tick */
+
+	/* Peripheral handlers */
+	irqEmptyDef, /* RTC */
+	irqM4Core, /* Cortex-M4 (Application) */
+	irqEmptyDef, /* DMA */
+	NULL, /* Reserved */
+	irqEmptyDef, /* Flash A, B and EEPROM */
+	irqEmptyDef, /* Ethernet */
+	irqEmptyDef, /* SDIO */
+	irqEmptyDef, /* LCD */
+	irqUSB, /* USB 0 */
+	irqEmptyDef, /* USB 1 */
+	irqEmptyDef, /* SCT */
+	irqEmptyDef, /* RITimer or WDT */
+	irqEmptyDef, /* Timer 0 */
+	irqEmptyDef, /* GPIO Glbl 1 */
+	irqEmptyDef, /* GPIO Int 4 */
+	irqEmptyDef, /* Timer 3 */
+	irqEmptyDef, /* Motor Ctrl PWM */
+	irqEmptyDef, /* ADC 0 */
+	irqEmptyDef, /* I2C 0 or I2C 1 */
+	irqEmptyDef, /* SGPIO */
+	irqEmptyDef, /* SPI or DAC */
+	irqEmptyDef, /* ADC 1 */
+	irqEmptyDef, /* SSP 0 or SSP 1 */
+	irqEmptyDef, /* Event Router */
+	irqEmptyDef, /* USART 0 */
+	irqEmptyDef, /* UART 1 */
+	irqEmptyDef, /* USART 2 or C_CAN 1 */
+	irqEmptyDef, /* USART 3 */
+	irqEmptyDef, /* I2S 0, I2S 1 or QEI */
+	irqEmptyDef, /* C_CAN 0 */
+	irqEmptyDef, /* ADCHS */
+	irqEmptyDef /* Cortex-M0 (Subsystem) */
+};
+
+int main()
+{
+	usbInit();
+	usbAttach();
+	/* Take the M4's events as interrupts, so it can have us move the rings along */
+	NVIC_SETIE0 = 1 << 1;
+
+	while (1)
+		__asm__ __volatile__("wfi");
+	return 0;
+}
+
+/* The M4 has moved one of the link's rings */
+void irqM4Core()
+{
+	SYSCTL_M4TXEVENT = 0;
+	usbServiceLink();
+}
+
+void irqReset()
+{
+	uint32_t *dst;
+
+	/* The M4 copied all of .text and .data in with the image, so only .bss needs setting up */
+	dst = &_start_bss;
+	while (dst < &_end_bss)
+		*dst++ = 0;
+
+	main();
+	while (1);
+}
+
+void irqEmptyDef()
+{
+	while (1);
+}
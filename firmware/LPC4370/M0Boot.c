@@ -0,0 +1,44 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Brings up the Cortex-M0 application core for a DUALCORE build, which then drives USB0 on the M4's behalf */
+#include <stdint.h>
+#include <LPC4370.h>
+#include "M0.h"
+#include "M0Image.h"
+
+/* Where M0.ld links the image to run, shadowed at the M0's address 0 */
+#define M0_IMAGE_ADDR	0x20000000
+
+void m0Boot()
+{
+	const uint8_t *src = M0Image;
+	uint8_t *dst = (uint8_t *)M0_IMAGE_ADDR;
+	uint32_t i;
+
+	/* Hold the core in reset while its image goes in, in case a debugger or an earlier run left it going */
+	RGU_RESET_CTRL1 = RGU_RESET_M0APP;
+	while (RGU_RESET_ACTIVE_STATUS1 & RGU_RESET_M0APP);
+
+	for (i = 0; i < M0ImageLen; i++)
+		dst[i] = src[i];
+	SYSCTL_M0APPMMAP = M0_IMAGE_ADDR;
+
+	/* And then let it go */
+	RGU_RESET_CTRL1 = 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Gang programming's lanes. Every device shares the SPI block's clock, chip select and MOSI, and lane 0's MISO
+ * goes back to the SPI block as it would on its own. The other lanes' MISO lines come in on SGPIO pins, each shifted
+ * into a slice of its own that is clocked off the SPI clock, which the board also routes to SGPIO8.
+ */
+#include <LPC4370.h>
+#include "SPI.h"
+#include "SGPIO.h"
+
+/* Where each lane past 0 comes in: the port and pin, the SGPIO function there, and the slice that SGPIO pin feeds */
+typedef struct
+{
+	uint8_t port;
+	uint8_t pin;
+	uint8_t mode;
+	uint8_t slice;
+} sgpioLane_t;
+
+static const sgpioLane_t sgpioLanes[7] =
+{
+	{ 0, 0, SCU_SFS_MODE_3, SGPIO_SLICE_A },	/* P0_0, SGPIO0 */
+	{ 0, 1, SCU_SFS_MODE_3, SGPIO_SLICE_I },	/* P0_1, SGPIO1 */
+	{ 1, 15, SCU_SFS_MODE_2, SGPIO_SLICE_E },	/* P1_15, SGPIO2 */
+	{ 1, 16, SCU_SFS_MODE_2, SGPIO_SLICE_J },	/* P1_16, SGPIO3 */
+	{ 6, 3, SCU_SFS_MODE_2, SGPIO_SLICE_C },	/* P6_3, SGPIO4 */
+	{ 6, 6, SCU_SFS_MODE_2, SGPIO_SLICE_K },	/* P6_6, SGPIO5 */
+	{ 2, 2, SCU_SFS_MODE_0, SGPIO_SLICE_F }		/* P2_2, SGPIO6 */
+};
+
+/* A slice's position counts down a bit at a time, and at 0 it swaps in its shadow register - so start it from the top */
+#define SGPIO_POS_START		((0xFF << SGPIO_POS_RESET_S) | (0xFF << SGPIO_POS_S))
+
+void sgpioInit()
+{
+	uint8_t lane;
+	uint32_t enable = 0;
+
+	/* The SGPIO samples the SPI clock with its own, which has to run well clear of it */
+	CGU_BASE_PERIPH_CLK = (CGU_BASE_M4_CLK & CGU_CTRL_CLK_SEL_M) | CGU_CTRL_AUTOBLOCK;
+	/* P1_12 is SGPIO8, which takes the SPI clock */
+	SCU->SFS_Port1[12] = SCU_SFS_MODE_6 | SCU_SFS_DPU | SCU_SFS_EIB | SCU_SFS_EHS;
+
+	for (lane = 1; lane < SPI_LANES; lane++)
+	{
+		const sgpioLane_t *config = &sgpioLanes[lane - 1];
+		const uint8_t slice = config->slice;
+		(&SCU->SFS_Port0[0])[(config->port * 32) + config->pin] = config->mode | SCU_SFS_DPU | SCU_SFS_EIB;
+		SGPIO->SGPIO_MUX_CFG[slice] = SGPIO_MUX_CFG_EXT_CLK_ENABLE | (0 << SGPIO_MUX_CFG_CLK_SOURCE_PIN_S) |
+			SGPIO_MUX_CFG_QUALIFIER_ENABLE;
+		/* A bit in on every rising edge of the clock, where the devices' data is good in mode 3 */
+		SGPIO->SLICE_MUX_CFG[slice] = SGPIO_SLICE_CLKGEN_EXTERNAL | SGPIO_SLICE_PARALLEL_1BIT;
+		SGPIO->PRESET[slice] = 0;
+		SGPIO->COUNT[slice] = 0;
+		SGPIO->POS[slice] = SGPIO_POS_START;
+		SGPIO->REG[slice] = 0;
+		enable |= 1 << slice;
+	}
+	SGPIO->CTRL_ENABLE = enable;
+}
+
+static uint32_t reverseBits(const uint32_t value)
+{
+	uint32_t result;
+	__asm__("rbit %0, %1" : "=r" (result) : "r" (value));
+	return result;
+}
+
+/* Each byte goes through the SPI block as lane 0's, and the other lanes' are picked out of their slices after it */
+void spiLanesRead(uint8_t *data, size_t dataLen)
+{
+	size_t i;
+	uint8_t lane;
+	for (i = 0; i < dataLen; i++)
+	{
+		for (lane = 1; lane < SPI_LANES; lane++)
+			SGPIO->POS[sgpioLanes[lane - 1].slice] = SGPIO_POS_START;
+		data[i] = spiRead();
+		/* Slices shift in from the top, so the byte's 8 bits are the register's top 8, most significant lowest */
+		for (lane = 1; lane < SPI_LANES; lane++)
+			data[(lane * dataLen) + i] = reverseBits(SGPIO->REG[sgpioLanes[lane - 1].slice]) & 0xFF;
+	}
+}
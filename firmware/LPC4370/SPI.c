@@ -18,22 +18,37 @@
 
 #include <LPC4370.h>
 #include "SPI.h"
+#include "Clock.h"
+#ifdef SPI_COMMANDS
+#include "SPIFI.h"
+#endif
+#ifdef SPI_LANES
+#include "SGPIO.h"
+#endif
 
 /*
  * Func1 for pins 3, 6, 7, 8, uses block SPI
  * Func3 for pins 3, 4, 5, 6, 7, 8 uses block SPIFI
  */
 
-void spiInit()
+/* Gives the pins to the SPI block, which is where they live other than while the SPIFI runs a command */
+void spiPinsSPI()
 {
 	/*
 	 * Set the port to digital mode, configure for open-collector based IO and switch into SPI mode
-	 * This sets the TX/!CS/CLK pins to outputs, RX as input
+	 * This sets the TX/!CS/CLK pins to outputs, RX as input. IO2 and IO3 are left pulled up, as WP# and HOLD#
 	 */
 	SCU->SFS_Port3[3] = SCU_SFS_MODE_1;
+	SCU->SFS_Port3[4] = SCU_SFS_MODE_0;
+	SCU->SFS_Port3[5] = SCU_SFS_MODE_0;
 	SCU->SFS_Port3[6] = SCU_SFS_MODE_1 | SCU_SFS_DPU | SCU_SFS_EIB;
 	SCU->SFS_Port3[7] = SCU_SFS_MODE_1;
 	SCU->SFS_Port3[8] = SCU_SFS_MODE_0; /* !CS needs to be under our control so do not send it into the SPI peripheral */
+}
+
+void spiInit()
+{
+	spiPinsSPI();
 	SPI->CR = 0;
 
 	/* Set !CS as GPIO output */
@@ -43,12 +58,44 @@ void spiInit()
 
 	/* Set Freescale SPI, SPO = 1, SPH = 1 */
 	SPI->CR = SPI_CR_SPO | SPI_CR_SPH | SPI_CR_MASTER | SPI_CR_DSS_EN | SPI_CR_DSS_8;
-	/* Scale the clock by 8 (the datasheet minimum) to make it 4MHz */
-	SPI->CCR = 8;
+#ifdef SPI_COMMANDS
+	spifiInit();
+#endif
+#ifdef SPI_LANES
+	sgpioInit();
+#endif
+	spiSetRate(SPI_RATE_SAFE);
 	/* Enable the interface */
 	/*SSI0_CR1_R = SSI_CR1_SSE;*/
 }
 
+/*
+ * The SPI clock is the system clock / CCR, where CCR is even and at least 8, so 204MHz divides to 17MHz by 12.
+ * With the SPIFI, that carries the reads and programs and gets the rate asked for, while the SPI block
+ * only runs the short commands and goes no faster than it can.
+ */
+uint32_t spiSetRate(uint32_t rate)
+{
+	uint32_t divisor;
+	if (rate == 0)
+		rate = 1;
+	/* Rounded so that a rate this returned gives back the same divisor */
+	divisor = clockSystem() / rate;
+	if (divisor == 0 || clockSystem() / divisor > rate)
+		divisor++;
+	if (divisor < 8)
+		divisor = 8;
+	else if (divisor > 254)
+		divisor = 254;
+	divisor = (divisor + 1) & ~1;
+	SPI->CCR = divisor;
+#ifdef SPI_COMMANDS
+	return spifiSetRate(rate);
+#else
+	return clockSystem() / divisor;
+#endif
+}
+
 void spiWrite(uint8_t data)
 {
 	uint8_t temp __attribute__((unused));
@@ -65,6 +112,41 @@ uint8_t spiRead()
 	return SPI->DR & 0xFF;
 }
 
+/* The SPI block has no FIFO to keep full, so these go a byte at a time */
+void spiWriteBlock(const uint8_t *data, size_t dataLen)
+{
+	size_t i;
+	for (i = 0; i < dataLen; i++)
+		spiWrite(data[i]);
+}
+
+void spiReadBlock(uint8_t *data, size_t dataLen)
+{
+	size_t i;
+	for (i = 0; i < dataLen; i++)
+		data[i] = spiRead();
+}
+
+/* With no DMA wired up here this runs to completion, and nothing yet needs a full-duplex block */
+void spiBlockStart(const uint8_t *tx, uint8_t *rx, size_t dataLen)
+{
+	if (tx != NULL)
+		spiWriteBlock(tx, dataLen);
+	else if (rx != NULL)
+		spiReadBlock(rx, dataLen);
+	else
+	{
+		size_t i;
+		for (i = 0; i < dataLen; i++)
+			spiWrite(0);
+	}
+}
+
+bool spiBlockDone()
+{
+	return true;
+}
+
 void spiChipSelect(bool select)
 {
 	if (select)
@@ -0,0 +1,276 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The SPIFI's command engine, behind the SPI_COMMANDS part of SPI.h. It runs one Flash instruction at a time,
+ * going over 2 or 4 lines for the parts the command says, and we move the data through its FIFO a word at a time.
+ */
+#include <LPC4370.h>
+#include "SPI.h"
+#include "SPIFI.h"
+#include "Clock.h"
+
+/* The fastest the SPIFI is specified to run at */
+#define SPIFI_RATE_MAX		104000000
+/* What we clock out for the mode bits of a read that has them, which keeps the device out of its continuous read mode */
+#define SPIFI_MODE_BITS		0xFF
+
+void spiPinsSPIFI()
+{
+	/* The clock's input buffer is on so its feedback can time the reads, and nothing is pulled or filtered */
+	SCU->SFS_Port3[3] = SCU_SFS_MODE_3 | SCU_SFS_DPU | SCU_SFS_EIB | SCU_SFS_EHS | SCU_SFS_DIF;
+	SCU->SFS_Port3[4] = SCU_SFS_MODE_3 | SCU_SFS_DPU | SCU_SFS_EIB | SCU_SFS_EHS | SCU_SFS_DIF;
+	SCU->SFS_Port3[5] = SCU_SFS_MODE_3 | SCU_SFS_DPU | SCU_SFS_EIB | SCU_SFS_EHS | SCU_SFS_DIF;
+	SCU->SFS_Port3[6] = SCU_SFS_MODE_3 | SCU_SFS_DPU | SCU_SFS_EIB | SCU_SFS_EHS | SCU_SFS_DIF;
+	SCU->SFS_Port3[7] = SCU_SFS_MODE_3 | SCU_SFS_DPU | SCU_SFS_EIB | SCU_SFS_EHS | SCU_SFS_DIF;
+	SCU->SFS_Port3[8] = SCU_SFS_MODE_3 | SCU_SFS_DPU | SCU_SFS_EHS;
+}
+
+void spifiInit()
+{
+	SPIFI->STAT = SPIFI_STAT_RESET;
+	while (SPIFI->STAT & SPIFI_STAT_RESET);
+	/* Mode 3 like the SPI block, so the clock idles at the same level whichever has the pins */
+	SPIFI->CTRL = SPIFI_CTRL_TIMEOUT_M | (1 << SPIFI_CTRL_CSHIGH_S) | SPIFI_CTRL_MODE3 | SPIFI_CTRL_FBCLK;
+}
+
+/* The SPIFI clock is whatever the core runs from, divided by IDIVE's 1 to 256 */
+uint32_t spifiSetRate(uint32_t rate)
+{
+	uint32_t divisor;
+	if (rate == 0)
+		rate = 1;
+	else if (rate > SPIFI_RATE_MAX)
+		rate = SPIFI_RATE_MAX;
+	divisor = clockSystem() / rate;
+	if (divisor == 0 || clockSystem() / divisor > rate)
+		divisor++;
+	if (divisor > 256)
+		divisor = 256;
+	CGU_IDIVE_CTRL = (CGU_BASE_M4_CLK & CGU_CTRL_CLK_SEL_M) | CGU_CTRL_AUTOBLOCK |
+		(((divisor - 1) << CGU_IDIVE_CTRL_IDIV_S) & CGU_IDIVE_CTRL_IDIV_M);
+	CGU_BASE_SPIFI_CLK = CGU_CTRL_CLK_SEL_IDIVE | CGU_CTRL_AUTOBLOCK;
+	return clockSystem() / divisor;
+}
+
+/* Sets the SPIFI up for command and returns its CMD register value for a data phase of dataLen */
+static uint32_t spifiCommand(const spiCommand_t *command, const uint32_t addr, const size_t dataLen)
+{
+	uint32_t cmd = ((uint32_t)command->opcode << SPIFI_CMD_OPCODE_S) | (dataLen & SPIFI_CMD_DATALEN_M);
+	uint8_t addrLines = 1;
+
+	if (command->lines == SPI_LINES_1_1_2 || command->lines == SPI_LINES_1_1_4)
+		cmd |= SPIFI_CMD_FIELDFORM_DATA;
+	else if (command->lines == SPI_LINES_1_2_2)
+	{
+		cmd |= SPIFI_CMD_FIELDFORM_ADDR;
+		addrLines = 2;
+	}
+	else if (command->lines == SPI_LINES_1_4_4)
+	{
+		cmd |= SPIFI_CMD_FIELDFORM_ADDR;
+		addrLines = 4;
+	}
+	if (command->lines == SPI_LINES_1_1_2 || command->lines == SPI_LINES_1_2_2)
+		SPIFI->CTRL |= SPIFI_CTRL_DUAL;
+	else
+		SPIFI->CTRL &= ~SPIFI_CTRL_DUAL;
+
+	if (command->addrBytes == 4)
+		cmd |= SPIFI_CMD_FRAMEFORM_OP4;
+	else if (command->addrBytes == 3)
+		cmd |= SPIFI_CMD_FRAMEFORM_OP3;
+	else
+		cmd |= SPIFI_CMD_FRAMEFORM_OP;
+	/* The wait clocks go out as intermediate bytes, over however many lines the address did */
+	cmd |= ((command->waitClocks * addrLines) / 8) << SPIFI_CMD_INTLEN_S;
+
+	SPIFI->ADDR = addr;
+	SPIFI->IDATA = SPIFI_MODE_BITS;
+	return cmd;
+}
+
+void spiCommandRead(const spiCommand_t *command, uint32_t addr, uint8_t *data, size_t dataLen)
+{
+	spiPinsSPIFI();
+	/* A command moves at most DATALEN's worth, so a longer read is several */
+	while (dataLen != 0)
+	{
+		const size_t len = dataLen < SPIFI_CMD_DATALEN_M ? dataLen : SPIFI_CMD_DATALEN_M;
+		size_t i = 0;
+		SPIFI->CMD = spifiCommand(command, addr, len);
+		for (; i + 4 <= len; i += 4)
+		{
+			const uint32_t word = SPIFI->DATA;
+			data[i] = word;
+			data[i + 1] = word >> 8;
+			data[i + 2] = word >> 16;
+			data[i + 3] = word >> 24;
+		}
+		for (; i < len; i++)
+			data[i] = SPIFI->DATA8;
+		while (SPIFI->STAT & SPIFI_STAT_CMD);
+		addr += len;
+		data += len;
+		dataLen -= len;
+	}
+	spiPinsSPI();
+}
+
+void spiCommandWrite(const spiCommand_t *command, uint32_t addr, const uint8_t *data, size_t dataLen)
+{
+	size_t i = 0;
+	spiPinsSPIFI();
+	/* Nothing we write (a page, or a status register or two) comes near DATALEN */
+	SPIFI->CMD = spifiCommand(command, addr, dataLen) | SPIFI_CMD_DOUT;
+	for (; i + 4 <= dataLen; i += 4)
+		SPIFI->DATA = data[i] | ((uint32_t)data[i + 1] << 8) | ((uint32_t)data[i + 2] << 16) | ((uint32_t)data[i + 3] << 24);
+	for (; i < dataLen; i++)
+		SPIFI->DATA8 = data[i];
+	/* The device is only deselected, starting the write, once the last of it has gone out */
+	while (SPIFI->STAT & SPIFI_STAT_CMD);
+	spiPinsSPI();
+}
+
+void spiPollStart(uint8_t opcode, uint8_t bit, bool value)
+{
+	spiPinsSPIFI();
+	SPIFI->CTRL &= ~SPIFI_CTRL_DUAL;
+	/* For a poll, DATALEN is the bit to watch and the value to wait for */
+	SPIFI->CMD = ((uint32_t)opcode << SPIFI_CMD_OPCODE_S) | SPIFI_CMD_FRAMEFORM_OP | SPIFI_CMD_POLL |
+		(value ? 0x08 : 0x00) | (bit & 0x07);
+}
+
+bool spiPollDone()
+{
+	uint8_t status __attribute__((unused));
+	if (SPIFI->STAT & SPIFI_STAT_CMD)
+		return false;
+	/* The status byte that ended the poll is left for us */
+	status = SPIFI->DATA8;
+	spiPinsSPI();
+	return true;
+}
+
+void spiPollStop()
+{
+	/* Resetting the SPIFI abandons the command and deselects the device */
+	SPIFI->STAT = SPIFI_STAT_RESET;
+	while (SPIFI->STAT & SPIFI_STAT_RESET);
+	spiPinsSPI();
+}
+
+#ifdef SPI_MAPPED
+/* The DMA channel that copies out of the window, and the most one transfer moves in units of its source width */
+#define SPIFI_DMA			(&GPDMA->CH[0])
+#define SPIFI_DMA_MAX		GPDMA_CONTROL_TRANSFERSIZE_M
+
+const uint8_t *spiMap(const spiCommand_t *command, uint32_t size)
+{
+	if (size > SPIFI_WINDOW_SIZE)
+		return NULL;
+	spiPinsSPIFI();
+	/* From here on, each read of the window that misses the SPIFI's buffer runs command at that address */
+	SPIFI->MCMD = spifiCommand(command, 0, 0);
+	GPDMA->CONFIG = GPDMA_CONFIG_E;
+	return (const uint8_t *)SPIFI_WINDOW;
+}
+
+void spiUnmap()
+{
+	/* Resetting the SPIFI takes it back out of memory mode */
+	SPIFI->STAT = SPIFI_STAT_RESET;
+	while (SPIFI->STAT & SPIFI_STAT_RESET);
+	spiPinsSPI();
+}
+
+/*
+ * Moves count units of the source width from src to dst memory to memory, and waits it out. The window is read
+ * over AHB master 0, which reaches the CRC engine too, leaving master 1 to write to RAM.
+ */
+static void spifiDMA(const void *src, volatile void *dst, const uint32_t count, const uint32_t control)
+{
+	GPDMA->INTTCCLEAR = 0x01;
+	GPDMA->INTERRCLR = 0x01;
+	SPIFI_DMA->SRCADDR = (uint32_t)src;
+	SPIFI_DMA->DESTADDR = (uint32_t)dst;
+	SPIFI_DMA->LLI = 0;
+	SPIFI_DMA->CONTROL = control | GPDMA_CONTROL_SI | (count & GPDMA_CONTROL_TRANSFERSIZE_M);
+	SPIFI_DMA->CONFIG = GPDMA_CH_CONFIG_FLOW_M2M | GPDMA_CH_CONFIG_E;
+	/* The channel disables itself when it is done */
+	while (GPDMA->ENBLDCHNS & 0x01);
+}
+
+void spiMapRead(const uint8_t *window, uint8_t *data, size_t dataLen)
+{
+	const uint32_t toRAM = GPDMA_CONTROL_D | GPDMA_CONTROL_DI;
+	/* Whole words where both ends line up, else a byte at a time */
+	if ((((uint32_t)window | (uint32_t)data) & 3) == 0)
+	{
+		while (dataLen >= 4)
+		{
+			const uint32_t words = dataLen / 4 < SPIFI_DMA_MAX ? dataLen / 4 : SPIFI_DMA_MAX;
+			spifiDMA(window, data, words, toRAM |
+				(GPDMA_WIDTH_32 << GPDMA_CONTROL_SWIDTH_S) | (GPDMA_WIDTH_32 << GPDMA_CONTROL_DWIDTH_S));
+			window += words * 4;
+			data += words * 4;
+			dataLen -= words * 4;
+		}
+	}
+	while (dataLen != 0)
+	{
+		const uint32_t bytes = dataLen < SPIFI_DMA_MAX ? dataLen : SPIFI_DMA_MAX;
+		spifiDMA(window, data, bytes, toRAM |
+			(GPDMA_WIDTH_8 << GPDMA_CONTROL_SWIDTH_S) | (GPDMA_WIDTH_8 << GPDMA_CONTROL_DWIDTH_S));
+		window += bytes;
+		data += bytes;
+		dataLen -= bytes;
+	}
+}
+
+static uint32_t reverseBits(const uint32_t value)
+{
+	uint32_t result;
+	__asm__("rbit %0, %1" : "=r" (result) : "r" (value));
+	return result;
+}
+
+/*
+ * The CRC engine is fed by DMA, reading the window a word at a time and writing it in a byte at a time so each
+ * byte goes in in order and, bit reversed, least significant bit first as the reflected CRC32 takes them.
+ * Its sum is kept unreflected, so is seeded with crc reversed and read back reversed.
+ */
+uint32_t spiMapCRC(uint32_t crc, const uint8_t *window, size_t dataLen)
+{
+	CRC->MODE = CRC_MODE_POLY_32 | CRC_MODE_BIT_RVS_WR | CRC_MODE_BIT_RVS_SUM;
+	CRC->SEED = reverseBits(crc);
+	for (; dataLen != 0 && ((uint32_t)window & 3) != 0; dataLen--)
+		CRC->WR_DATA8 = *window++;
+	while (dataLen >= 4)
+	{
+		const uint32_t words = dataLen / 4 < SPIFI_DMA_MAX ? dataLen / 4 : SPIFI_DMA_MAX;
+		spifiDMA(window, &CRC->WR_DATA8, words,
+			(GPDMA_WIDTH_32 << GPDMA_CONTROL_SWIDTH_S) | (GPDMA_WIDTH_8 << GPDMA_CONTROL_DWIDTH_S));
+		window += words * 4;
+		dataLen -= words * 4;
+	}
+	for (; dataLen != 0; dataLen--)
+		CRC->WR_DATA8 = *window++;
+	return CRC->SUM;
+}
+#endif
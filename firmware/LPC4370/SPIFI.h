@@ -0,0 +1,32 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPIFI_H
+#define SPIFI_H
+
+#include <stdint.h>
+
+/* The SPIFI shares port 3's pins with the SPI block, so they are handed back and forth around each command */
+extern void spiPinsSPI();
+extern void spiPinsSPIFI();
+
+extern void spifiInit();
+/* Sets the SPIFI's clock as close to rate as its divider gets without going over, returning the rate it got */
+extern uint32_t spifiSetRate(uint32_t rate);
+
+#endif /*SPIFI_H*/
@@ -18,6 +18,8 @@
 
 /* The startup code for the LPC4370's Cortex-M4 */
 #include <stdint.h>
+#include <LPC4370.h>
+#include "Clock.h"
 
 #ifndef NULL
 #define NULL	(void *)0
@@ -113,6 +115,62 @@ irqFunction vectorTable[] __attribute__((section(".nvic_table"))) =
 	irqEmptyDef /* QEI */
 };
 
+/* We come out of reset on the 12MHz IRC, and PLL1 multiplies the board's 12MHz crystal by 17 for 204MHz */
+#define CLOCK_IRC		12000000
+#define CLOCK_XTAL		12000000
+#define CLOCK_PLL1_M	17
+#define CLOCK_PLL		(CLOCK_XTAL * CLOCK_PLL1_M)
+/* How many times we poll for the PLL locking before giving up and staying on the IRC */
+#define CLOCK_TIMEOUT	100000
+
+static uint32_t clockHz = CLOCK_IRC;
+
+/* Spins for at least us microseconds at the current clock rate, as each go round the loop takes 4 or more cycles */
+static void clockDelay(const uint32_t us)
+{
+	volatile uint32_t count = (clockHz / 4000000) * us;
+	while (count-- != 0);
+}
+
+void clockInit()
+{
+	uint32_t timeout;
+	/* Start the cycle counter clockTicks() reads, which counts whatever the clock ends up running at */
+	DEMCR |= DEMCR_TRCENA;
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+	/* Start the crystal oscillator, which takes 250us to settle */
+	CGU_XTAL_OSC_CTRL &= ~(CGU_XTAL_OSC_CTRL_PD | CGU_XTAL_OSC_CTRL_BYPASS | CGU_XTAL_OSC_CTRL_HF);
+	clockDelay(250);
+	/*
+	 * Bring PLL1 up off the crystal with its output divided by 2 for 102MHz, as jumping the core straight
+	 * from the IRC to more than 110MHz is outside what the datasheet allows
+	 */
+	CGU_PLL1_CTRL = CGU_CTRL_CLK_SEL_XTAL | CGU_CTRL_AUTOBLOCK | ((CLOCK_PLL1_M - 1) << CGU_PLL1_CTRL_MSEL_S);
+	for (timeout = CLOCK_TIMEOUT; (CGU_PLL1_STAT & CGU_PLL1_STAT_LOCK) == 0; timeout--)
+	{
+		if (timeout == 0)
+			return;
+	}
+	CGU_BASE_M4_CLK = CGU_CTRL_CLK_SEL_PLL1 | CGU_CTRL_AUTOBLOCK;
+	clockHz = CLOCK_PLL / 2;
+	clockDelay(50);
+	/* Then take the divider out for the full rate, which the SPI divides down from too */
+	CGU_PLL1_CTRL |= CGU_PLL1_CTRL_DIRECT;
+	clockHz = CLOCK_PLL;
+	CGU_BASE_SPI_CLK = CGU_CTRL_CLK_SEL_PLL1 | CGU_CTRL_AUTOBLOCK;
+}
+
+uint32_t clockSystem()
+{
+	return clockHz;
+}
+
+uint32_t clockTicks()
+{
+	return DWT_CYCCNT;
+}
+
 void irqReset()
 {
 	uint32_t *src, *dst;
@@ -128,6 +186,7 @@ void irqReset()
 		while (dst < &_end_bss)
 			*dst++ = 0;
 
+		clockInit();
 		main();
 	}
 }
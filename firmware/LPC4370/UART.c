@@ -16,30 +16,84 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * The link to the host is the CDC interface on USB0, so this presents that
+ * through the same interface the UART drivers do for the other targets.
+ * In a DUALCORE build, the M0 application core drives USB0 and we only see the link's slots.
+ */
+
 #include "UART.h"
 #include "USB.h"
+#include "USBLink.h"
+#include "Clock.h"
+#ifdef DUALCORE
+#include "M0.h"
+#endif
 
 void uartInit()
 {
+	usbLinkInit();
+#ifdef DUALCORE
+	m0Boot();
+#else
 	usbInit();
+	usbAttach();
+#endif
 }
 
 void uartWrite(uint8_t data)
 {
+	usbWriteByte(data);
+}
+
+/* Bytes can go straight into the link's transmit slots */
+uint8_t *uartWriteBuffer(size_t *dataLen)
+{
+	return usbWriteBuffer(dataLen);
+}
+
+void uartWriteCommit(size_t dataLen)
+{
+	usbWriteCommit(dataLen);
 }
 
 uint8_t uartRead()
 {
-	return 0;
+	/* Whatever we've said so far has to go out before the host can reply to it */
+	while (!usbReadReady())
+		usbWriteFlush();
+	return usbReadByte();
 }
 
 bool uartHaveData()
 {
-	return false;
+	usbWriteFlush();
+	return usbReadReady();
 }
 
 uint8_t uartPeak()
 {
-	return 0;
+	return uartRead();
 }
 
+/* The link to the host is USB, so the rate it asks for doesn't change anything */
+bool uartBaudSupported(uint32_t baud)
+{
+	(void)baud;
+	return true;
+}
+
+bool uartSetBaud(uint32_t baud)
+{
+	(void)baud;
+	return true;
+}
+
+bool uartWaitData(uint16_t timeout)
+{
+	const uint32_t start = clockTicks();
+	const uint32_t ticks = (clockSystem() / 1000) * timeout;
+	bool ready;
+	while (!(ready = uartHaveData()) && clockTicks() - start < ticks);
+	return ready;
+}
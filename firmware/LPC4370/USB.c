@@ -22,6 +22,13 @@
 #include "USB.h"
 #include "USBTypes.h"
 #include "USBRequests.h"
+#include "USBLink.h"
+
+/* PLL0USB takes the 12MHz crystal up to the 480MHz the high speed PHY needs, with the settings the user manual gives */
+#define USB_PLL_MDIV			0x06167FFA
+#define USB_PLL_NP_DIV			0x00302062
+/* How many times we poll for the PLL locking before giving up */
+#define USB_PLL_TIMEOUT			100000
 
 volatile usbDeviceState usbState;
 volatile usbEP_t usbPacket;
@@ -38,12 +45,37 @@ usbEPStatus_t usbStatusOutEP[USB_ENDPOINTS];
 /* Defines the buffer descriptor table and places it at it's aligned address in RAM */
 volatile usbBDTEntry_t usbBDT[USB_BDT_ENTRIES] USB_BTD_ADDR;
 /* Define endpoint 0's buffers */
-volatile usbTD_t setupTD USB_TD_ALIGN;
+volatile usbSetupPacket_t usbSetup USB_EP0_SETUP_ADDR;
 volatile usbTD_t dataTD USB_TD_ALIGN;
-volatile uint8_t usbEP0Data[USB_EP0_DATA_LEN] USB_EP0_DATA_ADDR;
+volatile usbTD_t statusTD USB_TD_ALIGN;
+volatile uint8_t usbEP0Data[USB_EP0_BUFFER_LEN] USB_EP0_DATA_ADDR;
+
+/* And endpoint 1's, one per link slot, along with the last TD queued to each direction (nullptr when none has been yet) */
+volatile usbTD_t usbRxTD[USB_RX_SLOTS] USB_TD_ALIGN;
+volatile usbTD_t usbTxTD[USB_TX_SLOTS] USB_TD_ALIGN;
+volatile usbTD_t *usbRxLast, *usbTxLast;
+
+/* Whether the link is running, and how far into each ring we have handed slots to the controller */
+volatile bool usbLinkUp;
+uint8_t usbRxArmed, usbTxQueued;
 
 void usbInit()
 {
+	uint32_t timeout;
+
+	/* The controller runs from PLL0USB, so bring that up first */
+	CGU_PLL0USB_CTRL |= CGU_PLL0USB_CTRL_PD;
+	CGU_PLL0USB_MDIV = USB_PLL_MDIV;
+	CGU_PLL0USB_NP_DIV = USB_PLL_NP_DIV;
+	CGU_PLL0USB_CTRL = CGU_CTRL_CLK_SEL_XTAL | CGU_CTRL_AUTOBLOCK | CGU_PLL0USB_CTRL_DIRECTI |
+		CGU_PLL0USB_CTRL_DIRECTO | CGU_PLL0USB_CTRL_CLKEN;
+	for (timeout = USB_PLL_TIMEOUT; (CGU_PLL0USB_STAT & CGU_PLL0USB_STAT_LOCK) == 0; timeout--)
+	{
+		if (timeout == 0)
+			return;
+	}
+	CGU_BASE_USB0_CLK = CGU_CTRL_CLK_SEL_PLL0USB | CGU_CTRL_AUTOBLOCK;
+
 	NVIC_CLRIE0 &= ~(1 << 8);
 	NVIC_CLRPND0 &= ~(1 << 8);
 	SYSCTL_CREG0 &= ~SYSCTL_CREG0_USBPD;
@@ -89,7 +121,7 @@ void usbReset()
 	 *     USB Error (UEIE)
 	 *     Start-Of-Frame (SRIE)
 	 */
-	USB0->usbIE = USB_INT_UEIE | USB_INT_PCIE | USB_DINT_URIE | USB_INT_SRIE | USB_DINT_SLIE;
+	USB0->usbIE = USB_INT_UIE | USB_INT_UEIE | USB_INT_PCIE | USB_DINT_URIE | USB_INT_SRIE | USB_DINT_SLIE;
 
 	/* Reset the ping-pong buffers, bus address and transfer status */
 	USB0->epSetupStat = USB0->epSetupStat;
@@ -105,7 +137,7 @@ void usbReset()
 		usbBDT[i].activeTD.nextTD = USB_INVALID_TD;
 		usbBDT[i].epCaps &= ~(USB_EPCAP_LEN_MASK | USB_EPCAP_IOS | USB_EPCAP_ZLT | USB_EPCAP_MULT_MASK);
 	}
-	usbBDT[0].epCaps |= ((USB_EP0_SETUP_LEN << 16) & USB_EPCAP_LEN_MASK) | USB_EPCAP_IOS;
+	usbBDT[0].epCaps |= ((USB_EP0_DATA_LEN << 16) & USB_EPCAP_LEN_MASK) | USB_EPCAP_IOS;
 	usbBDT[1].epCaps |= (USB_EP0_DATA_LEN << 16) & USB_EPCAP_LEN_MASK;
 	USB0->listAddr = (uint32_t)&usbBDT;
 
@@ -131,29 +163,13 @@ void usbReset()
 		usbStatusOutEP[i].ep.buff = 0;
 	}
 
-	/* Prepare for an EP0 Setup packet */
+	/* Prepare for an EP0 Setup packet, which the controller writes straight into the queue head */
 	USB0->epCtrl0 = USB_EP_RX_TYPE_CTRL | USB_EP_RXR | USB_EP_RXE | USB_EP_TX_TYPE_CTRL | USB_EP_TXR | USB_EP_TXE;
-	setupTD.nextTD = USB_INVALID_TD;
-	setupTD.status = ((USB_EP0_SETUP_LEN << 16) & USB_TD_COUNT_MASK) | USB_TD_IOC;
-	setupTD.buffer0 = &usbBDT[0].setupPacket;
-	setupTD.buffer1 = nullptr;
-	setupTD.buffer2 = nullptr;
-	setupTD.buffer3 = nullptr;
-	setupTD.buffer4 = nullptr;
-	usbBDT[0].activeTD.nextTD = &setupTD;
-	USB0->epPrime |= USB_EP0_RX_MASK;
-
-	dataTD.nextTD = USB_INVALID_TD;
-	dataTD.status = ((USB_EP0_DATA_LEN << 16) & USB_TD_COUNT_MASK) | USB_TD_IOC;
-	dataTD.buffer0 = usbEP0Data;
-	dataTD.buffer1 = nullptr;
-	dataTD.buffer2 = nullptr;
-	dataTD.buffer3 = nullptr;
-	dataTD.buffer4 = nullptr;
 
 	/* Finally, idle the peripheral */
 	usbState = USB_STATE_DETACHED;
 	usbActiveConfig = 0;
+	usbLinkUp = false;
 }
 
 void usbAttach()
@@ -207,12 +223,114 @@ void usbSuspend()
 	usbSuspended = true;
 }
 
+void usbFillTD(volatile usbTD_t *td, volatile void *buffer, const uint16_t length, const uint32_t flags)
+{
+	td->nextTD = USB_INVALID_TD;
+	td->status = ((length << 16) & USB_TD_COUNT_MASK) | flags | USB_TD_ACTIVE;
+	td->buffer0 = buffer;
+	td->buffer1 = nullptr;
+	td->buffer2 = nullptr;
+	td->buffer3 = nullptr;
+	td->buffer4 = nullptr;
+}
+
+/* Starts the endpoint on td, for when it has nothing else queued */
+void usbPrimeTD(const uint8_t bdtIndex, const uint32_t epMask, volatile usbTD_t *td)
+{
+	usbBDT[bdtIndex].activeTD.nextTD = td;
+	usbBDT[bdtIndex].activeTD.status &= ~(USB_TD_ACTIVE | USB_TD_HALTED);
+	USB0->epPrime = epMask;
+}
+
+/*
+ * Adds td to the end of the endpoint's queue, after *last. If the controller ran off the end of the queue
+ * before it saw the link, which the ATDTW tripwire tells us without racing it, the endpoint has to be primed again.
+ */
+void usbQueueTD(const uint8_t bdtIndex, const uint32_t epMask, volatile usbTD_t *td, volatile usbTD_t **last)
+{
+	bool active;
+
+	if (*last == nullptr || *last == td)
+		usbPrimeTD(bdtIndex, epMask, td);
+	else
+	{
+		(*last)->nextTD = td;
+		if ((USB0->epPrime & epMask) == 0)
+		{
+			do
+			{
+				USB0->usbCmd |= USB_DCMD_ATDTW;
+				active = (USB0->epStat & epMask) != 0;
+			}
+			while ((USB0->usbCmd & USB_DCMD_ATDTW) == 0);
+			USB0->usbCmd &= ~USB_DCMD_ATDTW;
+			if (!active)
+				usbPrimeTD(bdtIndex, epMask, td);
+		}
+	}
+	*last = td;
+}
+
+void usbStallCtrlEP()
+{
+	USB0->epCtrl0 |= USB_EP_RX_STALLED | USB_EP_TX_STALLED;
+}
+
 void usbHandleDataCtrlEP()
 {
+	uint16_t length = usbSetup.length;
+	if (length > USB_EP0_BUFFER_LEN)
+		length = USB_EP0_BUFFER_LEN;
+
+	if (usbCtrlState == USB_CTRL_STATE_TX)
+	{
+		usbEPStatus_t *status = &usbStatusInEP[0];
+		uint16_t i, count = 0;
+
+		if (status->xferCount < length)
+			length = status->xferCount;
+		/* Gather the reply up, a descriptor made of several parts being copied in one part at a time */
+		if (status->multiPart)
+		{
+			uint8_t part;
+			for (part = 0; part < status->partDesc->numDesc && count < length; part++)
+			{
+				const usbMultiPartDesc_t *desc = &status->partDesc->descriptors[part];
+				const uint8_t *data = desc->descriptor;
+				for (i = 0; i < desc->length && count < length; i++)
+					usbEP0Data[count++] = data[i];
+			}
+		}
+		else if (status->buffSrc == USB_BUFFER_SRC_FLASH)
+		{
+			for (; count < length; count++)
+				usbEP0Data[count] = status->buffer.flashBuff[count];
+		}
+		else
+		{
+			for (; count < length; count++)
+				usbEP0Data[count] = ((volatile uint8_t *)status->buffer.memPtr)[count];
+		}
+		usbFillTD(&dataTD, usbEP0Data, count, USB_TD_IOC);
+		usbPrimeTD(USB_BDT_INDEX(0, USB_DIR_IN), USB_EP0_TX_MASK, &dataTD);
+	}
+	else
+	{
+		if (usbStatusOutEP[0].xferCount < length)
+			length = usbStatusOutEP[0].xferCount;
+		usbFillTD(&dataTD, usbEP0Data, length, USB_TD_IOC);
+		usbPrimeTD(USB_BDT_INDEX(0, USB_DIR_OUT), USB_EP0_RX_MASK, &dataTD);
+	}
 }
 
+/* The status stage is a zero length packet the other way to the data */
 void usbHandleStatusCtrlEP()
 {
+	usbFillTD(&statusTD, nullptr, 0, USB_TD_IOC);
+	if (usbCtrlState == USB_CTRL_STATE_TX)
+		usbPrimeTD(USB_BDT_INDEX(0, USB_DIR_OUT), USB_EP0_RX_MASK, &statusTD);
+	else
+		usbPrimeTD(USB_BDT_INDEX(0, USB_DIR_IN), USB_EP0_TX_MASK, &statusTD);
 }
 
 void usbServiceCtrlEPComplete()
@@ -230,15 +348,13 @@ void usbServiceCtrlEPComplete()
 		}
 		else
 		{
-			/* If nothing handled the request, get ready for the next SETUP token */
-
-			/* And stall the IN endpoint */
+			/* If nothing handled the request, stall it - the next SETUP token clears this */
+			usbStallCtrlEP();
 		}
 	}
 	else
 	{
-		volatile usbSetupPacket_t *packet = &usbBDT[0].setupPacket;
-		if (packet->requestType.direction == USB_DIR_IN)
+		if (usbSetup.requestType.direction == USB_DIR_IN)
 		{
 			/* <SETUP[0]><IN[1]><IN[0]>...<OUT[1]> */
 			usbCtrlState = USB_CTRL_STATE_TX;
@@ -253,9 +369,6 @@ void usbServiceCtrlEPComplete()
 		{
 			/* <SETUP[0] (OUT)><IN[1]> */
 			usbCtrlState = USB_CTRL_STATE_RX;
-
-			/* Get ready for the next SETUP token */
-
 			usbStageLock1 = false;
 			usbStageLock2 = false;
 			if ((usbDeferalFlags & USB_DEFER_STATUS_PACKETS) == 0)
@@ -264,9 +377,8 @@ void usbServiceCtrlEPComplete()
 	}
 }
 
-bool usbHandleStandardRequest(volatile usbBDTEntry_t *BD)
+bool usbHandleStandardRequest(volatile usbSetupPacket_t *packet)
 {
-	volatile usbSetupPacket_t *packet = &BD->setupPacket;
 	if (packet->requestType.type != USB_REQUEST_TYPE_STANDARD)
 		return false;
 
@@ -314,8 +426,10 @@ bool usbHandleStandardRequest(volatile usbBDTEntry_t *BD)
 			usbRequestDoFeature(packet);
 			return true;
 		case USB_REQUEST_GET_INTERFACE:
-			/* Set source and types */
+			/* We only have alternate 0 of each interface */
+			usbEP0Data[0] = 0;
 			usbStatusInEP[0].buffSrc = USB_BUFFER_SRC_MEM;
+			usbStatusInEP[0].buffer.memPtr = usbEP0Data;
 			usbStatusInEP[0].xferCount = 1;
 			usbStatusInEP[0].needsArming = 1;
 			return true;
@@ -333,10 +447,31 @@ bool usbHandleStandardRequest(volatile usbBDTEntry_t *BD)
 	return false;
 }
 
+/*
+ * Takes a copy of the setup packet, which the controller is free to overwrite should another arrive meanwhile.
+ * The SUTW tripwire tells us when it did, in which case we copy it again.
+ */
+void usbReadSetup()
+{
+	volatile uint32_t *setup = (volatile uint32_t *)&usbBDT[0].setupPacket;
+	volatile uint32_t *copy = (volatile uint32_t *)&usbSetup;
+
+	USB0->epSetupStat = USB_EP0_RX_MASK;
+	do
+	{
+		USB0->usbCmd |= USB_DCMD_SUTW;
+		copy[0] = setup[0];
+		copy[1] = setup[1];
+	}
+	while ((USB0->usbCmd & USB_DCMD_SUTW) == 0);
+	USB0->usbCmd &= ~USB_DCMD_SUTW;
+}
+
 void usbHandleCtrlEPSetup()
 {
 	bool processed;
 
+	usbReadSetup();
 	/* Reset in buffers for EP0 (de-arm them) to get to a clean state for this call */
 	while (USB0->epPrime & 0x00010001);
 	USB0->epFlush = 0x00010001;
@@ -349,18 +484,31 @@ void usbHandleCtrlEPSetup()
 	usbStatusInEP[0].xferCount = 0;
 	usbStatusOutEP[0].value = 0;
 	usbStatusOutEP[0].xferCount = 0;
+	usbStatusOutEP[0].func = nullptr;
 
 	/* Handle the request */
-	processed = usbHandleStandardRequest(&usbBDT[usbPacket.bdtIndex]);
-	// CDC here
+	processed = usbHandleStandardRequest(&usbSetup);
+	if (!processed)
+		processed = usbRequestCDC(&usbSetup);
 
-	usbServiceCtrlEPComplete();
-	USB0->epSetupStat = 0x00000001;
+	if (processed)
+		usbServiceCtrlEPComplete();
+	else
+		usbStallCtrlEP();
 }
 
 void usbHandleCtrlEPOut()
 {
 	USB0->epComplete = 0x00000001;
+	/* Once the data for a request that sends us some has arrived, act on it and then acknowledge */
+	if (usbCtrlState == USB_CTRL_STATE_RX && usbStatusOutEP[0].needsArming)
+	{
+		usbStatusOutEP[0].needsArming = 0;
+		if (usbStatusOutEP[0].func)
+			usbStatusOutEP[0].func();
+		if ((usbDeferalFlags & USB_DEFER_STATUS_PACKETS) == 0)
+			usbHandleStatusCtrlEP();
+	}
 }
 
 void usbHandleCtrlEPIn()
@@ -381,6 +529,102 @@ void usbServiceCtrlEP()
 		usbHandleCtrlEPIn();
 }
 
+/* EP1's TDs interrupt on completion, so the link is serviced once we've acknowledged them */
+void usbServiceDataEP()
+{
+	USB0->epComplete = (USB_EP0_RX_MASK | USB_EP0_TX_MASK) << usbPacket.epNum;
+}
+
+uint16_t usbBulkLen()
+{
+	if ((USB0->portSC1 & USB_SC1_PSPD_MASK) == USB_SC1_PSPD_HS)
+		return USB_EP1_IN_LEN;
+	return USB_EP1_FS_LEN;
+}
+
+/* Starts the link over for a fresh configuration, dropping anything either ring held */
+void usbDataInit(const uint16_t packetLen)
+{
+	uint8_t i;
+
+	usbLinkUp = false;
+	/* Zero length packets are ours to send, as only we know where a reply ends */
+	usbBDT[USB_BDT_INDEX(1, USB_DIR_OUT)].epCaps = ((packetLen << 16) & USB_EPCAP_LEN_MASK) | USB_EPCAP_ZLT;
+	usbBDT[USB_BDT_INDEX(1, USB_DIR_IN)].epCaps = ((packetLen << 16) & USB_EPCAP_LEN_MASK) | USB_EPCAP_ZLT;
+	USB0->epFlush = USB_EP1_RX_MASK | USB_EP1_TX_MASK;
+	while (USB0->epFlush & (USB_EP1_RX_MASK | USB_EP1_TX_MASK));
+
+	usbRxLast = nullptr;
+	usbTxLast = nullptr;
+	for (i = 0; i < USB_RX_SLOTS; i++)
+		usbRxTD[i].status = 0;
+	for (i = 0; i < USB_TX_SLOTS; i++)
+		usbTxTD[i].status = 0;
+
+	/*
+	 * The stream side owns rxTail and txHead, so we start from wherever they are and let the new generation
+	 * tell it to catch rxTail up with rxHead and forget any slot it was part way through filling.
+	 */
+	usbRxArmed = usbLink->rxHead;
+	usbTxQueued = usbLink->txHead;
+	usbLink->txTail = usbTxQueued;
+	usbLink->packetLen = packetLen;
+	usbLinkBarrier();
+	if (++usbLink->generation == 0)
+		usbLink->generation = 1;
+	usbLinkUp = true;
+	usbServiceLink();
+}
+
+/*
+ * Moves both rings along: receive slots the controller has filled are published to the stream side and the ones
+ * it has given back are handed to the controller again, while transmit slots the stream side has filled are queued
+ * and the ones the controller has sent are given back. Runs from the USB interrupt, which the stream side raises too.
+ */
+void usbServiceLink()
+{
+	volatile usbTD_t *td;
+	uint8_t slot;
+
+	if (!usbLinkUp)
+		return;
+
+	while (usbLink->rxHead != usbRxArmed)
+	{
+		slot = usbLink->rxHead % USB_RX_SLOTS;
+		if (usbRxTD[slot].status & USB_TD_ACTIVE)
+			break;
+		/* The controller counts down what it has left to fill, so what's left over is what didn't arrive */
+		usbLink->rxLength[slot] = usbLink->packetLen - ((usbRxTD[slot].status & USB_TD_COUNT_MASK) >> 16);
+		usbLinkBarrier();
+		++usbLink->rxHead;
+	}
+	while ((uint8_t)(usbRxArmed - usbLink->rxTail) < USB_RX_SLOTS)
+	{
+		slot = usbRxArmed % USB_RX_SLOTS;
+		td = &usbRxTD[slot];
+		usbFillTD(td, usbLink->rxSlots[slot], usbLink->packetLen, USB_TD_IOC);
+		usbQueueTD(USB_BDT_INDEX(1, USB_DIR_OUT), USB_EP1_RX_MASK, td, &usbRxLast);
+		++usbRxArmed;
+	}
+
+	while (usbLink->txTail != usbTxQueued)
+	{
+		if (usbTxTD[usbLink->txTail % USB_TX_SLOTS].status & USB_TD_ACTIVE)
+			break;
+		++usbLink->txTail;
+	}
+	while (usbTxQueued != usbLink->txHead)
+	{
+		usbLinkBarrier();
+		slot = usbTxQueued % USB_TX_SLOTS;
+		td = &usbTxTD[slot];
+		usbFillTD(td, usbLink->txSlots[slot], usbLink->txLength[slot], USB_TD_IOC);
+		usbQueueTD(USB_BDT_INDEX(1, USB_DIR_IN), USB_EP1_TX_MASK, td, &usbTxLast);
+		++usbTxQueued;
+	}
+}
+
 void irqUSB()
 {
 	/*
@@ -442,6 +686,7 @@ void irqUSB()
 		return;
 
 	/* If we detect the SIE has completed IO for a transaction, handle that transaction */
+	USB0->usbIF = USB_INT_UI;
 	while ((USB0->epComplete | USB0->epSetupStat) != 0)
 	{
 		uint32_t epMask = 0x01;
@@ -468,5 +713,9 @@ void irqUSB()
 
 		if (endpointNum == 0)
 			usbServiceCtrlEP();
+		else
+			usbServiceDataEP();
 	}
+
+	usbServiceLink();
 }
@@ -26,5 +26,9 @@ extern void usbAttach();
 extern void usbDetach();
 extern void irqUSB();
 
+/* The controller side of the bulk data path, which USBLink.h describes */
+extern uint16_t usbBulkLen();
+extern void usbDataInit(const uint16_t packetLen);
+
 #endif /*USB_H*/
 
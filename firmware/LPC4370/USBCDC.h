@@ -47,7 +47,11 @@
 #define USB_ACM_LINE_CODING		0x02
 #define USB_ACM_COMM_FEAT		0x01
 
-typedef struct
+#define USB_CDC_SET_LINE_CODING			0x20
+#define USB_CDC_GET_LINE_CODING			0x21
+#define USB_CDC_SET_CONTROL_LINE_STATE	0x22
+
+typedef struct __attribute__((packed))
 {
 	uint8_t length;
 	uint8_t descriptorType;
@@ -81,5 +85,13 @@ typedef struct
 	uint8_t slaveInterface0;
 } usbCDCUnion2_t;
 
+typedef struct __attribute__((packed))
+{
+	uint32_t baudRate;
+	uint8_t stopBits;
+	uint8_t parity;
+	uint8_t dataBits;
+} usbCDCLineCoding_t;
+
 #endif	/* USBCDC_H */
 
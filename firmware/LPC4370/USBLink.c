@@ -0,0 +1,157 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The stream side of the bulk data path, which reads and writes the link's slots in place */
+#include <LPC4370.h>
+#include "USBLink.h"
+
+/* The generation of the link we are in step with, 0 being before the host has configured us */
+uint8_t usbLinkGeneration;
+/* How far into the receive slot at rxTail we have read */
+uint16_t usbRxPos;
+/* How much of the transmit slot at txHead has been written, and whether the last one sent ended on a whole packet */
+uint16_t usbTxCount;
+bool usbTxFull;
+
+void usbLinkInit()
+{
+	usbLink->rxHead = usbLink->rxTail = 0;
+	usbLink->txHead = usbLink->txTail = 0;
+	usbLink->generation = 0;
+	usbLink->packetLen = USB_EP1_FS_LEN;
+	usbLinkGeneration = 0;
+	usbRxPos = 0;
+	usbTxCount = 0;
+	usbTxFull = false;
+}
+
+/* Lets the controller side know a ring has moved */
+static void usbLinkSignal()
+{
+	usbLinkBarrier();
+#ifdef DUALCORE
+	/* Which raises the M0APP core's M4 event interrupt */
+	__asm__ __volatile__("dsb\n\tsev" : : : "memory");
+#else
+	NVIC_SETPND0 = 1 << 8;
+#endif
+}
+
+/* Catches up with a fresh configuration, dropping what was left of the old one */
+static bool usbLinkSync()
+{
+	const uint8_t generation = usbLink->generation;
+	if (generation == usbLinkGeneration)
+		return generation != 0;
+	usbLinkBarrier();
+	usbLinkGeneration = generation;
+	usbLink->rxTail = usbLink->rxHead;
+	usbRxPos = 0;
+	usbTxCount = 0;
+	usbTxFull = false;
+	usbLinkSignal();
+	return true;
+}
+
+bool usbReadReady()
+{
+	uint8_t slot;
+
+	if (!usbLinkSync())
+		return false;
+
+	while (usbLink->rxTail != usbLink->rxHead)
+	{
+		usbLinkBarrier();
+		slot = usbLink->rxTail % USB_RX_SLOTS;
+		if (usbRxPos != usbLink->rxLength[slot])
+			return true;
+		/* Everything in this slot has been read, so give it back to be filled again */
+		++usbLink->rxTail;
+		usbRxPos = 0;
+		usbLinkSignal();
+	}
+	return false;
+}
+
+/* Only valid once usbReadReady() says so */
+uint8_t usbReadByte()
+{
+	return usbLink->rxSlots[usbLink->rxTail % USB_RX_SLOTS][usbRxPos++];
+}
+
+static void usbTxQueue()
+{
+	usbLink->txLength[usbLink->txHead % USB_TX_SLOTS] = usbTxCount;
+	usbLinkBarrier();
+	++usbLink->txHead;
+	usbLinkSignal();
+	usbTxFull = usbTxCount != 0 && usbTxCount % usbLink->packetLen == 0;
+	usbTxCount = 0;
+}
+
+/* Waits for the controller side to be done sending a slot before writing into it again */
+static void usbTxWait()
+{
+	while ((uint8_t)(usbLink->txHead - usbLink->txTail) >= USB_TX_SLOTS);
+}
+
+void usbWriteByte(const uint8_t data)
+{
+	usbLinkSync();
+	if (usbTxCount == 0)
+		usbTxWait();
+	usbLink->txSlots[usbLink->txHead % USB_TX_SLOTS][usbTxCount++] = data;
+	if (usbTxCount == USB_TX_SLOT_LEN)
+		usbTxQueue();
+}
+
+/* Hands out the rest of the transmit slot being filled, for up to *dataLen bytes to be written straight into it */
+uint8_t *usbWriteBuffer(size_t *dataLen)
+{
+	size_t space;
+	usbLinkSync();
+	if (usbTxCount == 0)
+		usbTxWait();
+	space = USB_TX_SLOT_LEN - usbTxCount;
+	if (*dataLen > space)
+		*dataLen = space;
+	return &usbLink->txSlots[usbLink->txHead % USB_TX_SLOTS][usbTxCount];
+}
+
+void usbWriteCommit(const size_t dataLen)
+{
+	usbTxCount += dataLen;
+	if (usbTxCount == USB_TX_SLOT_LEN)
+		usbTxQueue();
+}
+
+/*
+ * Sends whatever has been written. A transfer that ends on a whole packet needs a
+ * zero length one after it, or the host would go on waiting for more.
+ */
+void usbWriteFlush()
+{
+	if (usbTxCount != 0)
+		usbTxQueue();
+	if (usbTxFull)
+	{
+		usbTxWait();
+		usbTxQueue();
+	}
+}
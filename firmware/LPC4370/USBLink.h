@@ -0,0 +1,73 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef USB_LINK_H
+#define USB_LINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "USBTypes.h"
+
+/*
+ * The bulk data path is split in two: the controller side (USB.c) queues the slots below to EP1 and retires them,
+ * and the stream side (USBLink.c) reads and writes the bytes in them. In a DUALCORE build the M0APP core runs
+ * the controller side and the M4 the stream side, otherwise both run on the M4 with the USB interrupt between them.
+ *
+ * The two sides share nothing but this structure, kept in the AHB SRAM at ARAM2 where both cores and the controller's
+ * DMA can reach it. Receive and transmit slots each form a single producer, single consumer ring - each index is
+ * only ever advanced by one side, after the slot contents it covers are written. Indices run freely and wrap at 256,
+ * so a slot count must divide that, and head - tail is how many slots are in the ring.
+ */
+#define USB_LINK_ADDR				0x20008000
+
+typedef struct usbLink_t
+{
+	/* First, so each slot stays aligned to its size from ARAM2's 16K boundary */
+	uint8_t txSlots[USB_TX_SLOTS][USB_TX_SLOT_LEN];
+	uint8_t rxSlots[USB_RX_SLOTS][USB_EP1_OUT_LEN];
+
+	/* Advanced by the controller side as packets arrive, and by the stream side as it finishes reading them */
+	volatile uint16_t rxLength[USB_RX_SLOTS];
+	volatile uint8_t rxHead, rxTail;
+	/* Advanced by the stream side as it fills slots (a length of 0 sends a zero length packet), and the controller side as they go */
+	volatile uint16_t txLength[USB_TX_SLOTS];
+	volatile uint8_t txHead, txTail;
+
+	/* Bumped by the controller side each time the host configures the interface, when the rings start over */
+	volatile uint8_t generation;
+	volatile uint16_t packetLen;
+} usbLink_t;
+
+#define usbLink						((usbLink_t *)USB_LINK_ADDR)
+#define usbLinkBarrier()			__asm__ __volatile__("dmb" : : : "memory")
+
+/* Controller side */
+extern void usbServiceLink();
+
+/* Stream side, which is polled. Writes are sent as each slot fills, or on usbWriteFlush() */
+extern void usbLinkInit();
+extern bool usbReadReady();
+extern uint8_t usbReadByte();
+extern void usbWriteByte(const uint8_t data);
+/* Or filled in place, usbWriteBuffer() cutting dataLen down to what is left of the slot */
+extern uint8_t *usbWriteBuffer(size_t *dataLen);
+extern void usbWriteCommit(const size_t dataLen);
+extern void usbWriteFlush();
+
+#endif /*USB_LINK_H*/
@@ -18,19 +18,19 @@
 
 #include <LPC4370.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <USBInterface.h>
 #include "USB.h"
 #include "USBTypes.h"
 #include "USBRequests.h"
 #include "USBCDC.h"
 
-#define USB_VID					0x0
-#define USB_PID					0x0
-
-#define USB_NUM_CONFIG_DESC		1
-#define USB_NUM_IFACE_DESC		2
-#define USB_NUM_ENDPOINT_DESC	3
+#define USB_NUM_CONFIG_DESC		2
+#define USB_NUM_IFACE_DESC		3
+#define USB_NUM_ENDPOINT_DESC	6
 #define USB_NUM_CONFIG_SECS		11
-#define USB_NUM_STRING_DESC		4
+#define USB_NUM_VENDOR_SECS		5
+#define USB_NUM_STRING_DESC		5
 
 #define USB_EPDIR_IN			0x80
 #define USB_EPDIR_OUT			0x00
@@ -43,14 +43,28 @@ const usbDeviceDescriptor_t usbDeviceDesc =
 	USB_CLASS_COMMS,
 	USB_SUBCLASS_NONE,
 	USB_PROTOCOL_NONE,
-	USB_EP0_SETUP_LEN,
-	USB_VID,
-	USB_PID,
+	USB_EP0_DATA_LEN,
+	SPIFP_USB_VID,
+	SPIFP_USB_PID,
 	0x0001, /* BCD encoded device version */
 	0x01, /* Manufacturer string index */
 	0x02, /* Product string index */
 	0x00, /* Temporarily do not support a serial number string */
-	USB_NUM_CONFIG_DESC /* One configuration only */
+	USB_NUM_CONFIG_DESC
+};
+
+/* What we would be at the other speed, which is the same bar the bulk endpoint size */
+const usbDeviceQualifierDescriptor_t usbDeviceQualifierDesc =
+{
+	sizeof(usbDeviceQualifierDescriptor_t),
+	USB_DESCRIPTOR_DEVICE_QUALIFIER,
+	0x0200,
+	USB_CLASS_COMMS,
+	USB_SUBCLASS_NONE,
+	USB_PROTOCOL_NONE,
+	USB_EP0_DATA_LEN,
+	USB_NUM_CONFIG_DESC,
+	0x00
 };
 
 const usbConfigDescriptor_t usbConfigDesc[USB_NUM_CONFIG_DESC] =
@@ -68,6 +82,21 @@ const usbConfigDescriptor_t usbConfigDesc[USB_NUM_CONFIG_DESC] =
 		0x03, /* Configuration string index */
 		USB_CONF_ATTR_DEFAULT | USB_CONF_ATTR_SELFPWR,
 		50 /* 100mA max */
+	},
+	/*
+	 * The same bulk endpoints again, but as a vendor specific interface with nothing in the way,
+	 * for hosts that would rather not go through a serial port driver to get at them
+	 */
+	{
+		sizeof(usbConfigDescriptor_t),
+		USB_DESCRIPTOR_CONFIGURATION,
+		sizeof(usbConfigDescriptor_t) + sizeof(usbInterfaceDescriptor_t) +
+		sizeof(usbEndpointDescriptor_t) + sizeof(usbEndpointDescriptor_t) + sizeof(usbEndpointDescriptor_t),
+		0x01, /* One interface */
+		0x02, /* This is the second configuration */
+		0x04, /* Configuration string index */
+		USB_CONF_ATTR_DEFAULT | USB_CONF_ATTR_SELFPWR,
+		50 /* 100mA max */
 	}
 };
 
@@ -94,10 +123,22 @@ const usbInterfaceDescriptor_t usbInterfaceDesc[USB_NUM_IFACE_DESC] =
 		USB_SUBCLASS_NONE,
 		USB_PROTOCOL_NONE,
 		0x00 /* No string to describe this interface */
+	},
+	{
+		sizeof(usbInterfaceDescriptor_t),
+		USB_DESCRIPTOR_INTERFACE,
+		0x00, /* The second configuration's only interface */
+		0x00, /* Alternate 0 */
+		0x03, /* Bulk in and out, and interrupt in for events */
+		USB_CLASS_VENDOR,
+		SPIFP_USB_SUBCLASS,
+		SPIFP_USB_PROTOCOL,
+		0x00 /* No string to describe this interface */
 	}
 };
 
-const usbEndpointDescriptor_t usbEndpointDesc[USB_NUM_ENDPOINT_DESC] =
+/* The bulk endpoints' sizes are filled in for the speed we are running at by usbSizeEndpoints() */
+usbEndpointDescriptor_t usbEndpointDesc[USB_NUM_ENDPOINT_DESC] =
 {
 	{
 		sizeof(usbEndpointDescriptor_t),
@@ -122,6 +163,30 @@ const usbEndpointDescriptor_t usbEndpointDesc[USB_NUM_ENDPOINT_DESC] =
 		USB_EPTYPE_BULK,
 		USB_EP1_OUT_LEN,
 		0x01 /* Poll once per frame */
+	},
+	{
+		sizeof(usbEndpointDescriptor_t),
+		USB_DESCRIPTOR_ENDPOINT,
+		USB_EPDIR_IN | 1,
+		USB_EPTYPE_BULK,
+		USB_EP1_IN_LEN,
+		0x01 /* Poll once per frame */
+	},
+	{
+		sizeof(usbEndpointDescriptor_t),
+		USB_DESCRIPTOR_ENDPOINT,
+		USB_EPDIR_OUT | 1,
+		USB_EPTYPE_BULK,
+		USB_EP1_OUT_LEN,
+		0x01 /* Poll once per frame */
+	},
+	{
+		sizeof(usbEndpointDescriptor_t),
+		USB_DESCRIPTOR_ENDPOINT,
+		USB_EPDIR_IN | 2,
+		USB_EPTYPE_INTR,
+		USB_EP2_IN_LEN,
+		0x01 /* Poll once per frame */
 	}
 };
 
@@ -168,7 +233,7 @@ const usbCDCCallMgmt_t usbCDCCallMgmt =
 	USB_DESCRIPTOR_CDC,
 	USB_CDC_CM,
 	USB_CDC_CM_SELF_MANAGE,
-	2
+	1 /* The data interface */
 };
 
 const usbMultiPartDesc_t usbConfigSecs[USB_NUM_CONFIG_SECS] =
@@ -219,11 +284,39 @@ const usbMultiPartDesc_t usbConfigSecs[USB_NUM_CONFIG_SECS] =
 	}
 };
 
+const usbMultiPartDesc_t usbVendorSecs[USB_NUM_VENDOR_SECS] =
+{
+	{
+		sizeof(usbConfigDescriptor_t),
+		&usbConfigDesc[1]
+	},
+	{
+		sizeof(usbInterfaceDescriptor_t),
+		&usbInterfaceDesc[2]
+	},
+	{
+		sizeof(usbEndpointDescriptor_t),
+		&usbEndpointDesc[3]
+	},
+	{
+		sizeof(usbEndpointDescriptor_t),
+		&usbEndpointDesc[4]
+	},
+	{
+		sizeof(usbEndpointDescriptor_t),
+		&usbEndpointDesc[5]
+	}
+};
+
 const usbMultiPartTable_t usbConfigDescs[USB_NUM_CONFIG_DESC] =
 {
 	{
 		USB_NUM_CONFIG_SECS,
 		usbConfigSecs
+	},
+	{
+		USB_NUM_VENDOR_SECS,
+		usbVendorSecs
 	}
 };
 
@@ -289,14 +382,49 @@ const struct
 	}
 };
 
+const struct
+{
+	usbStringDescBase_t header;
+	uint16_t strBulk[8];
+} usbStringBulk =
+{
+	{
+		sizeof(usbStringBulk),
+		USB_DESCRIPTOR_STRING
+	},
+	{
+		/* Secondary configuration string is "USB Bulk" */
+		'U', 'S', 'B', ' ', 'B', 'u', 'l', 'k'
+	}
+};
+
 const usbStringDescBase_t *usbStrings[USB_NUM_STRING_DESC] =
 {
 	&usbStringLangIDs.header,
 	&usbStringMfr.header,
 	&usbStringProduct.header,
-	&usbStringUART.header
+	&usbStringUART.header,
+	&usbStringBulk.header
+};
+
+usbCDCLineCoding_t usbLineCoding =
+{
+	BAUD_DEFAULT,
+	0, /* 1 stop bit */
+	0, /* No parity */
+	8
 };
 
+static void usbSizeEndpoints()
+{
+	uint8_t i;
+	for (i = 0; i < USB_NUM_ENDPOINT_DESC; i++)
+	{
+		if ((usbEndpointDesc[i].attributes & 0x03) == USB_EPTYPE_BULK)
+			usbEndpointDesc[i].maxPacketSize = usbBulkLen();
+	}
+}
+
 void usbRequestGetDescriptor(volatile usbSetupPacket_t *packet)
 {
 	if (packet->requestType.direction == USB_DIR_IN)
@@ -310,11 +438,16 @@ void usbRequestGetDescriptor(volatile usbSetupPacket_t *packet)
 				usbStatusInEP[0].buffer.flashPtr = &usbDeviceDesc;
 				usbStatusInEP[0].xferCount = usbDeviceDesc.length;
 				break;
+			case USB_DESCRIPTOR_DEVICE_QUALIFIER:
+				usbStatusInEP[0].buffer.flashPtr = &usbDeviceQualifierDesc;
+				usbStatusInEP[0].xferCount = usbDeviceQualifierDesc.length;
+				break;
 			case USB_DESCRIPTOR_CONFIGURATION:
 				if (packet->value.descriptor.index < USB_NUM_CONFIG_DESC)
 				{
 					uint8_t i;
 					const usbMultiPartTable_t *configDesc = &usbConfigDescs[packet->value.descriptor.index];
+					usbSizeEndpoints();
 					usbStatusInEP[0].buffer.flashPtr = configDesc->descriptors[0].descriptor;
 					usbStatusInEP[0].xferCount = 0;
 					for (i = 0; i < configDesc->numDesc; i++)
@@ -385,6 +518,13 @@ void usbRequestSetConfiguration(volatile usbSetupPacket_t *packet)
 		uint8_t j, ifaceIdx = 0, endpointIdx = 0;
 
 		usbState = USB_STATE_CONFIGURED;
+		usbSizeEndpoints();
+		/*
+		 * The direction of an endpoint we don't use must still not be left as a control endpoint,
+		 * so start every one off as bulk both ways
+		 */
+		for (i = 1; i < USB_ENDPOINTS; i++)
+			USB0->epCtrl[i] = USB_EP_RX_TYPE_BULK | USB_EP_TX_TYPE_BULK;
 		/* Count interfaces to arrive at the first to deref */
 		for (i = 0; i < configIdx; i++)
 		{
@@ -396,7 +536,7 @@ void usbRequestSetConfiguration(volatile usbSetupPacket_t *packet)
 
 		for (i = 0; i < usbConfigDesc[configIdx].numInterfaces; i++)
 		{
-			for (j = 0; j < usbInterfaceDesc[i].numEndpoints; j++)
+			for (j = 0; j < usbInterfaceDesc[ifaceIdx + i].numEndpoints; j++)
 			{
 				const usbEndpointDescriptor_t *endpoint = &usbEndpointDesc[endpointIdx + j];
 				volatile uint32_t *ep = &USB0->epCtrl[endpoint->endpointAddress & 0x7F];
@@ -404,27 +544,32 @@ void usbRequestSetConfiguration(volatile usbSetupPacket_t *packet)
 
 				if ((endpoint->endpointAddress & 0x80) == USB_EPDIR_IN)
 				{
+					/* The interrupt type has both type bits set, so doubles as the mask for them */
+					*ep &= ~USB_EP_TX_TYPE_INTR;
 					if (epType == USB_EPTYPE_BULK)
 						*ep |= USB_EP_TX_TYPE_BULK;
 					else if (epType == USB_EPTYPE_INTR)
 						*ep |= USB_EP_TX_TYPE_INTR;
 					else
 						*ep |= USB_EP_TX_TYPE_ISO;
-					*ep |= USB_EP_TXE;
+					/* Resetting the data toggle as we enable the endpoint */
+					*ep |= USB_EP_TXR | USB_EP_TXE;
 				}
 				else
 				{
+					*ep &= ~USB_EP_RX_TYPE_INTR;
 					if (epType == USB_EPTYPE_BULK)
 						*ep |= USB_EP_RX_TYPE_BULK;
 					else if (epType == USB_EPTYPE_INTR)
 						*ep |= USB_EP_RX_TYPE_INTR;
 					else
 						*ep |= USB_EP_RX_TYPE_ISO;
-					*ep |= USB_EP_RXE;
+					*ep |= USB_EP_RXR | USB_EP_RXE;
 				}
 			}
 			endpointIdx += j;
 		}
+		usbDataInit(usbBulkLen());
 	}
 }
 
@@ -476,5 +621,59 @@ void usbRequestDoFeature(volatile usbSetupPacket_t *packet)
 		usbStatusInEP[0].needsArming = 1;
 		return;
 	}
+
+	/* Halting an endpoint stalls it until the host clears it again, which also resets its data toggle */
+	if (packet->value.feature.value == USB_FEATURE_ENDPOINT_STALL &&
+		packet->requestType.recipient == USB_RECIPIENT_ENDPOINT &&
+		packet->index.epNum != 0 && packet->index.epNum < USB_ENDPOINTS)
+	{
+		volatile uint32_t *ep = &USB0->epCtrl[packet->index.epNum];
+		const uint32_t stall = packet->index.epDir == USB_DIR_IN ? USB_EP_TX_STALLED : USB_EP_RX_STALLED;
+		const uint32_t reset = packet->index.epDir == USB_DIR_IN ? USB_EP_TXR : USB_EP_RXR;
+
+		if (packet->request == USB_REQUEST_SET_FEATURE)
+			*ep |= stall;
+		else
+			*ep = (*ep & ~stall) | reset;
+		usbStatusInEP[0].needsArming = 1;
+	}
+}
+
+static void usbSetLineCoding()
+{
+	uint8_t i;
+	uint8_t *lineCoding = (uint8_t *)&usbLineCoding;
+	for (i = 0; i < sizeof(usbCDCLineCoding_t); i++)
+		lineCoding[i] = usbEP0Data[i];
+}
+
+/*
+ * The ACM requests a host's serial driver makes. There's no UART behind us, so the line coding is only
+ * remembered to give back, and the control lines are ignored.
+ */
+bool usbRequestCDC(volatile usbSetupPacket_t *packet)
+{
+	if (packet->requestType.type != USB_REQUEST_TYPE_CLASS ||
+		packet->requestType.recipient != USB_RECIPIENT_INTERFACE)
+		return false;
+
+	switch (packet->request)
+	{
+		case USB_CDC_SET_LINE_CODING:
+			usbStatusOutEP[0].needsArming = 1;
+			usbStatusOutEP[0].xferCount = sizeof(usbCDCLineCoding_t);
+			usbStatusOutEP[0].func = usbSetLineCoding;
+			return true;
+		case USB_CDC_GET_LINE_CODING:
+			usbStatusInEP[0].buffSrc = USB_BUFFER_SRC_MEM;
+			usbStatusInEP[0].buffer.memPtr = &usbLineCoding;
+			usbStatusInEP[0].xferCount = sizeof(usbCDCLineCoding_t);
+			usbStatusInEP[0].needsArming = 1;
+			return true;
+		case USB_CDC_SET_CONTROL_LINE_STATE:
+			usbStatusInEP[0].needsArming = 1;
+			return true;
+	}
+	return false;
 }
 
@@ -23,6 +23,7 @@ extern void usbRequestGetDescriptor(volatile usbSetupPacket_t *packet);
 extern void usbRequestSetConfiguration(volatile usbSetupPacket_t *packet);
 extern void usbRequestGetStatus(volatile usbSetupPacket_t *packet);
 extern void usbRequestDoFeature(volatile usbSetupPacket_t *packet);
+extern bool usbRequestCDC(volatile usbSetupPacket_t *packet);
 
 extern volatile usbDeviceState usbState;
 extern volatile uint8_t usbActiveConfig;
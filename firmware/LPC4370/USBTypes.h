@@ -34,13 +34,27 @@
 
 #define USB_EP0_SETUP_LEN			8
 #define USB_EP0_SETUP_ADDR			__attribute__((aligned(8)))
-#define USB_EP0_DATA_LEN			8
-#define USB_EP0_DATA_ADDR			__attribute__((aligned(8)))
+#define USB_EP0_DATA_LEN			64
+/* Replies are gathered into one buffer and sent as a single transfer, so this is the longest we can give */
+#define USB_EP0_BUFFER_LEN			256
+#define USB_EP0_DATA_ADDR			__attribute__((aligned(256)))
+
+/* The bulk endpoints are 512 bytes at high speed, but full speed only allows 64 */
+#define USB_EP1_OUT_LEN				512
+#define USB_EP1_OUT_ADDR			__attribute__((aligned(512)))
+#define USB_EP1_IN_LEN				512
+#define USB_EP1_IN_ADDR				__attribute__((aligned(512)))
+#define USB_EP1_FS_LEN				64
 
-#define USB_EP1_OUT_LEN				64
-#define USB_EP1_OUT_ADDR			__attribute__((aligned(64)))
-#define USB_EP1_IN_LEN				64
-#define USB_EP1_IN_ADDR				__attribute__((aligned(64)))
+/*
+ * EP1 OUT keeps a chain of receive slots queued, one packet to each, so the controller can DMA several packets in
+ * back to back while the firmware reads through the earliest. EP1 IN is given slots of several packets at a time.
+ * The slots live in usbLink_t (USBLink.h), laid out so each is aligned to its size and never crosses the
+ * 4K boundary a TD's next buffer pointer would be needed for. Both counts must divide 256.
+ */
+#define USB_RX_SLOTS				8
+#define USB_TX_SLOTS				4
+#define USB_TX_SLOT_LEN				2048
 
 #define USB_EP2_IN_LEN				64
 #define USB_EP2_IN_ADDR				__attribute__((aligned(64)))
@@ -66,11 +80,16 @@
 #define USB_EPCAP_MULT_3			0xC0000000
 
 #define USB_TD_STATUS_MASK			0x000000FF
+#define USB_TD_ACTIVE				0x00000080
+#define USB_TD_HALTED				0x00000040
 #define USB_TD_MULTO_MASK			0x00000C00
 #define USB_TD_IOC					0x00008000
 #define USB_TD_COUNT_MASK			0x7FFF0000
 #define USB_INVALID_TD				(void *)0x00000001
 
+/* The queue heads are in OUT, IN pairs by endpoint */
+#define USB_BDT_INDEX(ep, dir)		(((ep) << 1) | (dir))
+
 #define USB_PAGE_MASK				0xFFFFF000
 #define USB_PAGE_INC				0x00001000
 
@@ -324,7 +343,7 @@ typedef enum
 #define USB_EPTYPE_BULK			0x02
 #define USB_EPTYPE_INTR			0x03
 
-typedef struct
+typedef struct __attribute__((packed))
 {
 	uint8_t length;
 	uint8_t descriptorType;
@@ -342,7 +361,20 @@ typedef struct
 	uint8_t numConfigurations;
 } usbDeviceDescriptor_t;
 
-typedef struct
+typedef struct __attribute__((packed))
+{
+	uint8_t length;
+	uint8_t descriptorType;
+	uint16_t usbVersion;
+	uint8_t deviceClass;
+	uint8_t deviceSubClass;
+	uint8_t deviceProtocol;
+	uint8_t maxPacketSize0;
+	uint8_t numConfigurations;
+	uint8_t reserved;
+} usbDeviceQualifierDescriptor_t;
+
+typedef struct __attribute__((packed))
 {
 	uint8_t length;
 	uint8_t descriptorType;
@@ -367,7 +399,7 @@ typedef struct
 	uint8_t strInterfaceIdx;
 } usbInterfaceDescriptor_t;
 
-typedef struct
+typedef struct __attribute__((packed))
 {
 	uint8_t length;
 	uint8_t descriptorType;
@@ -414,7 +446,7 @@ typedef enum
 extern usbEPStatus_t usbStatusInEP[USB_ENDPOINTS];
 extern usbEPStatus_t usbStatusOutEP[USB_ENDPOINTS];
 extern volatile usbBDTEntry_t usbBDT[USB_BDT_ENTRIES];
-extern volatile uint8_t usbEP0Data[USB_EP0_DATA_LEN];
+extern volatile uint8_t usbEP0Data[USB_EP0_BUFFER_LEN];
 
 #endif /*USBTypes_H*/
 
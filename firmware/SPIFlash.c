@@ -26,16 +26,21 @@
 #include "USBInterface.h"
 #include "UART.h"
 #endif
+#include "FlashDevices.h"
 #include "SPI.h"
 #include "GPIO.h"
+#include "Clock.h"
 
+#define FLASH_DEVICE(name, manufacturer, type, capacity, size, pageSize, eraseSizes, clockMax, \
+	tPP, tPPMax, tSSE, tSSEMax, tBE32, tBE32Max, tSE, tSEMax, tBE, tBEMax, protect, relock, sfdp) DEV_##name,
 typedef enum
 {
 	DEV_INVALID,
-	DEV_M25P80,
-	DEV_M25P16,
-	DEV_W25Q80BV,
+	FLASH_DEVICES
+	/* A device we don't know by ID, driven from what its SFDP tables tell us */
+	DEV_SFDP
 } FlashDevice_t;
+#undef FLASH_DEVICE
 
 #define WREN	0x06
 #define WRDI	0x04
@@ -44,246 +49,1740 @@ typedef enum
 #define RDSR	0x05
 #define WRSR	0x01
 #define READ	0x03
+/* Like READ, but with a dummy byte after the address so the device can run at its full clock */
+#define FAST_READ	0x0B
 #define PP		0x02
 #define SSE		0x20
+#define BE32	0x52
 #define SE		0xD8
 #define BE		0xC7
+/* Reads the device's Serial Flash Discoverable Parameters (JESD216), taking an address and a dummy byte like FAST_READ */
+#define RDSFDP	0x5A
+/* The forms of the instructions that always take a 4-byte address, for devices past 16MB */
+#define FAST_READ4	0x0C
+#define PP4		0x12
+#define SSE4	0x21
+#define SE4		0xDC
+/* Switch the device between taking 3 and 4-byte addresses on the usual instructions */
+#define EN4B	0xB7
+#define EX4B	0xE9
+/* Page Program with the data over 4 lines, in its 3 and 4-byte address forms */
+#define QPP		0x32
+#define QPP4	0x34
+/* Read and write the status register that has the Quad Enable bit on parts that keep it in a second one */
+#define RDSR2	0x35
+#define WRSR2	0x31
+#define RDSR2_QE7	0x3F
+#define WRSR2_QE7	0x3E
+
+#define SIZE_4K		0x00001000
+#define SIZE_32K	0x00008000
+#define SIZE_64K	0x00010000
+
+/* SFDP doesn't say how fast the device goes, but no part that has it does FAST_READ any slower than this */
+#define CLOCK_MAX_SFDP	50000000
+/* How many times the checks have to pass at a clock before we trust it */
+#define CLOCK_ROUNDS	4
+/* Having had to back off, we settle this fraction below the fastest clock that passed */
+#define CLOCK_MARGIN	4
+/* Where the check block is read back from, picked to put a good mix of address bits on the wire */
+#define CLOCK_CHECK_ADDR	0x0A5500
+/* Where a programming session writes its own check block when the device's is all the same - in the first 4K, which it erases anyway */
+#define CLOCK_PATTERN_ADDR	0x000A00
+/* The taps of the LFSR that makes the pattern written there, which is maximal length so runs through every byte but 0 */
+#define CLOCK_PATTERN_TAPS	0xB8
+/* What calibrateClock() reads back at each clock - the device's contents, its SFDP tables, or nothing it can check */
+#define CHECK_CONTENTS	0
+#define CHECK_SFDP	1
+#define CHECK_NONE	2
+
+/* An erase cost that means the erase size is not supported */
+#define ERASE_NONE	0xFFFFFFFF
+
+/* SFDP's signature, "SFDP" read as a little endian uint32_t, and the ID of the JEDEC Basic Flash Parameter Table */
+#define SFDP_SIGNATURE	0x50444653
+#define SFDP_BFPT_ID	0xFF00
+/* And of the 4-byte Address Instruction Table, which lists the 4-byte instructions the device has */
+#define SFDP_4BAIT_ID	0xFF84
+/* The BFPT is 9 DWORDs in the original JESD216, 16 from revision A on, and we need nothing past that */
+#define SFDP_BFPT_MIN	9
+#define SFDP_BFPT_MAX	16
+/* How far 3-byte addresses reach */
+#define SIZE_3BYTE	0x01000000
+
+/*
+ * How the device takes addresses - 3 bytes, 4 bytes (on the 4-byte instructions, or on every one for a device that
+ * only takes 4), or 4 bytes once switched over with EN4B, which some devices want a WREN ahead of
+ */
+#define ADDR_3BYTE		0
+#define ADDR_4BYTE		1
+#define ADDR_EN4B		2
+#define ADDR_EN4B_WREN	3
+
+/* The multi-IO reads, named for the number of lines the instruction, address and data go over */
+#define READ_1_1_2	0
+#define READ_1_2_2	1
+#define READ_1_1_4	2
+#define READ_1_4_4	3
+#define READ_MODES	4
+
+/*
+ * How the device's Quad Enable bit is set, which BFPT DWORD15 gives (QER_UNKNOWN for a BFPT too old to say).
+ * Until it is, IO2 and IO3 are the device's WP# and HOLD# and its quad instructions don't work.
+ */
+#define QER_NONE		0 /* There's no QE bit to set */
+#define QER_SR2_WRSR	1 /* Bit 1 of status register 2, written by WRSR's second byte, which a one byte WRSR clears */
+#define QER_SR1			2 /* Bit 6 of status register 1 */
+#define QER_SR2_QE7		3 /* Bit 7 of status register 2, read and written with RDSR2_QE7 and WRSR2_QE7 */
+#define QER_SR2_KEEP	4 /* As QER_SR2_WRSR, but a one byte WRSR leaves it alone */
+#define QER_SR2_RDSR2	5 /* As QER_SR2_KEEP, but status register 2 can be read with RDSR2 */
+#define QER_SR2_WRSR2	6 /* Bit 1 of status register 2, read with RDSR2 and written with WRSR2 */
+#define QER_UNKNOWN		0xFF
+#define SR_QE1			0x02
+#define SR_QE6			0x40
+#define SR_QE7			0x80
+
+typedef struct
+{
+	/* 0 if the device doesn't have the read */
+	uint8_t opcode;
+	/* The mode and dummy clocks between the address and the data */
+	uint8_t waitClocks;
+} FlashRead_t;
+
+typedef struct
+{
+	uint32_t typical, max;
+} FlashTime_t;
+
+typedef struct
+{
+	uint32_t size;
+	uint16_t pageSize;
+	/* Which of the sub-chip erase sizes the device supports, and their instructions */
+	uint8_t eraseSizes;
+	uint8_t erase4KOp, erase32KOp, erase64KOp;
+	/* Page program time in us, and erase times in ms for a 4K sub-sector, 32K block, 64K sector and the whole chip */
+	FlashTime_t tPP, tSSE, tBE32, tSE, tBE;
+	/* The fastest SPI clock the device reads at, and the read we use to get the data out over the one line we have */
+	uint32_t clockMax;
+	FlashRead_t read;
+	/* The Page Program instruction, and how the device takes addresses (ADDR_3BYTE etc) */
+	uint8_t programOp;
+	uint8_t addrMode;
+	/* The status register bits that protect blocks, and whether to set them again when done */
+	uint8_t protect;
+	bool relock;
+} FlashInfo_t;
+
+/* How long a status register write takes, which every 25 series part we've seen keeps within */
+#define TW_TYPICAL	5000
+#define TW_MAX		15000
+
+/*
+ * The number of pages we can buffer from the host at once.
+ * This is advertised to the host as its credit count when a transfer starts.
+ */
+#define PAGE_BUFFERS	8
 
 FlashDevice_t device;
+/* What we know of the device, from our own tables or its SFDP ones (kept in sfdpInfo), and the ID it answered with */
+const FlashInfo_t *flash;
+FlashInfo_t sfdpInfo;
+uint8_t flashDID[3];
+/* The multi-IO reads the device's SFDP tables say it has, indexed by READ_1_1_2 etc (opcode 0 if not) */
+FlashRead_t flashReads[READ_MODES];
+/* How its Quad Enable bit is set (QER_NONE etc), and the quad Page Program it has (0 if none we can rely on) */
+uint8_t flashQER, flashQuadProgram;
+#ifdef SPI_COMMANDS
+/* The read and Page Program selectCommands() settled on for the SPI driver's command engine */
+spiCommand_t readCommand, programCommand;
+/* Whether we set the Quad Enable bit for them, and so have to clear it again when done */
+bool quadEnabled;
+/* Where the read readNext() continues from */
+uint32_t readAddr;
+#endif
+#ifdef SPI_LANES
+#if SPI_LANES < 2 || SPI_LANES > 8
+#error "SPI_LANES must be from 2 to 8"
+#endif
+#ifdef SPI_COMMANDS
+#error "The SPI command engine reads back from one device, so can't gang program with SPI_LANES"
+#endif
+/*
+ * Gang programming sends everything to SPI_LANES devices at once. Lane 0 is the device the rest of this file
+ * talks to, and its failures are the session's; the other lanes follow it, dropping out of the session when they fail.
+ */
+#define LANE_COUNT	SPI_LANES
+uint8_t lanesFailed;
+/* What each lane's check block read at the safe clock, and each lane's reads since, lane n's len bytes at n * len */
+uint8_t laneCheck[SPI_LANES << 8], laneData[SPI_LANES << 8];
+/* The CRC32 crcFlash() found for each lane */
+uint32_t laneCRC[SPI_LANES];
+#else
+#define LANE_COUNT	1
+#endif
+/* When the write or erase in progress was started, and how far we've counted from there */
+uint32_t busyTicks, busyCount, busyElapsed;
 #ifndef NOUSB
-uint8_t usbData[256];
+/* Word aligned so pages can be compared with the device a word at a time */
+uint8_t usbData[PAGE_BUFFERS << 8] __attribute__((aligned(4)));
+uint16_t usbPageLen[PAGE_BUFFERS];
+/* Non-zero when the buffer slot holds a run of blank pages to skip rather than a page of data */
+uint16_t usbPageSkip[PAGE_BUFFERS];
 uint32_t usbDataTotal;
 uint32_t usbDataReceived;
+/* The START_FLAG_CRC etc flags the host started this transfer with, and the CRC32 of what it has sent so far */
+uint8_t usbFlags;
+uint32_t usbCRC;
+/* The rate the UART is running at for this session */
+uint32_t uartBaud = BAUD_DEFAULT;
+static const uint8_t baudProbe[BAUD_PROBE_LEN] = BAUD_PROBE_PATTERN;
+
+typedef enum
+{
+	RX_STATE_COMMAND,
+	RX_STATE_RECORDS,
+	RX_STATE_LENGTH,
+	RX_STATE_DATA,
+	RX_STATE_SKIP,
+	RX_STATE_ERROR
+} rxState_t;
+
+/* Page reception state - rxHead is the page being received, rxTail the page being programmed */
+rxState_t rxState;
+uint8_t rxHead, rxTail, rxPagesReady, rxRecords;
+uint16_t rxCount;
+uint32_t rxPagesLeft;
+#else
+/* Without USB there is nothing to receive while we wait on the Flash device */
+#define receiveData()
+#endif
+
+/* The JEDEC IDs of the devices in FlashDevices.h, indexed by FlashDevice_t */
+#define FLASH_DEVICE(name, manufacturer, type, capacity, size, pageSize, eraseSizes, clockMax, \
+	tPP, tPPMax, tSSE, tSSEMax, tBE32, tBE32Max, tSE, tSEMax, tBE, tBEMax, protect, relock, sfdp) \
+	{ manufacturer, type, capacity },
+static const uint8_t flashIDs[][3] =
+{
+	{ 0, 0, 0 }, /* DEV_INVALID */
+	FLASH_DEVICES
+};
+#undef FLASH_DEVICE
+
+/*
+ * And their datasheet parameters, taking the erases and reads as the standard instructions.
+ * Devices past 16MB are driven with the 4-byte instructions, so there's no mode to leave them in, and as
+ * there's no common 4-byte form of the 32K erase they make do with the 4K and 64K ones.
+ */
+#define FLASH_OP(size, op)	((size) > SIZE_3BYTE ? op##4 : op)
+#define FLASH_DEVICE(name, manufacturer, type, capacity, size, pageSize, eraseSizes, clockMax, \
+	tPP, tPPMax, tSSE, tSSEMax, tBE32, tBE32Max, tSE, tSEMax, tBE, tBEMax, protect, relock, sfdp) \
+	{ size, pageSize, (size) > SIZE_3BYTE ? (eraseSizes) & ~ERASE_32K : (eraseSizes), FLASH_OP(size, SSE), BE32, \
+		FLASH_OP(size, SE), { tPP, tPPMax }, { tSSE, tSSEMax }, { tBE32, tBE32Max }, { tSE, tSEMax }, { tBE, tBEMax }, \
+		clockMax, { FLASH_OP(size, FAST_READ), 8 }, FLASH_OP(size, PP), (size) > SIZE_3BYTE ? ADDR_4BYTE : ADDR_3BYTE, \
+		protect, relock },
+static const FlashInfo_t flashInfo[] =
+{
+	{ 0, 0, 0, 0, 0, 0, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, 0, { 0, 0 }, 0, ADDR_3BYTE, 0, false }, /* DEV_INVALID */
+	FLASH_DEVICES
+};
+#undef FLASH_DEVICE
+#undef FLASH_OP
+
+/* The BFPT's typical erase time units in ms, for the sub-chip erases and then the whole chip */
+static const uint16_t sfdpEraseUnits[4] = { 1, 16, 128, 1000 };
+static const uint32_t sfdpChipUnits[4] = { 16, 256, 4000, 64000 };
+/* Times for a BFPT too old to give them, taken from a typical part */
+static const FlashTime_t sfdpTSSE = { 45, 400 };
+static const FlashTime_t sfdpTBE32 = { 120, 1600 };
+static const FlashTime_t sfdpTSE = { 150, 2000 };
+static const FlashTime_t sfdpTPP = { 700, 5000 };
+
+/* When true, the whole chip is erased up front, otherwise erasedTo tracks how far we've erased just in time */
+bool eraseChip;
+uint32_t erasedTo;
+/* The SPI clock calibrateClock() last settled on, and the one we start a session from */
+uint32_t spiClock;
+/* Where calibrateClock() takes its check block from this session, as CHECK_CONTENTS etc, and the address for CHECK_CONTENTS */
+uint8_t checkSource;
+uint32_t checkAddr;
+/*
+ * Reads from the Flash land here a page at a time so they can go as a single burst,
+ * one half filling in the background while we work on the other
+ */
+uint8_t spiBuffer[2][256];
+
+#ifndef NOCONFIG
+/* Pages that are entirely 0xFF are left as the erase left them */
+bool pageBlank(const uint8_t *data, const size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++)
+	{
+		if (data[i] != 0xFF)
+			return false;
+	}
+	return true;
+}
+#endif
+
+/* Whether the len bytes at data are all value */
+bool dataFilled(const uint8_t *data, const size_t len, const uint8_t value)
+{
+	size_t i;
+	for (i = 0; i < len; i++)
+	{
+		if (data[i] != value)
+			return false;
+	}
+	return true;
+}
+
+int datacmp(const uint8_t *a, const uint8_t *b, const size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++)
+	{
+		if (*a != *b)
+			return *a - *b;
+		a++;
+		b++;
+	}
+	return 0;
+}
+
+#ifndef NOUSB
+/* CRC32 (IEEE 802.3, reflected) done a nibble at a time so the table stays small */
+static const uint32_t crcTable[16] =
+{
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t crc32Byte(uint32_t crc, const uint8_t data)
+{
+	crc ^= data;
+	crc = (crc >> 4) ^ crcTable[crc & 0x0F];
+	return (crc >> 4) ^ crcTable[crc & 0x0F];
+}
+
+uint32_t crc32Block(uint32_t crc, const uint8_t *data, const size_t dataLen)
+{
+	size_t i;
+	for (i = 0; i < dataLen; i++)
+		crc = crc32Byte(crc, data[i]);
+	return crc;
+}
+
+void beginReceive(const uint32_t pages)
+{
+	rxState = RX_STATE_COMMAND;
+	rxHead = 0;
+	rxTail = 0;
+	rxPagesReady = 0;
+	rxRecords = 0;
+	rxCount = 0;
+	rxPagesLeft = pages;
+}
+
+/*
+ * Runs a byte from the host through the page stream parser, which takes bare CMD_PAGE and
+ * CMD_SKIP messages and CMD_FRAMEs of them. Returns true when the byte completes a record.
+ * When discarding, the page data is parsed but not stored.
+ */
+bool parseData(const uint8_t data, const bool discard)
+{
+	switch (rxState)
+	{
+		case RX_STATE_COMMAND:
+			if (data == CMD_FRAME && rxRecords == 0)
+				rxState = RX_STATE_RECORDS;
+			else if (data == CMD_PAGE)
+				rxState = RX_STATE_LENGTH;
+			else if (data == CMD_SKIP)
+				rxState = RX_STATE_SKIP;
+			else
+				rxState = RX_STATE_ERROR;
+			break;
+		case RX_STATE_RECORDS:
+			rxRecords = data;
+			rxState = data == 0 ? RX_STATE_ERROR : RX_STATE_COMMAND;
+			break;
+		case RX_STATE_LENGTH:
+			/* A page length of 0 means 256 */
+			usbPageLen[rxHead] = data == 0 ? 0x100 : data;
+			usbPageSkip[rxHead] = 0;
+			rxCount = 0;
+			rxState = RX_STATE_DATA;
+			break;
+		case RX_STATE_DATA:
+			if (!discard)
+				usbData[(rxHead << 8) + rxCount] = data;
+			if (++rxCount == usbPageLen[rxHead])
+			{
+				if (rxRecords != 0)
+					rxRecords--;
+				rxState = RX_STATE_COMMAND;
+				return true;
+			}
+			break;
+		case RX_STATE_SKIP:
+			/* A skip count of 0 means 256 */
+			usbPageLen[rxHead] = 0;
+			usbPageSkip[rxHead] = data == 0 ? 0x100 : data;
+			if (rxRecords != 0)
+				rxRecords--;
+			rxState = RX_STATE_COMMAND;
+			return true;
+		case RX_STATE_ERROR:
+			break;
+	}
+	return false;
+}
+
+/*
+ * Consumes whatever page data the UART has for us without blocking,
+ * so long as we have a free page buffer to put it in.
+ * This is called from all the places we wait on the Flash device so that
+ * the host can keep its credits worth of pages in flight.
+ */
+void receiveData()
+{
+	while (rxPagesLeft != 0 && rxPagesReady != PAGE_BUFFERS && rxState != RX_STATE_ERROR && uartHaveData())
+	{
+		if (parseData(uartRead(), false))
+		{
+			uint16_t count = usbPageSkip[rxHead] != 0 ? usbPageSkip[rxHead] : 1;
+			/* A skip run must not take us past the end of the image */
+			if (count > rxPagesLeft)
+			{
+				rxState = RX_STATE_ERROR;
+				break;
+			}
+			rxHead = (rxHead + 1) % PAGE_BUFFERS;
+			rxPagesReady++;
+			rxPagesLeft -= count;
+		}
+	}
+}
+
+/* Waits for the next page or skip run from the host to land in rxTail, returning false on failure */
+bool readData()
+{
+	while (rxPagesReady == 0)
+	{
+		if (rxState == RX_STATE_ERROR || rxPagesLeft == 0)
+			return false;
+		receiveData();
+	}
+	return true;
+}
+
+/* Hands the page at the tail of the buffer ring back so its credit can be reused */
+void releaseData()
+{
+	rxTail = (rxTail + 1) % PAGE_BUFFERS;
+	rxPagesReady--;
+}
+
+/*
+ * Discards any pages the host still had in flight when we stopped programming,
+ * returning the first command that follows them.
+ */
+uint8_t endReceive()
+{
+	rxPagesLeft = 0;
+	while (rxState != RX_STATE_ERROR)
+	{
+		uint8_t data = uartRead();
+		if (rxState == RX_STATE_COMMAND && rxRecords == 0 && data != CMD_PAGE && data != CMD_FRAME && data != CMD_SKIP)
+			return data;
+		parseData(data, true);
+	}
+	return uartRead();
+}
+#endif
+
+/* How much of len the next read into one half of spiBuffer covers */
+size_t spiChunk(const size_t len)
+{
+	return len < sizeof(spiBuffer[0]) ? len : sizeof(spiBuffer[0]);
+}
+
+/* Waits out a background SPI block, taking in more pages from the host meanwhile */
+void waitBlock()
+{
+	while (!spiBlockDone())
+		receiveData();
+}
+
+/* Sends an instruction and the 3 or 4-byte address it works on as a single burst */
+void sendAddressBytes(const uint8_t opcode, const uint32_t addr, const uint8_t addrBytes)
+{
+	uint8_t instruction[5], i;
+	instruction[0] = opcode;
+	for (i = 1; i <= addrBytes; i++)
+		instruction[i] = (addr >> ((addrBytes - i) * 8)) & 0xFF;
+	spiWriteBlock(instruction, addrBytes + 1);
+}
+
+/* Sends an instruction and its address the way the device takes them */
+void sendAddress(const uint8_t opcode, const uint32_t addr)
+{
+	sendAddressBytes(opcode, addr, flash->addrMode == ADDR_3BYTE ? 3 : 4);
+}
+
+/* Reads the three byte JEDEC ID the device answers RDID with */
+void readDID(uint8_t *data)
+{
+	/* Select the device */
+	spiChipSelect(true);
+	/* Send a JEDEC DID read request */
+	spiWrite(RDID);
+	/* And buffer the three bytes of the answer */
+	spiReadBlock(data, 3);
+	/* Deselect the device */
+	spiChipSelect(false);
+}
+
+/* Reads len bytes of the device's SFDP tables from addr */
+void readSFDP(const uint32_t addr, uint8_t *data, const size_t len)
+{
+	/* Select the device */
+	spiChipSelect(true);
+	/* SFDP addresses are always 3 bytes, whatever mode the device is in */
+	sendAddressBytes(RDSFDP, addr, 3);
+	/* Dummy byte */
+	spiWrite(0);
+	spiReadBlock(data, len);
+	/* Deselect the device */
+	spiChipSelect(false);
+}
+
+/* SFDP is little endian throughout, and numbers a table's DWORDs from 1 */
+uint32_t sfdpDword(const uint8_t *table, const uint8_t index)
+{
+	table += (index - 1) * 4;
+	return table[0] | ((uint32_t)table[1] << 8) | ((uint32_t)table[2] << 16) | ((uint32_t)table[3] << 24);
+}
+
+/* Decodes one of the BFPT's 16-bit fast read descriptions - the dummy clocks, mode clocks and instruction */
+FlashRead_t sfdpRead(const bool supported, const uint16_t field)
+{
+	FlashRead_t read = { 0, 0 };
+	if (supported)
+	{
+		read.opcode = field >> 8;
+		read.waitClocks = (field & 0x1F) + ((field >> 5) & 0x07);
+	}
+	return read;
+}
+
+/*
+ * Fills in sfdpInfo and flashReads from the device's JEDEC Basic Flash Parameter Table,
+ * returning false if it doesn't have one or it describes a device we can't drive.
+ */
+bool readFlashParams()
+{
+	FlashInfo_t *info = &sfdpInfo;
+	uint8_t header[8], table[SFDP_BFPT_MAX * 4], fourByte[8];
+	uint8_t length = 0;
+	uint16_t i, headers, revision = 0;
+	uint32_t dword, bfpt = 0, fourByteTable = 0;
+
+	for (i = 0; i < READ_MODES; i++)
+	{
+		flashReads[i].opcode = 0;
+		flashReads[i].waitClocks = 0;
+	}
+	flashQER = QER_UNKNOWN;
+	flashQuadProgram = 0;
+	readSFDP(0, header, 8);
+	if (sfdpDword(header, 1) != SFDP_SIGNATURE)
+		return false;
+	/* Take the newest BFPT the device has, as later ones only add to the earlier */
+	headers = header[6] + 1;
+	for (i = 0; i < headers; i++)
+	{
+		readSFDP(8 + (i * 8), header, 8);
+		if (((header[7] << 8) | header[0]) == SFDP_BFPT_ID && ((header[2] << 8) | header[1]) >= revision)
+		{
+			revision = (header[2] << 8) | header[1];
+			length = header[3];
+			bfpt = sfdpDword(header, 2) & 0x00FFFFFF;
+		}
+		else if (((header[7] << 8) | header[0]) == SFDP_4BAIT_ID && header[3] >= 2)
+			fourByteTable = sfdpDword(header, 2) & 0x00FFFFFF;
+	}
+	if (length < SFDP_BFPT_MIN)
+		return false;
+	if (length > SFDP_BFPT_MAX)
+		length = SFDP_BFPT_MAX;
+	readSFDP(bfpt, table, length * 4);
+
+	/* DWORD1 - the fast reads the device has */
+	dword = sfdpDword(table, 1);
+	flashReads[READ_1_1_2] = sfdpRead(dword & (1 << 16), sfdpDword(table, 4));
+	flashReads[READ_1_2_2] = sfdpRead(dword & (1 << 20), sfdpDword(table, 4) >> 16);
+	flashReads[READ_1_4_4] = sfdpRead(dword & (1 << 21), sfdpDword(table, 3));
+	flashReads[READ_1_1_4] = sfdpRead(dword & (1 << 22), sfdpDword(table, 3) >> 16);
+	/*
+	 * DWORD15 - how the Quad Enable bit is set. The BFPT doesn't list a quad Page Program, but the parts
+	 * that keep QE in bit 1 of status register 2 (Winbond, GigaDevice, Spansion and their like) all take QPP
+	 */
+	if (length >= 15)
+		flashQER = (sfdpDword(table, 15) >> 20) & 0x07;
+	if (flashReads[READ_1_1_4].opcode != 0 && (flashQER == QER_SR2_WRSR || flashQER == QER_SR2_KEEP ||
+		flashQER == QER_SR2_RDSR2 || flashQER == QER_SR2_WRSR2))
+		flashQuadProgram = QPP;
+	/* FAST_READ with 8 dummy clocks is the one read every SFDP device is required to have */
+	info->read.opcode = FAST_READ;
+	info->read.waitClocks = 8;
+	info->clockMax = CLOCK_MAX_SFDP;
+	info->programOp = PP;
+	/* The BFPT doesn't describe the protect bits, but BP0-2 are common to all 25 series parts */
+	info->protect = 0x1C;
+	info->relock = false;
+
+	/* DWORD2 - the density in bits, either less one or as a power of 2 (up to the 2GB we can count in bytes) */
+	dword = sfdpDword(table, 2);
+	if ((dword & 0x80000000) == 0)
+		info->size = (dword + 1) >> 3;
+	else if ((dword & 0x7FFFFFFF) < 3 || (dword & 0x7FFFFFFF) > 34)
+		return false;
+	else
+		info->size = 1U << ((dword & 0x7FFFFFFF) - 3);
+
+	/*
+	 * DWORD1 again for whether the device takes 3-byte addresses, 3 or 4, or only 4. One that can take either
+	 * and is big enough to need 4 is driven with its 4-byte instructions if it lists them, else switched over with
+	 * EN4B as DWORD16 describes, else only its first 16MB is used
+	 */
+	info->addrMode = ADDR_3BYTE;
+	if (((sfdpDword(table, 1) >> 17) & 0x03) == 0x02)
+		info->addrMode = ADDR_4BYTE;
+	else if (info->size > SIZE_3BYTE)
+	{
+		if (fourByteTable != 0)
+			readSFDP(fourByteTable, fourByte, 8);
+		/* 4BAIT DWORD1 - FAST_READ4 and PP4 are the least we need */
+		if (fourByteTable != 0 && (sfdpDword(fourByte, 1) & 0x42) == 0x42)
+		{
+			dword = sfdpDword(fourByte, 1);
+			info->addrMode = ADDR_4BYTE;
+			info->read.opcode = FAST_READ4;
+			info->programOp = PP4;
+			flashReads[READ_1_1_2].opcode = (dword & (1 << 2)) != 0 ? 0x3C : 0;
+			flashReads[READ_1_2_2].opcode = (dword & (1 << 3)) != 0 ? 0xBC : 0;
+			flashReads[READ_1_1_4].opcode = (dword & (1 << 4)) != 0 ? 0x6C : 0;
+			flashReads[READ_1_4_4].opcode = (dword & (1 << 5)) != 0 ? 0xEC : 0;
+			/* Which does list whether there's a 1-1-4 Page Program */
+			flashQuadProgram = (dword & (1 << 7)) != 0 ? QPP4 : 0;
+		}
+		else if (length >= 16 && (sfdpDword(table, 16) & (1 << 24)) != 0)
+			info->addrMode = ADDR_EN4B;
+		else if (length >= 16 && (sfdpDword(table, 16) & (1 << 25)) != 0)
+			info->addrMode = ADDR_EN4B_WREN;
+		else
+			/* With no way to address the rest, we can only use the first 16MB, and refuse images bigger than that */
+			info->size = SIZE_3BYTE;
+	}
+
+	/*
+	 * DWORD8 and 9 - the four erase types' sizes (as a power of 2) and instructions,
+	 * and DWORD10 their typical times and the multiplier to the maximum ones
+	 */
+	info->eraseSizes = 0;
+	info->tSSE = sfdpTSSE;
+	info->tBE32 = sfdpTBE32;
+	info->tSE = sfdpTSE;
+	for (i = 0; i < 4; i++)
+	{
+		const uint16_t type = sfdpDword(table, 8 + (i >> 1)) >> ((i & 1) * 16);
+		uint8_t opcode = type >> 8;
+		FlashTime_t *time;
+		/* Using the 4-byte instructions, 4BAIT DWORD1 says which erase types have one and DWORD2 gives it */
+		if (info->addrMode == ADDR_4BYTE && info->programOp == PP4)
+		{
+			if ((sfdpDword(fourByte, 1) & (1 << (9 + i))) == 0)
+				continue;
+			opcode = fourByte[4 + i];
+		}
+		if ((type & 0xFF) == 12)
+		{
+			info->eraseSizes |= ERASE_4K;
+			info->erase4KOp = opcode;
+			time = &info->tSSE;
+		}
+		else if ((type & 0xFF) == 15)
+		{
+			info->eraseSizes |= ERASE_32K;
+			info->erase32KOp = opcode;
+			time = &info->tBE32;
+		}
+		else if ((type & 0xFF) == 16)
+		{
+			info->eraseSizes |= ERASE_64K;
+			info->erase64KOp = opcode;
+			time = &info->tSE;
+		}
+		else
+			continue;
+		if (length >= 10)
+		{
+			const uint8_t field = (sfdpDword(table, 10) >> (4 + (i * 7))) & 0x7F;
+			time->typical = ((field & 0x1F) + 1) * sfdpEraseUnits[field >> 5];
+			time->max = time->typical * (((sfdpDword(table, 10) & 0x0F) + 1) * 2);
+		}
+	}
+	/* DWORD1 gives the 4K erase instruction too, should the erase types leave it out (in its 3-byte form) */
+	dword = sfdpDword(table, 1);
+	if ((info->eraseSizes & ERASE_4K) == 0 && (dword & 0x03) == 0x01 && info->programOp == PP)
+	{
+		info->eraseSizes |= ERASE_4K;
+		info->erase4KOp = (dword >> 8) & 0xFF;
+	}
+	if (info->eraseSizes == 0)
+		return false;
+
+	/* DWORD11 - the page size (as a power of 2), and the typical page program and chip erase times and their multiplier */
+	if (length >= 11)
+	{
+		uint32_t multiplier;
+		dword = sfdpDword(table, 11);
+		multiplier = ((dword & 0x0F) + 1) * 2;
+		/* Our pages are 256 bytes, which program just as well inside a bigger device page */
+		info->pageSize = ((dword >> 4) & 0x0F) >= 8 ? 256 : 1 << ((dword >> 4) & 0x0F);
+		info->tPP.typical = (((dword >> 8) & 0x1F) + 1) * ((dword & (1 << 13)) != 0 ? 64 : 8);
+		info->tPP.max = info->tPP.typical * multiplier;
+		info->tBE.typical = (((dword >> 24) & 0x1F) + 1) * sfdpChipUnits[(dword >> 29) & 0x03];
+		info->tBE.max = info->tBE.typical * multiplier;
+	}
+	else
+	{
+		info->pageSize = 256;
+		info->tPP = sfdpTPP;
+		/* Not knowing how long the chip takes to erase, we never choose to */
+		info->tBE.typical = ERASE_NONE;
+		info->tBE.max = ERASE_NONE;
+	}
+	return true;
+}
+
+/* Switches a device that needs telling over to 4-byte addresses */
+void enter4ByteMode()
+{
+	if (flash->addrMode == ADDR_EN4B_WREN)
+	{
+		spiChipSelect(true);
+		spiWrite(WREN);
+		spiChipSelect(false);
+	}
+	if (flash->addrMode == ADDR_EN4B || flash->addrMode == ADDR_EN4B_WREN)
+	{
+		spiChipSelect(true);
+		spiWrite(EN4B);
+		spiChipSelect(false);
+	}
+}
+
+/* And back to 3-byte ones when we're done with it, which is what whatever boots from it will expect */
+void exit4ByteMode()
+{
+	if (flash->addrMode == ADDR_EN4B || flash->addrMode == ADDR_EN4B_WREN)
+	{
+		spiChipSelect(true);
+		spiWrite(EX4B);
+		spiChipSelect(false);
+	}
+}
+
+/*
+ * Works out what's on the other end of the SPI bus, pointing flash at what we know of it.
+ * The devices in FlashDevices.h are known by their ID, and anything else with SFDP tables is driven from them,
+ * so newer parts need no firmware changes. The tables are read either way for the multi-IO reads they list.
+ */
+bool identifyDevice()
+{
+	const bool haveSFDP = readFlashParams();
+	readDID(flashDID);
+	/* I wanted to use memcmp here, but could not make use of the newlib implemenation */
+	for (device = DEV_INVALID + 1; device < DEV_SFDP; device++)
+	{
+		if (datacmp(flashDID, flashIDs[device], 3) == 0)
+			break;
+	}
+
+	if (device != DEV_SFDP)
+		flash = &flashInfo[device];
+	else if (haveSFDP)
+		flash = &sfdpInfo;
+	else
+	{
+		device = DEV_INVALID;
+		flash = &flashInfo[DEV_INVALID];
+	}
+	enter4ByteMode();
+	return device != DEV_INVALID;
+}
+
+/* Starts the device's single line read at addr, leaving it selected for the data to be clocked out */
+void sendRead(const uint32_t addr)
+{
+	uint8_t i;
+	sendAddress(flash->read.opcode, addr);
+	/* The dummy clocks, a byte's worth at a time */
+	for (i = 0; i < flash->read.waitClocks; i += 8)
+		spiWrite(0);
+}
+
+/* Starts a read of the device at addr, which readNext() takes a buffer's worth at a time and readEnd() finishes */
+void readBegin(const uint32_t addr)
+{
+#ifdef SPI_COMMANDS
+	readAddr = addr;
+#else
+	/* Select the device */
+	spiChipSelect(true);
+	sendRead(addr);
+#endif
+}
+
+/* Starts the next len bytes of the read into data in the background, for waitBlock() to wait out */
+void readNext(uint8_t *data, const size_t len)
+{
+#ifdef SPI_COMMANDS
+	/* The command engine takes an instruction per buffer, which is done by the time it returns */
+	spiCommandRead(&readCommand, readAddr, data, len);
+	readAddr += len;
+#else
+	/* The read carries on through the device for as long as we keep clocking */
+	spiBlockStart(NULL, data, len);
+#endif
+}
+
+void readEnd()
+{
+	/* A read can be left in flight */
+	waitBlock();
+#ifndef SPI_COMMANDS
+	/* Deselect the device */
+	spiChipSelect(false);
+#endif
+}
+
+#ifdef SPI_LANES
+/* Which of the lanes still in the session read back something other than expected - each lane's own len bytes, or with a stride of 0, the same */
+uint8_t lanesMismatched(const uint8_t *expected, const size_t len, const size_t stride)
+{
+	uint8_t lane, mismatched = 0;
+	for (lane = 0; lane < SPI_LANES; lane++)
+	{
+		if ((lanesFailed & (1 << lane)) == 0 && datacmp(laneData + lane * len, expected + lane * stride, len) != 0)
+			mismatched |= 1 << lane;
+	}
+	return mismatched;
+}
+
+/* Which of the lanes still in the session have any of bits set in the status byte they send next, with RDSR already sent */
+uint8_t lanesStatusSet(const uint8_t bits)
+{
+	uint8_t lane, set = 0;
+	spiLanesRead(laneData, 1);
+	for (lane = 0; lane < SPI_LANES; lane++)
+	{
+		if ((lanesFailed & (1 << lane)) == 0 && (laneData[lane] & bits) != 0)
+			set |= 1 << lane;
+	}
+	return set;
+}
+
+uint8_t readLanesStatus(const uint8_t bits)
+{
+	uint8_t set;
+	spiChipSelect(true);
+	spiWrite(RDSR);
+	set = lanesStatusSet(bits);
+	spiChipSelect(false);
+	return set;
+}
+
+/* Which lanes answer RDID with something other than lane 0's ID */
+uint8_t lanesMisidentified()
+{
+	spiChipSelect(true);
+	spiWrite(RDID);
+	spiLanesRead(laneData, 3);
+	spiChipSelect(false);
+	return lanesMismatched(flashDID, 3, 0);
+}
+
+/* Starts a session with the lanes whose devices match lane 0's */
+void identifyLanes()
+{
+	/* Every lane is in the session until it proves otherwise */
+	lanesFailed = 0;
+	lanesFailed = lanesMisidentified() & ~0x01;
+}
+#endif
+
+void writeEnable()
+{
+	/* Select the device */
+	spiChipSelect(true);
+	/* Write enable the device */
+	spiWrite(WREN);
+	/* Deselect the device - executes write-enable instruction */
+	spiChipSelect(false);
+	asm("nop");
+	/* Select the device again */
+	spiChipSelect(true);
+	/* Issue Read Status Register instruction */
+	spiWrite(RDSR);
+	/* And use it's continuous read mode till the write enable completes (bit 1 => 1) */
+	while ((spiRead() & 0x02) == 0);
+	/* Deselect the device */
+	spiChipSelect(false);
+}
+
+uint8_t readStatus()
+{
+	uint8_t status;
+	/* Select the device */
+	spiChipSelect(true);
+	/* Issue Read Status Register instruction */
+	spiWrite(RDSR);
+	status = spiRead();
+	/* Deselect the device */
+	spiChipSelect(false);
+	return status;
+}
+
+/* Marks the write or erase just issued as started, for waitWriteComplete() to time it from */
+void busyStart()
+{
+	busyTicks = clockTicks();
+	busyCount = 0;
+	busyElapsed = 0;
+}
+
+/* How many us it's been since busyStart(), adding up the ticks as we go so that the counter wrapping doesn't matter */
+uint32_t busyTime()
+{
+	const uint32_t now = clockTicks(), ticksPerUs = clockSystem() / 1000000;
+	busyCount += now - busyTicks;
+	busyTicks = now;
+	busyElapsed += busyCount / ticksPerUs;
+	busyCount %= ticksPerUs;
+	return busyElapsed;
+}
+
+/*
+ * Waits for the write or erase started at busyStart() to complete, given its typical and maximum times in us.
+ * The device won't be done before its typical time, so until then we leave the bus alone and get on with taking in
+ * pages from the host, and only then poll the status register. Returns false if it's still busy at the maximum.
+ */
+bool waitWriteComplete(const uint32_t typical, const uint32_t max)
+{
+	bool busy;
+#ifdef SPI_LANES
+	uint8_t busyLanes;
+#endif
+	while (busyTime() < typical)
+		receiveData();
+#ifdef SPI_LANES
+	/* Every lane has to finish, so poll them all through the one continuous status read */
+	spiChipSelect(true);
+	spiWrite(RDSR);
+	while ((busyLanes = lanesStatusSet(0x01)) != 0 && busyTime() < max)
+		receiveData();
+	spiChipSelect(false);
+	/* Lanes still busy at the maximum drop out, and lane 0 fails the session */
+	lanesFailed |= busyLanes & ~0x01;
+	busy = (busyLanes & 0x01) != 0;
+#elif defined(SPI_COMMANDS)
+	/* Have the command engine poll the status register till the write is complete (bit 0 => 0), taking in page data meanwhile */
+	spiPollStart(RDSR, 0, false);
+	while ((busy = !spiPollDone()) && busyTime() < max)
+		receiveData();
+	if (busy)
+		spiPollStop();
+#else
+	/* Select the device */
+	spiChipSelect(true);
+	/* Write the Read Status Register instruction */
+	spiWrite(RDSR);
+	/* And use it's continuous read mode till the write is complete (bit 0 => 0), taking in page data meanwhile */
+	while ((busy = (spiRead() & 0x01) != 0) && busyTime() < max)
+		receiveData();
+	/* Deselect the device */
+	spiChipSelect(false);
+#endif
+	return !busy;
+}
+
+/* Erase times are kept in ms */
+bool waitEraseComplete(const FlashTime_t *time)
+{
+	return waitWriteComplete(time->typical * 1000, time->max * 1000);
+}
+
+void writeStatus(const uint8_t status)
+{
+	writeEnable();
+	/* Select the device */
+	spiChipSelect(true);
+	/* Write the Status Register */
+	spiWrite(WRSR);
+	spiWrite(status);
+#ifdef SPI_COMMANDS
+	/* Writing just the one byte would clear status register 2, and the QE bit our quad commands need with it */
+	if (flashQER == QER_SR2_WRSR && (readCommand.lines == SPI_LINES_1_1_4 || readCommand.lines == SPI_LINES_1_4_4))
+		spiWrite(SR_QE1);
+#endif
+	/* Deselect the device */
+	spiChipSelect(false);
+	busyStart();
+}
+
+/* Takes off any block protection the device has on, returning false if it won't come off (such as when WP# holds it) */
+bool unlockDevice()
+{
+	const uint8_t status = readStatus();
+#ifdef SPI_LANES
+	/* Lane 0's status goes to every lane, so any lane with protection on has it all taken off */
+	uint8_t locked = readLanesStatus(flash->protect);
+	if (locked == 0)
+		return true;
+	writeStatus(status & ~flash->protect);
+	if (!waitWriteComplete(TW_TYPICAL, TW_MAX))
+		return false;
+	locked = readLanesStatus(flash->protect);
+	lanesFailed |= locked & ~0x01;
+	return (locked & 0x01) == 0;
+#else
+	if ((status & flash->protect) == 0)
+		return true;
+	writeStatus(status & ~flash->protect);
+	return waitWriteComplete(TW_TYPICAL, TW_MAX) && (readStatus() & flash->protect) == 0;
 #endif
+}
+
+/* Protects the whole device again, for boards that expect to find it that way */
+void lockDevice()
+{
+	writeStatus(readStatus() | flash->protect);
+	waitWriteComplete(TW_TYPICAL, TW_MAX);
+}
+
+#ifdef SPI_COMMANDS
+/* Reads the status register that opcode gives, which for the QE bit's is a second one */
+uint8_t readStatus2(const uint8_t opcode)
+{
+	uint8_t status;
+	spiChipSelect(true);
+	spiWrite(opcode);
+	status = spiRead();
+	spiChipSelect(false);
+	return status;
+}
 
 /*
- * 0x20 => Manufacturer ID (Numonyx)
- * 0x20 => Memory Type (SPI Flash)
- * 0x14 => Memory Capacity - 8Mbit
+ * Sets or clears the device's Quad Enable bit the way its QER says, returning false if we don't know how.
+ * Parts that can't have status register 2 read back get the rest of it written as 0.
  */
-static const uint8_t M25P80_DID[3] = { 0x20, 0x71, 0x14 };
+bool writeQuadEnable(const bool enable)
+{
+	const uint8_t status = readStatus();
+	uint8_t status2 = 0;
+
+	if (flashQER == QER_SR2_QE7)
+		status2 = readStatus2(RDSR2_QE7);
+	else if (flashQER == QER_SR2_RDSR2 || flashQER == QER_SR2_WRSR2)
+		status2 = readStatus2(RDSR2);
+	else if (flashQER != QER_SR1 && flashQER != QER_SR2_WRSR && flashQER != QER_SR2_KEEP)
+		return false;
+
+	writeEnable();
+	/* Select the device */
+	spiChipSelect(true);
+	if (flashQER == QER_SR1)
+	{
+		spiWrite(WRSR);
+		spiWrite(enable ? status | SR_QE6 : status & ~SR_QE6);
+	}
+	else if (flashQER == QER_SR2_QE7)
+	{
+		spiWrite(WRSR2_QE7);
+		spiWrite(enable ? status2 | SR_QE7 : status2 & ~SR_QE7);
+	}
+	else if (flashQER == QER_SR2_WRSR2)
+	{
+		spiWrite(WRSR2);
+		spiWrite(enable ? status2 | SR_QE1 : status2 & ~SR_QE1);
+	}
+	else
+	{
+		/* The rest take status register 2 as WRSR's second byte */
+		spiWrite(WRSR);
+		spiWrite(status);
+		spiWrite(enable ? status2 | SR_QE1 : status2 & ~SR_QE1);
+	}
+	/* Deselect the device */
+	spiChipSelect(false);
+	busyStart();
+	return waitWriteComplete(TW_TYPICAL, TW_MAX);
+}
+
+/* Starts the session on the device's single line read and Page Program, for selectCommands() to widen later */
+void resetCommands()
+{
+	readCommand.opcode = flash->read.opcode;
+	readCommand.addrBytes = flash->addrMode == ADDR_3BYTE ? 3 : 4;
+	readCommand.waitClocks = flash->read.waitClocks;
+	readCommand.lines = SPI_LINES_1_1_1;
+	programCommand.opcode = flash->programOp;
+	programCommand.addrBytes = readCommand.addrBytes;
+	programCommand.waitClocks = 0;
+	programCommand.lines = SPI_LINES_1_1_1;
+	quadEnabled = false;
+}
+
+/* Whether command reads the check block back the same as the single line read at the safe clock did */
+bool commandReadsBack(const spiCommand_t *command)
+{
+	spiCommandRead(command, checkAddr, spiBuffer[1], sizeof(spiBuffer[1]));
+	return datacmp(spiBuffer[0], spiBuffer[1], sizeof(spiBuffer[1])) == 0;
+}
+
 /*
- * 0x20 => Manufacturer ID (Numonyx)
- * 0x20 => Memory Type (SPI Flash)
- * 0x15 => Memory Capacity - 16Mbit
+ * Settles on the read and Page Program the command engine runs, trying the widest read the device lists first.
+ * Each is checked at the safe clock against the check block in spiBuffer[0], so a board that doesn't wire IO2 and IO3
+ * through - or a quad read whose QE bit we can't set - falls back to fewer lines. A device that fails a quad read
+ * as it is gets its QE bit set and another go. The Page Program only goes over 4 lines when the quad reads work.
+ * Without a check block from the device's contents there's nothing to try a read against, so it stays on one line.
  */
-static const uint8_t M25P16_DID[3] = { 0x20, 0x20, 0x15 };
+void selectCommands()
+{
+	/* The reads widest first, and the lines each goes over */
+	static const uint8_t modes[READ_MODES] = { READ_1_4_4, READ_1_1_4, READ_1_2_2, READ_1_1_2 };
+	static const uint8_t lines[READ_MODES] = { SPI_LINES_1_4_4, SPI_LINES_1_1_4, SPI_LINES_1_2_2, SPI_LINES_1_1_2 };
+	/* The multi-IO reads are in their 3-byte forms unless they came from the 4BAIT along with the 4-byte ones we use */
+	const bool multiIO = flash->read.opcode != FAST_READ4 || sfdpInfo.read.opcode == FAST_READ4;
+	uint8_t i;
+
+	for (i = 0; multiIO && checkSource == CHECK_CONTENTS && i < READ_MODES; i++)
+	{
+		const FlashRead_t *read = &flashReads[modes[i]];
+		const bool quad = lines[i] == SPI_LINES_1_1_4 || lines[i] == SPI_LINES_1_4_4;
+		spiCommand_t command;
+		if (read->opcode == 0)
+			continue;
+		command.opcode = read->opcode;
+		command.addrBytes = readCommand.addrBytes;
+		command.waitClocks = read->waitClocks;
+		command.lines = lines[i];
+		if (!commandReadsBack(&command))
+		{
+			if (!quad || quadEnabled || flashQER == QER_NONE || flashQER == QER_UNKNOWN)
+				continue;
+			quadEnabled = true;
+			if (!writeQuadEnable(true) || !commandReadsBack(&command))
+				continue;
+		}
+		readCommand = command;
+		if (quad && flashQuadProgram != 0)
+		{
+			programCommand.opcode = flashQuadProgram;
+			programCommand.lines = SPI_LINES_1_1_4;
+		}
+		break;
+	}
+
+	/* If setting QE came to nothing, put it back */
+	if (quadEnabled && readCommand.lines != SPI_LINES_1_1_4 && readCommand.lines != SPI_LINES_1_4_4)
+	{
+		writeQuadEnable(false);
+		quadEnabled = false;
+	}
+}
+#endif
+
+/* Puts the device back the way whatever boots from it expects to find it, once we're done with it */
+void releaseDevice()
+{
+	exit4ByteMode();
+#ifdef SPI_COMMANDS
+	if (quadEnabled)
+	{
+		writeQuadEnable(false);
+		quadEnabled = false;
+	}
+#endif
+}
+
+/* Returns the typical time to erase the first len bytes of a 32K block (0 < len <= 32K) */
+uint32_t eraseCost32K(const FlashInfo_t *info, const uint32_t len)
+{
+	uint32_t cost = ERASE_NONE;
+	if (info->eraseSizes & ERASE_4K)
+		cost = ((len + SIZE_4K - 1) / SIZE_4K) * info->tSSE.typical;
+	if ((info->eraseSizes & ERASE_32K) && info->tBE32.typical < cost)
+		cost = info->tBE32.typical;
+	return cost;
+}
+
+/*
+ * Works out the cheapest erase to make at addr (which is always at least 4K aligned)
+ * given the image ends at end, returning its size.
+ * This is stateless so that planning the whole image and erasing it piecemeal agree.
+ */
+uint32_t planErase(const uint32_t addr, const uint32_t end)
+{
+	const FlashInfo_t *info = flash;
+	uint32_t need;
+
+	if ((info->eraseSizes & ERASE_64K) && (addr & (SIZE_64K - 1)) == 0)
+	{
+		uint32_t cost;
+		need = end - addr;
+		if (need > SIZE_64K)
+			need = SIZE_64K;
+		/* Compare with the cost of covering each half of the sector separately */
+		if (need > SIZE_32K)
+		{
+			cost = eraseCost32K(info, need - SIZE_32K);
+			if (cost != ERASE_NONE)
+				cost += eraseCost32K(info, SIZE_32K);
+		}
+		else
+			cost = eraseCost32K(info, need);
+		if (cost == ERASE_NONE || info->tSE.typical <= cost)
+			return SIZE_64K;
+	}
+	if ((info->eraseSizes & ERASE_32K) && (addr & (SIZE_32K - 1)) == 0)
+	{
+		need = end - addr;
+		if (need > SIZE_32K)
+			need = SIZE_32K;
+		if ((info->eraseSizes & ERASE_4K) == 0 ||
+			info->tBE32.typical <= ((need + SIZE_4K - 1) / SIZE_4K) * info->tSSE.typical)
+			return SIZE_32K;
+	}
+	return SIZE_4K;
+}
+
+/*
+ * Decides if erasing the whole chip up front is cheaper than erasing just the blocks the image covers,
+ * returning the typical time in ms the erasing will take
+ */
+uint32_t planErasure(const uint32_t end)
+{
+	const FlashInfo_t *info = flash;
+	uint32_t addr, cost = 0;
+
+	for (addr = 0; addr < end && cost < info->tBE.typical; )
+	{
+		uint32_t size = planErase(addr, end);
+		if (size == SIZE_64K)
+			cost += info->tSE.typical;
+		else if (size == SIZE_32K)
+			cost += info->tBE32.typical;
+		else
+			cost += info->tSSE.typical;
+		addr += size;
+	}
+	eraseChip = cost >= info->tBE.typical;
+	erasedTo = 0;
+	return eraseChip ? info->tBE.typical : cost;
+}
+
+void eraseBlock(const uint8_t opcode, const uint32_t addr)
+{
+	/* Ensure the device is write enabled */
+	writeEnable();
+	/* Select the device */
+	spiChipSelect(true);
+	/* Issue the erase instruction for the block containing addr */
+	sendAddress(opcode, addr);
+	/* Deselect the device - executes erase */
+	spiChipSelect(false);
+	busyStart();
+}
+
+/* Erases, just in time, whatever is needed for the page at addr to be programmed, returning false if an erase fails */
+bool eraseAhead(const uint32_t addr, const uint32_t end)
+{
+	while (!eraseChip && addr >= erasedTo)
+	{
+		uint32_t size = planErase(erasedTo, end);
+		const FlashTime_t *time;
+		if (size == SIZE_64K)
+		{
+			eraseBlock(flash->erase64KOp, erasedTo);
+			time = &flash->tSE;
+		}
+		else if (size == SIZE_32K)
+		{
+			eraseBlock(flash->erase32KOp, erasedTo);
+			time = &flash->tBE32;
+		}
+		else
+		{
+			eraseBlock(flash->erase4KOp, erasedTo);
+			time = &flash->tSSE;
+		}
+		if (!waitEraseComplete(time))
+			return false;
+		erasedTo += size;
+	}
+	return true;
+}
+
+#ifndef NOUSB
+/* Tells the host, should it ask, that we're still erasing */
+void answerErasePoll(const uint8_t *data)
+{
+	if (data == usbData && uartHaveData())
+	{
+		/* It doesn't matter what the request was.. */
+		uartRead();
+		/* Inform the connected PC */
+		uartWrite(CMD_ERASE);
+		uartWrite(RPL_BUSY);
+	}
+}
+#else
+#define answerErasePoll(data)
+#endif
+
+/* Erases the whole chip if that's the plan, returning false if it doesn't complete in time */
+bool eraseDevice(const uint8_t *data)
+{
+	bool busy = false;
+	if (eraseChip)
+	{
+		/* Ensure the device is write enabled */
+		writeEnable();
+		/* Select the device */
+		spiChipSelect(true);
+		/* Issue erase instruction */
+		spiWrite(BE);
+		/* Deselect the device - executes erase */
+		spiChipSelect(false);
+		busyStart();
+		/* It won't be done before its typical time, so leave the device be till then */
+		while (busyTime() < flash->tBE.typical * 1000)
+			answerErasePoll(data);
+		/* Select the device */
+		spiChipSelect(true);
+		/* Write the Read Status Register instruction */
+		spiWrite(RDSR);
+		/* While write is not complete (bit 0 => 1) */
+		while ((busy = (spiRead() & 0x01) != 0) && busyTime() < flash->tBE.max * 1000)
+			answerErasePoll(data);
+		/* Deselect the device */
+		spiChipSelect(false);
+	}
+#ifndef NOUSB
+	if (data == usbData)
+	{
+		/*
+		 * It doesn't matter what the request was..
+		 * When erasing just in time, this is the host's first poll and we're immediately done.
+		 */
+		uartRead();
+		/* Write complete, so say erase completed! */
+		uartWrite(CMD_ERASE);
+		uartWrite(busy ? RPL_FAIL : RPL_OK);
+	}
+#endif
+	return !busy;
+}
+
+/* Programs a page, leaving the last Page Program it takes running. Returns false if one before that fails */
+bool writeData(const uint32_t page, const uint8_t *data, const uint16_t dataLen)
+{
+	const uint32_t addr = page << 8;
+	uint16_t done = 0;
+	/* A device with smaller pages than ours takes one Page Program per device page, each completing before the next */
+	while (done < dataLen)
+	{
+		const uint16_t len = dataLen - done < flash->pageSize ? dataLen - done : flash->pageSize;
+		if (done != 0 && !waitWriteComplete(flash->tPP.typical, flash->tPP.max))
+			return false;
+		writeEnable();
+#ifdef SPI_COMMANDS
+		/* The command engine sends the instruction and data itself, the data over 4 lines when the device takes QPP */
+		spiCommandWrite(&programCommand, addr + done, data + done, len);
+#else
+		/* Select the device */
+		spiChipSelect(true);
+		/* And issue the Page Program instruction */
+		sendAddress(flash->programOp, addr + done);
+		/* Send the data in the background, taking in more pages from the host meanwhile */
+		spiBlockStart(data + done, NULL, len);
+		waitBlock();
+		/* Deselect the device - executes write instruction */
+		spiChipSelect(false);
+#endif
+		busyStart();
+		done += len;
+	}
+	receiveData();
+	return true;
+}
+
+/* Starts reading the check block from wherever checkSource says it is, leaving the device selected for it to be clocked out */
+void sendCheck()
+{
+	/* Select the device */
+	spiChipSelect(true);
+	if (checkSource == CHECK_SFDP)
+	{
+		/* SFDP addresses are always 3 bytes, whatever mode the device is in, and are followed by a dummy byte */
+		sendAddressBytes(RDSFDP, 0, 3);
+		spiWrite(0);
+	}
+	else
+		sendRead(checkAddr);
+}
+
+/*
+ * Reads the check block at the safe clock for checkClock() to compare against - every lane's into laneCheck when
+ * gang programming - returning whether it's varied enough to show up a misread. A block that's all the same,
+ * such as a blank device's, reads back right at clocks that garble everything else, and SFDP tables have to be there.
+ */
+bool takeCheck()
+{
+#ifdef SPI_LANES
+	uint8_t lane;
+	sendCheck();
+	spiLanesRead(laneCheck, 256);
+	spiChipSelect(false);
+	for (lane = 0; lane < SPI_LANES; lane++)
+	{
+		const uint8_t *check = laneCheck + (lane << 8);
+		if ((lanesFailed & (1 << lane)) == 0 && dataFilled(check, 256, check[0]))
+			return false;
+	}
+	return checkSource != CHECK_SFDP || sfdpDword(laneCheck, 1) == SFDP_SIGNATURE;
+#else
+	sendCheck();
+	spiReadBlock(spiBuffer[0], sizeof(spiBuffer[0]));
+	spiChipSelect(false);
+	if (dataFilled(spiBuffer[0], sizeof(spiBuffer[0]), spiBuffer[0][0]))
+		return false;
+	return checkSource != CHECK_SFDP || sfdpDword(spiBuffer[0], 1) == SFDP_SIGNATURE;
+#endif
+}
+
+/* Whether the check block takeCheck() just read is erased on every lane, so a pattern can be programmed straight over it */
+bool checkErased()
+{
+#ifdef SPI_LANES
+	uint8_t lane;
+	for (lane = 0; lane < SPI_LANES; lane++)
+	{
+		if ((lanesFailed & (1 << lane)) == 0 && !dataFilled(laneCheck + (lane << 8), 256, 0xFF))
+			return false;
+	}
+	return true;
+#else
+	return dataFilled(spiBuffer[0], sizeof(spiBuffer[0]), 0xFF);
+#endif
+}
+
+/*
+ * Programs a pattern for the clock check at checkAddr, erasing the block under it first if that isn't already.
+ * Returns false if the erase or program fails.
+ */
+bool writePattern()
+{
+	uint8_t lfsr = CLOCK_PATTERN_TAPS;
+	size_t i;
+	if (!checkErased())
+	{
+		/* Erase the block as a session would its first, which planErasure() then plans afresh */
+		eraseChip = false;
+		erasedTo = 0;
+		if (!eraseAhead(checkAddr, checkAddr + sizeof(spiBuffer[1])))
+			return false;
+	}
+	for (i = 0; i < sizeof(spiBuffer[1]); i++)
+	{
+		spiBuffer[1][i] = lfsr;
+		lfsr = (lfsr >> 1) ^ ((lfsr & 0x01) != 0 ? CLOCK_PATTERN_TAPS : 0);
+	}
+	return writeData(checkAddr >> 8, spiBuffer[1], sizeof(spiBuffer[1])) &&
+		waitWriteComplete(flash->tPP.typical, flash->tPP.max);
+}
+
 /*
- * 0xEF => Winbond
- * 0x40 => SPIFlash
- * 0x14 => 8Mbit
+ * Settles on the check block calibrateClock() reads back at each step, and takes it at the safe clock.
+ * The device's contents do where they're varied. Where they're all the same, as on a blank device, a session about
+ * to program the device (scratch) uses its first block: it's erased again before the image goes into it, so we're
+ * free to write a pattern there to read back. Otherwise the SFDP tables stand in, and without those either there's
+ * nothing to check a clock against. Returns false if writing the pattern fails.
  */
-static const uint8_t W25Q80BV_DID[3] = { 0xEF, 0x40, 0x14 };
-
-int datacmp(const uint8_t *a, const uint8_t *b, const size_t n)
+bool takeCheckBlock(const bool scratch)
 {
-	size_t i;
-	for (i = 0; i < n; i++)
+	checkSource = CHECK_CONTENTS;
+	checkAddr = CLOCK_CHECK_ADDR;
+	if (takeCheck())
+		return true;
+	if (scratch)
 	{
-		if (*a != *b)
-			return *a - *b;
-		a++;
-		b++;
+		checkAddr = CLOCK_PATTERN_ADDR;
+		if (takeCheck())
+			return true;
+		if (!writePattern())
+			return false;
+		if (takeCheck())
+			return true;
 	}
-	return 0;
+	checkSource = CHECK_SFDP;
+	if (takeCheck())
+		return true;
+	checkSource = CHECK_NONE;
+	return true;
 }
 
-#ifndef NOUSB
-uint16_t readData()
+/* Reads the ID and check block back at the current SPI clock, comparing them with what we got at the safe one */
+bool checkClock()
 {
-	uint8_t pageLen, i;
-	if (uartRead() != CMD_PAGE)
-		return 0;
-	pageLen = uartRead();
-	i = 0;
-	do
+	uint8_t i;
+#ifdef SPI_LANES
+	for (i = 0; i < CLOCK_ROUNDS; i++)
 	{
-		usbData[i] = uartRead();
-		i++;
+		/* The clock is shared, so has to suit every lane still in the session */
+		if (lanesMisidentified() != 0)
+			return false;
+		sendCheck();
+		spiLanesRead(laneData, 256);
+		spiChipSelect(false);
+		if (lanesMismatched(laneCheck, 256, 256) != 0)
+			return false;
+	}
+#else
+	uint8_t did[3];
+	for (i = 0; i < CLOCK_ROUNDS; i++)
+	{
+		readDID(did);
+		if (datacmp(did, flashDID, 3) != 0)
+			return false;
+		if (checkSource == CHECK_SFDP)
+			readSFDP(0, spiBuffer[1], sizeof(spiBuffer[1]));
+		else
+		{
+			readBegin(checkAddr);
+			readNext(spiBuffer[1], sizeof(spiBuffer[1]));
+			readEnd();
+		}
+		if (datacmp(spiBuffer[0], spiBuffer[1], sizeof(spiBuffer[1])) != 0)
+			return false;
 	}
-	while (i != pageLen);
-
-	if (pageLen == 0)
-		return 0x100;
-	else
-		return pageLen;
-}
 #endif
-
-bool verifyDID()
-{
-	uint8_t data[3], i;
-	/* Select the device */
-	spiChipSelect(true);
-	/* Send a JEDEC DID read request */
-	spiWrite(RDID);
-	/* For each of the three bytes returned */
-	for (i = 0; i < 3; i++)
-		/* And having recieved the answer, buffer it */
-		data[i] = spiRead();
-	/* Deselect the device */
-	spiChipSelect(false);
-	/* Compare the recieved data to the expected data */
-	/* I wanted to use memcmp here, but could not make use of the newlib implemenation */
-	if (datacmp(data, M25P80_DID, 3) == 0)
-		device = DEV_M25P80;
-	else if (datacmp(data, M25P16_DID, 3) == 0)
-		device = DEV_M25P16;
-	else if (datacmp(data, W25Q80BV_DID, 3) == 0)
-		device = DEV_W25Q80BV;
-	else
-		device = DEV_INVALID;
-	return device != DEV_INVALID;
+	return true;
 }
 
-void writeEnable()
+/*
+ * Starts a session with whatever device is on the other end at the safe SPI clock, leaving spiClock as the hint
+ * for calibrateClock(). Returns false if there's no device we can drive.
+ */
+bool openDevice()
 {
-	/* Select the device */
-	spiChipSelect(true);
-	/* Write enable the device */
-	spiWrite(WREN);
-	/* Deselect the device - executes write-enable instruction */
-	spiChipSelect(false);
-	asm("nop");
-	/* Select the device again */
-	spiChipSelect(true);
-	/* Issue Read Status Register instruction */
-	spiWrite(RDSR);
-	/* And use it's continuous read mode till the write enable completes (bit 1 => 1) */
-	while ((spiRead() & 0x02) == 0);
-	/* Deselect the device */
-	spiChipSelect(false);
+	spiSetRate(SPI_RATE_SAFE);
+	if (!identifyDevice())
+		return false;
+#ifdef SPI_LANES
+	identifyLanes();
+#endif
+#ifdef SPI_COMMANDS
+	resetCommands();
+#endif
+	return true;
 }
 
-void unlockDevice()
+/*
+ * Finds the fastest SPI clock this board carries reliably to the Flash, for the device openDevice() found.
+ * The ID and a check block are read at the safe clock for reference, and then back at each step of the divider
+ * down from the device's fastest until they match - scratch saying the session will erase and program the device,
+ * so may write its own check block. A hint, such as the clock the host last saw for this fixture, is checked on
+ * its own first. Returns false, leaving the clock safe, if writing the check block fails.
+ */
+bool calibrateClock(uint32_t hint, const bool scratch)
 {
-	writeEnable();
-	/* Select the device */
-	spiChipSelect(true);
-	/* Write the Status Register */
-	spiWrite(WRSR);
-	/* All zeros disables all enabled protections */
-	spiWrite(0x00);
-	/* Deselect the device */
-	spiChipSelect(false);
-}
+	uint32_t rate;
+	bool backedOff = false;
 
-void lockDevice()
-{
-	writeEnable();
-	/* Select the device */
-	spiChipSelect(true);
-	/* Write the Status Register */
-	spiWrite(WRSR);
-	/* The three Block Protect bits are bits [4:2] */
-	spiWrite(0x1C);
-	/* Deselect the device */
-	spiChipSelect(false);
-}
+	spiClock = spiSetRate(SPI_RATE_SAFE);
+	if (!takeCheckBlock(scratch))
+		return false;
+#ifdef SPI_COMMANDS
+	selectCommands();
+#endif
+	/* A clock that garbles the data can't be told from one that doesn't with nothing to read back */
+	if (checkSource == CHECK_NONE)
+		return true;
 
-void eraseDevice(const uint8_t *data)
-{
-	uint8_t i;
-	/* Ensure the device is write enabled */
-	writeEnable();
-	/* Select the device */
-	spiChipSelect(true);
-	/* Issue erase instruction */
-	spiWrite(BE);
-	/* Deselect the device - executes erase */
-	spiChipSelect(false);
-	for (i = 0; i < 10; i++);
-	/* Select the device */
-	spiChipSelect(true);
-	/* Write the Read Status Register instruction */
-	spiWrite(RDSR);
-	/* While write is not complete (bit 0 => 1) */
-	while ((spiRead() & 0x01) != 0)
+	if (hint > flash->clockMax)
+		hint = flash->clockMax;
+	if (hint > SPI_RATE_SAFE)
 	{
-#ifndef NOUSB
-		if (data == usbData && uartHaveData())
+		rate = spiSetRate(hint);
+		if (rate > SPI_RATE_SAFE && checkClock())
 		{
-			/* It doesn't matter what the request was.. */
-			uartRead();
-			/* Inform the connected PC */
-			uartWrite(CMD_ERASE);
-			uartWrite(RPL_BUSY);
+			spiClock = rate;
+			return true;
 		}
-#endif
 	}
-	/* Deselect the device */
-	spiChipSelect(false);
-#ifndef NOUSB
-	if (data == usbData)
+
+	for (rate = spiSetRate(flash->clockMax); rate > SPI_RATE_SAFE; rate = spiSetRate(rate - 1))
 	{
-		/* It doesn't matter what the request was.. */
-		uartRead();
-		/* Write complete, so say erase completed! */
-		uartWrite(CMD_ERASE);
-		uartWrite(RPL_OK);
+		if (checkClock())
+			break;
+		backedOff = true;
 	}
-#endif
+	/* A clock that only just works on this board is one that will fail on a warm day */
+	if (rate > SPI_RATE_SAFE && backedOff)
+		rate = spiSetRate(rate - (rate / CLOCK_MARGIN));
+	if (rate <= SPI_RATE_SAFE)
+		rate = spiSetRate(SPI_RATE_SAFE);
+	spiClock = rate;
+	return true;
 }
 
-void writeData(const uint8_t sector, const uint8_t page, const uint8_t *data, const uint16_t dataLen)
+#ifdef SPI_MAPPED
+/* Compares the device as mapped at window with data, a word at a time where the two line up */
+bool windowMatches(const uint8_t *window, const uint8_t *data, const size_t dataLen)
 {
-	uint16_t i;
-	writeEnable();
-	/* Select the device */
-	spiChipSelect(true);
-	/* And issue the Page Program instruction */
-	spiWrite(PP);
-	/* Sector is (sector >> 4), and sub-sector is (sector & 0x0F) */
-	spiWrite(sector);
-	/* The page of the sector */
-	spiWrite(page);
-	/* Must be 0 to select the first byte of the page */
-	spiWrite(0);
-	/* Send the data */
-	for (i = 0; i < dataLen; i++)
-		spiWrite(data[i]);
-	/* Deselect the device - executes write instruction */
-	spiChipSelect(false);
+	size_t i = 0;
+	if ((((uintptr_t)window | (uintptr_t)data) & 3) == 0)
+	{
+		for (; i + 4 <= dataLen; i += 4)
+		{
+			if (*(const uint32_t *)(window + i) != *(const uint32_t *)(data + i))
+				return false;
+		}
+	}
+	return datacmp(window + i, data + i, dataLen - i) == 0;
 }
+#endif
 
-bool verifyData(const uint16_t startPage, const uint8_t *data, const size_t dataLen)
+bool verifyData(const uint32_t startPage, const uint8_t *data, const size_t dataLen)
 {
-	uint16_t i;
+	size_t done = 0, chunk = spiChunk(dataLen);
+	uint8_t buffer = 0;
 	bool ok = true;
-	/* Select the device */
+#ifdef SPI_LANES
+	uint8_t mismatched = 0;
+#endif
+#ifdef SPI_MAPPED
+	const uint8_t *window = spiMap(&readCommand, flash->size);
+	if (window != NULL)
+	{
+		/* Straight out of the window, with nothing to read into a buffer first */
+		ok = windowMatches(window + (startPage << 8), data, dataLen);
+		spiUnmap();
+		return ok;
+	}
+#endif
+#ifdef SPI_LANES
+	/* Every lane is read back at once, a buffer's worth at a time through the one read */
 	spiChipSelect(true);
-	spiWrite(READ);
-	spiWrite(startPage >> 8);
-	spiWrite(startPage & 0xFF);
-	spiWrite(0);
-	for (i = 0; i < dataLen; i++)
+	sendRead(startPage << 8);
+	for (; done < dataLen; done += chunk)
 	{
-		if (spiRead() != data[i])
-		{
-			ok = false;
-			break;
-		}
+		chunk = spiChunk(dataLen - done);
+		spiLanesRead(laneData, chunk);
+		mismatched |= lanesMismatched(data + done, chunk, 0);
 	}
-	/* Deselect the device */
 	spiChipSelect(false);
+	/* Lanes that don't match drop out, and lane 0 fails the session */
+	lanesFailed |= mismatched & ~0x01;
+	return (mismatched & 0x01) == 0;
+#endif
+	readBegin(startPage << 8);
+	/* Read the next buffer's worth in the background while comparing this one */
+	readNext(spiBuffer[buffer], chunk);
+	while (ok && done < dataLen)
+	{
+		const size_t next = spiChunk(dataLen - done - chunk);
+		waitBlock();
+		if (next != 0)
+			readNext(spiBuffer[buffer ^ 1], next);
+		ok = datacmp(spiBuffer[buffer], data + done, chunk) == 0;
+		done += chunk;
+		chunk = next;
+		buffer ^= 1;
+	}
+	readEnd();
 	return ok;
 }
 
-void waitWriteComplete()
+#ifndef NOUSB
+/* Reads the first dataLen bytes of the device back in one go, returning their CRC32 */
+uint32_t crcFlash(const uint32_t dataLen)
 {
-	/* Select the device */
+	uint32_t done = 0, chunk = spiChunk(dataLen), crc = 0xFFFFFFFF;
+	uint8_t buffer = 0;
+#ifdef SPI_LANES
+	uint8_t lane;
+#endif
+#ifdef SPI_MAPPED
+	const uint8_t *window = spiMap(&readCommand, flash->size);
+	if (window != NULL)
+	{
+		/* The CRC engine takes the device straight from the window */
+		crc = spiMapCRC(crc, window, dataLen);
+		spiUnmap();
+		return ~crc;
+	}
+#endif
+#ifdef SPI_LANES
+	/* Each lane gets its own checksum, lane 0's being the one returned */
+	for (lane = 0; lane < SPI_LANES; lane++)
+		laneCRC[lane] = crc;
 	spiChipSelect(true);
-	/* Write the Read Status Register instruction */
-	spiWrite(RDSR);
-	/* And use it's continuous read mode till the write is complete (bit 0 => 0) */
-	while ((spiRead() & 0x01) != 0);
-	/* Deselect the device */
+	sendRead(0);
+	for (; done < dataLen; done += chunk)
+	{
+		chunk = spiChunk(dataLen - done);
+		spiLanesRead(laneData, chunk);
+		for (lane = 0; lane < SPI_LANES; lane++)
+			laneCRC[lane] = crc32Block(laneCRC[lane], laneData + lane * chunk, chunk);
+	}
 	spiChipSelect(false);
+	for (lane = 0; lane < SPI_LANES; lane++)
+		laneCRC[lane] = ~laneCRC[lane];
+	return laneCRC[0];
+#endif
+	readBegin(0);
+	/* Checksum one buffer while filling the other */
+	readNext(spiBuffer[buffer], chunk);
+	while (done < dataLen)
+	{
+		const uint32_t next = spiChunk(dataLen - done - chunk);
+		waitBlock();
+		if (next != 0)
+			readNext(spiBuffer[buffer ^ 1], next);
+		crc = crc32Block(crc, spiBuffer[buffer], chunk);
+		done += chunk;
+		chunk = next;
+		buffer ^= 1;
+	}
+	readEnd();
+	return ~crc;
 }
+#endif
 
 void transferBitfile(const void *data, const size_t dataLen)
 {
-	uint16_t addr, pages;
+	uint32_t addr, pages;
+	/* Only the host is told how long the erase should take */
+	uint32_t eraseTime __attribute__((unused));
 #ifndef NOCONFIG
 	const uint8_t *dataPtr = data;
 #endif
@@ -291,7 +1790,7 @@ void transferBitfile(const void *data, const size_t dataLen)
 	bool programmed = true;
 #endif
 
-	if (!verifyDID())
+	if (!openDevice())
 	{
 #ifndef NOUSB
 		if (data == usbData)
@@ -302,54 +1801,143 @@ void transferBitfile(const void *data, const size_t dataLen)
 #endif
 		return;
 	}
-#ifndef NOUSB
-	else if (data == usbData)
+	/* An image bigger than the device would wrap around and program over its start, so refuse it outright */
+	if (dataLen > flash->size)
 	{
-		uartWrite(CMD_START);
-		uartWrite(RPL_OK);
+#ifndef NOUSB
+		if (data == usbData)
+		{
+			uartWrite(CMD_START);
+			uartWrite(RPL_FAIL);
+		}
+#endif
+		return;
 	}
+	/*
+	 * Start from the clock we settled on last time, or that the host remembers for this fixture.
+	 * The image's first block is erased before anything is programmed into it, so the check may use it.
+	 */
+	if (!unlockDevice() || !calibrateClock(spiClock, dataLen != 0))
+	{
+#ifndef NOUSB
+		if (data == usbData)
+		{
+			uartWrite(CMD_ABORT);
+			uartWrite(RPL_FAIL);
+		}
 #endif
+		return;
+	}
 
 	pages = (dataLen >> 8) + ((dataLen & 0xFF) != 0 ? 1 : 0);
-	if (device == DEV_M25P80)
+	eraseTime = planErasure(pages << 8);
+#ifndef NOUSB
+	if (data == usbData)
 	{
-		unlockDevice();
-		waitWriteComplete();
+		uint8_t i;
+		uartWrite(CMD_START);
+		uartWrite(RPL_OK);
+		/* Tell the host how many pages it may have in flight, and the SPI clock we're running the Flash at */
+		uartWrite(PAGE_BUFFERS);
+		for (i = 0; i < 4; i++)
+			uartWrite((spiClock >> (24 - (i * 8))) & 0xFF);
+		/* And what the device is, and how long it should take, so it can tell the user */
+		for (i = 0; i < 3; i++)
+			uartWrite(flashDID[i]);
+		for (i = 0; i < 4; i++)
+			uartWrite((flash->size >> (24 - (i * 8))) & 0xFF);
+		for (i = 0; i < 4; i++)
+			uartWrite((flash->tPP.typical >> (24 - (i * 8))) & 0xFF);
+		for (i = 0; i < 4; i++)
+			uartWrite(((eraseChip ? eraseTime : 0) >> (24 - (i * 8))) & 0xFF);
+		for (i = 0; i < 4; i++)
+			uartWrite(((eraseChip ? 0 : eraseTime) >> (24 - (i * 8))) & 0xFF);
 	}
-	eraseDevice(data);
+#endif
+	if (!eraseDevice(data))
+		return;
+#ifndef NOUSB
+	if (data == usbData)
+		beginReceive(pages);
+#endif
 	for (addr = 0; addr < pages; addr++)
 	{
 #ifndef NOUSB
-		size_t pageLen;
+		size_t pageLen = 0;
+		const uint8_t *pageData = usbData + (rxTail << 8);
+#endif
+		/* Make sure the block this page lands in is erased - the host keeps sending meanwhile */
+		bool written = eraseAhead(addr << 8, pages << 8);
+#ifndef NOUSB
 		if (data == usbData)
 		{
-			pageLen = readData();
 			/* If we failed to receive the page, immediately indicate failure */
-			if (pageLen == 0)
+			if (!readData())
 			{
 				uartWrite(CMD_PAGE);
 				uartWrite(RPL_FAIL);
 				programmed = false;
 				break;
 			}
-			writeData(addr >> 8, addr & 0xFF, data, pageLen);
+			else if (usbPageSkip[rxTail] != 0)
+			{
+				const uint16_t skip = usbPageSkip[rxTail];
+				uint32_t skipEnd = (addr + skip) << 8;
+				/* Blank pages need no programming, but the blocks under them must still be erased */
+				if (!written || !eraseAhead(skipEnd - 0x100, pages << 8))
+				{
+					uartWrite(CMD_ABORT);
+					uartWrite(RPL_FAIL);
+					programmed = false;
+					break;
+				}
+				if (skipEnd > usbDataTotal)
+					skipEnd = usbDataTotal;
+				if (usbFlags & START_FLAG_CRC)
+				{
+					uint32_t i;
+					for (i = addr << 8; i < skipEnd; i++)
+						usbCRC = crc32Byte(usbCRC, 0xFF);
+				}
+				usbDataReceived += skipEnd - (addr << 8);
+				addr += skip - 1;
+				uartWrite(CMD_PAGE);
+				uartWrite(RPL_OK);
+				releaseData();
+				continue;
+			}
+			pageLen = usbPageLen[rxTail];
+			if (written)
+				written = writeData(addr, pageData, pageLen);
+			/* Checksum the page while the device programs it */
+			if (usbFlags & START_FLAG_CRC)
+				usbCRC = crc32Block(usbCRC, pageData, pageLen);
 		}
 #endif
 #ifndef NOCONFIG
 		if (data == config)
 		{
 			if ((addr + 1) < (dataLen >> 8))
-				writeData(addr >> 8, addr & 0xFF, dataPtr, 256);
-			else
-				writeData(addr >> 8, addr & 0xFF, dataPtr, dataLen & 0xFF);
+			{
+				if (written && !pageBlank(dataPtr, 256))
+					written = writeData(addr, dataPtr, 256);
+			}
+			else if (written && !pageBlank(dataPtr, dataLen & 0xFF))
+				written = writeData(addr, dataPtr, dataLen & 0xFF);
 			dataPtr += 256;
 		}
 #endif
-		waitWriteComplete();
+		/* The host's next pages come in while the device programs this one */
+		if (written)
+			written = waitWriteComplete(flash->tPP.typical, flash->tPP.max);
+#ifndef NOCONFIG
+		if (data == config && !written)
+			break;
+#endif
 #ifndef NOUSB
 		if (data == usbData)
 		{
-			if (!verifyData(addr, data, pageLen))
+			if (!written || ((usbFlags & START_FLAG_CRC) == 0 && !verifyData(addr, pageData, pageLen)))
 			{
 				uartWrite(CMD_ABORT);
 				uartWrite(RPL_FAIL);
@@ -361,43 +1949,87 @@ void transferBitfile(const void *data, const size_t dataLen)
 				uartWrite(CMD_PAGE);
 				uartWrite(RPL_OK);
 				usbDataReceived += pageLen;
+				releaseData();
 			}
 		}
 #endif
 	}
-	if (device == DEV_M25P80)
-	{
+	if (flash->relock)
 		lockDevice();
-		waitWriteComplete();
-	}
 #ifndef NOCONFIG
 	if (data == config)
 	{
-		if (verifyData(0, data, dataLen))
+		bool verified = verifyData(0, data, dataLen);
+#ifdef SPI_LANES
+		/* Only once every lane has come through */
+		verified = verified && lanesFailed == 0;
+#endif
+		if (verified)
 			gpioShowOK();
 	}
 #endif
 #ifndef NOUSB
 	if (data == usbData)
 	{
-		uint8_t cmd = uartRead();
+		uint8_t cmd, i;
+		uint32_t flashCRC = 0;
+		if (usbFlags & START_FLAG_CRC)
+		{
+			usbCRC = ~usbCRC;
+			if (programmed)
+			{
+				flashCRC = crcFlash(usbDataTotal);
+				programmed = flashCRC == usbCRC;
+#ifdef SPI_LANES
+				for (i = 1; i < SPI_LANES; i++)
+				{
+					if (laneCRC[i] != usbCRC)
+						lanesFailed |= 1 << i;
+				}
+#endif
+			}
+		}
+		cmd = endReceive();
 		if (cmd == CMD_STOP)
 		{
-			uint8_t i;
 			uint32_t diff = usbDataTotal - usbDataReceived;
+			/* Lane 0 fails with the session, and any others as they dropped out of it */
+#ifdef SPI_LANES
+			const uint8_t failed = lanesFailed | (programmed ? 0 : 0x01);
+#else
+			const uint8_t failed = programmed ? 0 : 0x01;
+#endif
 			for (i = 0; i < 4; i++)
 			{
 				uartWrite((diff >> 24) & 0xFF);
 				diff <<= 8;
 			}
 			uartWrite(CMD_STOP);
-			if (programmed)
+			if (failed == 0)
 			{
 				uartWrite(RPL_OK);
 				gpioShowOK();
 			}
 			else
 				uartWrite(RPL_FAIL);
+			if (usbFlags & START_FLAG_CRC)
+			{
+				for (i = 0; i < 4; i++)
+				{
+					uartWrite((usbCRC >> 24) & 0xFF);
+					usbCRC <<= 8;
+				}
+				for (i = 0; i < 4; i++)
+				{
+					uartWrite((flashCRC >> 24) & 0xFF);
+					flashCRC <<= 8;
+				}
+			}
+			if (usbFlags & START_FLAG_LANES)
+			{
+				uartWrite(LANE_COUNT);
+				uartWrite(failed);
+			}
 		}
 		else
 		{
@@ -408,6 +2040,133 @@ void transferBitfile(const void *data, const size_t dataLen)
 #endif
 }
 
+#ifndef NOUSB
+/*
+ * Streams the Flash back to the host in one continuous read.
+ * The host asks with the uint32_t address and length to read, a length of 0 meaning to the end of the device,
+ * and its hint for the SPI clock. We reply with the SPI clock we settled on and the length we'll actually send
+ * ahead of the data.
+ */
+void dumpFlash()
+{
+	uint8_t i, buffer = 0;
+	uint16_t chunk;
+	uint32_t addr = 0, len = 0, size;
+#if defined(SPI_MAPPED) && defined(UART_BUFFERS)
+	const uint8_t *window;
+#endif
+	for (i = 0; i < 4; i++)
+		addr = (addr << 8) | uartRead();
+	for (i = 0; i < 4; i++)
+		len = (len << 8) | uartRead();
+
+	for (i = 0; i < 4; i++)
+		spiClock = (spiClock << 8) | uartRead();
+
+	size = openDevice() && calibrateClock(spiClock, false) ? flash->size : 0;
+	if (len == 0 && addr < size)
+		len = size - addr;
+	if (addr >= size || len > size - addr)
+	{
+		uartWrite(CMD_READ);
+		uartWrite(RPL_FAIL);
+		return;
+	}
+	uartWrite(CMD_READ);
+	uartWrite(RPL_OK);
+	for (i = 0; i < 4; i++)
+		uartWrite((spiClock >> (24 - (i * 8))) & 0xFF);
+	for (i = 0; i < 4; i++)
+		uartWrite((len >> (24 - (i * 8))) & 0xFF);
+
+#if defined(SPI_MAPPED) && defined(UART_BUFFERS)
+	window = spiMap(&readCommand, flash->size);
+	if (window != NULL)
+	{
+		/* The device goes by DMA from the window into the link's own buffers, with no copy in between */
+		while (len != 0)
+		{
+			size_t count = len;
+			uint8_t *data = uartWriteBuffer(&count);
+			spiMapRead(window + addr, data, count);
+			uartWriteCommit(count);
+			addr += count;
+			len -= count;
+		}
+		spiUnmap();
+		gpioShowOK();
+		return;
+	}
+#endif
+	readBegin(addr);
+	/* Send each buffer's worth to the host while the next comes in behind it */
+	chunk = spiChunk(len);
+	readNext(spiBuffer[buffer], chunk);
+	while (len != 0)
+	{
+		const uint16_t next = spiChunk(len - chunk);
+		uint16_t j;
+		waitBlock();
+		if (next != 0)
+			readNext(spiBuffer[buffer ^ 1], next);
+		for (j = 0; j < chunk; j++)
+			uartWrite(spiBuffer[buffer][j]);
+		len -= chunk;
+		chunk = next;
+		buffer ^= 1;
+	}
+	readEnd();
+	gpioShowOK();
+}
+#endif
+
+#ifndef NOUSB
+/* Throws away whatever the host is sending until the line goes quiet, then drops back to baud */
+void fallBackBaud(const uint32_t baud)
+{
+	while (uartWaitData(BAUD_PROBE_TIMEOUT))
+		uartRead();
+	uartSetBaud(baud);
+	uartBaud = baud;
+}
+
+/*
+ * Switches the UART to the rate the host asks for, as CMD_BAUD lays out.
+ * If the probe or the host's confirmation don't arrive intact, we go back to the rate we were at.
+ */
+void changeBaud()
+{
+	uint8_t i;
+	uint32_t baud = 0;
+	bool probed = true;
+	for (i = 0; i < 4; i++)
+		baud = (baud << 8) | uartRead();
+
+	uartWrite(CMD_BAUD);
+	if (!uartBaudSupported(baud))
+	{
+		uartWrite(RPL_FAIL);
+		return;
+	}
+	uartWrite(RPL_OK);
+	uartSetBaud(baud);
+
+	for (i = 0; i < BAUD_PROBE_LEN && probed; i++)
+		probed = uartWaitData(BAUD_PROBE_TIMEOUT) && uartRead() == baudProbe[i];
+	if (probed)
+	{
+		for (i = 0; i < BAUD_PROBE_LEN; i++)
+			uartWrite(baudProbe[i]);
+		probed = uartWaitData(BAUD_PROBE_TIMEOUT) && uartRead() == RPL_OK;
+	}
+
+	if (probed)
+		uartBaud = baud;
+	else
+		fallBackBaud(uartBaud);
+}
+#endif
+
 int main()
 {
 	gpioInit();
@@ -427,6 +2186,7 @@ int main()
 			gpioSignalTransfer();
 			/* Attempt the transfer */
 			transferBitfile(config, configLen);
+			releaseDevice();
 			gpioEndTransfer();
 			gpioStartTimer();
 		}
@@ -435,7 +2195,8 @@ int main()
 		/* If the UART has recieved a byte.. */
 		if (uartHaveData())
 		{
-			if (uartPeak() == CMD_START)
+			const uint8_t cmd = uartPeak();
+			if (cmd == CMD_START)
 			{
 				uint8_t i;
 				gpioStopTimer();
@@ -447,15 +2208,42 @@ int main()
 					usbDataTotal <<= 8;
 					usbDataTotal |= uartRead();
 				}
+				usbFlags = uartRead();
+				/* The host's hint for the SPI clock, which it remembers per fixture */
+				for (i = 0; i < 4; i++)
+					spiClock = (spiClock << 8) | uartRead();
+				usbCRC = 0xFFFFFFFF;
 				gpioSignalTransfer();
 				transferBitfile(usbData, usbDataTotal);
+				releaseDevice();
+				/* A negotiated rate only lasts the session */
+				uartBaud = BAUD_DEFAULT;
+				uartSetBaud(uartBaud);
+				gpioEndTransfer();
+				gpioStartTimer();
+			}
+			else if (cmd == CMD_READ)
+			{
+				gpioStopTimer();
+				gpioBeginTransfer();
+				gpioSignalTransfer();
+				dumpFlash();
+				releaseDevice();
+				/* A negotiated rate only lasts the session */
+				uartBaud = BAUD_DEFAULT;
+				uartSetBaud(uartBaud);
 				gpioEndTransfer();
 				gpioStartTimer();
 			}
+			else if (cmd == CMD_BAUD)
+				changeBaud();
 			else
 			{
 				uartWrite(CMD_INVALID);
 				uartWrite(RPL_FAIL);
+				/* Noise at a negotiated rate most likely means a new host is talking to us at the default one */
+				if (uartBaud != BAUD_DEFAULT)
+					fallBackBaud(BAUD_DEFAULT);
 			}
 		}
 #endif
@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <tm4c123gh6pm.h>
 #include "GPIO.h"
+#include "Clock.h"
 
 void gpioInit()
 {
@@ -60,7 +61,7 @@ void gpioInit()
 	TIMER0_CTL_R &= ~TIMER_CTL_TAEN;
 	TIMER0_TAMR_R = TIMER_TAMR_TAMR_1_SHOT | TIMER_TAMR_TACDIR | TIMER_TAMR_TAMIE;
 	/* Set the timeout for 500ms */
-	TIMER0_TAMATCHR_R = 8000000;
+	TIMER0_TAMATCHR_R = clockSystem() / 2;
 	TIMER0_ICR_R = TIMER_ICR_TAMCINT;
 }
 
@@ -18,6 +18,41 @@
 
 #include <tm4c123gh6pm.h>
 #include "SPI.h"
+#include "Clock.h"
+
+/* The SSI's TX and RX FIFOs are each 8 frames deep */
+#define SSI_FIFO_LEN	8
+/* The fastest the TM4C123's datasheet allows SSInClk to run as a master, however cleanly a board carries more */
+#define SSI_RATE_MAX	25000000
+#ifdef SPI_PACK16
+/* Blocks shorter than this aren't worth changing the frame size for */
+#define SPI_PACK_MIN	16
+#endif
+
+/* SSI0 RX and TX are uDMA channels 10 and 11 in the default channel map */
+#define DMA_CH_SSI0RX	10
+#define DMA_CH_SSI0TX	11
+#define DMA_CHANNELS	((1 << DMA_CH_SSI0RX) | (1 << DMA_CH_SSI0TX))
+/* A basic mode uDMA transfer moves at most 1024 items */
+#define SPI_DMA_MAX		1024
+/* The uDMA can't reach the MCU's Flash, only SRAM, which starts here */
+#define SRAM_BASE		0x20000000
+
+typedef struct
+{
+	volatile uint32_t srcEnd;
+	volatile uint32_t dstEnd;
+	volatile uint32_t control;
+	uint32_t unused;
+} dmaControl_t;
+
+/* The control table has to be 1024 byte aligned, but we only need the primary structures up to SSI0 TX */
+static dmaControl_t dmaControl[DMA_CH_SSI0TX + 1] __attribute__((aligned(1024)));
+/* Blocks sourced from the MCU's Flash, such as the built-in config, get copied through here */
+static uint8_t spiBounce[256];
+/* What we clock out when there's no TX buffer, and where what comes back goes when there's no RX buffer */
+static uint8_t spiZero, spiSink;
+static volatile bool spiDMABusy;
 
 void spiInit()
 {
@@ -42,12 +77,71 @@ void spiInit()
 	GPIO_PORTA_DATA_BITS_R[0x08] = 0x08;
 	/* Set Freescale SPI, SPO = 1, SPH = 1 */
 	SSI0_CR0_R = SSI_CR0_SPO | SSI_CR0_SPH | SSI_CR0_FRF_MOTO | SSI_CR0_DSS_8;
-	/* We have a 16 MHz clock, and we interface to the SPI Flash chip at 8MHz */
-	SSI0_CC_R = 0;
-	/* Scale the clock by 8 to make it 2MHz */
-	SSI0_CPSR_R = 8;
-	/* Enable the interface */
+	/* Run the SSI from the system clock, divided down to a rate any board copes with until we know better */
+	SSI0_CC_R = SSI_CC_CS_SYSPLL;
+	/* This also enables the interface */
+	spiSetRate(SPI_RATE_SAFE);
+
+	/* Enable the uDMA and hand it its control table */
+	SYSCTL_RCGCDMA_R |= SYSCTL_RCGCDMA_R0;
+	while ((SYSCTL_PRDMA_R & SYSCTL_PRDMA_R0) != SYSCTL_PRDMA_R0);
+	UDMA_CFG_R = UDMA_CFG_MASTEN;
+	UDMA_CTLBASE_R = (uint32_t)dmaControl;
+	/*
+	 * Map channels 10 and 11 to SSI0, using their primary structures and taking single as well as burst requests.
+	 * RX gets the higher priority so the RX FIFO never overruns while TX is being fed.
+	 */
+	UDMA_CHMAP1_R &= ~(UDMA_CHMAP1_CH10SEL_M | UDMA_CHMAP1_CH11SEL_M);
+	UDMA_ALTCLR_R = DMA_CHANNELS;
+	UDMA_USEBURSTCLR_R = DMA_CHANNELS;
+	UDMA_REQMASKCLR_R = DMA_CHANNELS;
+	UDMA_PRIOSET_R = 1 << DMA_CH_SSI0RX;
+	/* uDMA completion for SSI0's channels comes in on the SSI0 interrupt */
+	NVIC_EN0_R = 1 << (INT_SSI0 - 16);
+}
+
+void irqSSI0()
+{
+	UDMA_CHIS_R = UDMA_CHIS_R & DMA_CHANNELS;
+	/* Everything's been clocked through once the RX channel has stored the last byte and switched itself off */
+	if ((UDMA_ENASET_R & (1 << DMA_CH_SSI0RX)) == 0)
+	{
+		SSI0_DMACTL_R = 0;
+		spiDMABusy = false;
+	}
+}
+
+/*
+ * The SPI clock is the system clock / (CPSDVSR * (1 + SCR)), where CPSDVSR is even and 2 to 254 and SCR is 0 to 255.
+ * This takes the smallest prescale that lets SCR make up the rest of the division, so 80MHz divides to 20MHz as 2 * 2.
+ * As with the frame size, the SSI has to be idle and disabled while it's changed. Rates past SSI_RATE_MAX are held to it.
+ */
+uint32_t spiSetRate(uint32_t rate)
+{
+	const uint32_t clock = clockSystem();
+	uint32_t divisor, prescale = 2, scale;
+	if (rate == 0)
+		rate = 1;
+	else if (rate > SSI_RATE_MAX)
+		rate = SSI_RATE_MAX;
+	/* Rounded so that a rate this returned gives back the same divisor */
+	divisor = clock / rate;
+	if (divisor == 0 || clock / divisor > rate)
+		divisor++;
+	while (prescale < 254 && ((divisor + prescale - 1) / prescale) > 256)
+		prescale += 2;
+	scale = (divisor + prescale - 1) / prescale;
+	if (scale > 256)
+		scale = 256;
+	else if (scale == 0)
+		scale = 1;
+
+	while ((SSI0_SR_R & SSI_SR_BSY) != 0);
+	SSI0_CR1_R = 0;
+	SSI0_CPSR_R = prescale;
+	SSI0_CR0_R = (SSI0_CR0_R & ~SSI_CR0_SCR_M) | ((scale - 1) << SSI_CR0_SCR_S);
 	SSI0_CR1_R = SSI_CR1_SSE;
+	return clock / (prescale * scale);
 }
 
 void spiWrite(uint8_t data)
@@ -67,6 +161,136 @@ uint8_t spiRead()
 	return SSI0_DR_R & 0xFF;
 }
 
+/*
+ * Moves frameCount frames through the SSI, keeping the TX FIFO topped up while draining the RX FIFO.
+ * No more frames are let in flight than the RX FIFO can hold, so nothing received is ever dropped.
+ * tx or rx may be NULL to send 0s or throw away what comes back. Wide frames carry two bytes, first byte MSB.
+ */
+static void spiBurst(const uint8_t *tx, uint8_t *rx, const size_t frameCount, const bool wide)
+{
+	size_t sent = 0, received = 0;
+	while (received < frameCount)
+	{
+		while (sent < frameCount && (sent - received) < SSI_FIFO_LEN && (SSI0_SR_R & SSI_SR_TNF) != 0)
+		{
+			uint16_t frame = 0;
+			if (tx != NULL)
+				frame = wide ? (tx[sent << 1] << 8) | tx[(sent << 1) + 1] : tx[sent];
+			SSI0_DR_R = frame;
+			sent++;
+		}
+		while (received < sent && (SSI0_SR_R & SSI_SR_RNE) != 0)
+		{
+			const uint16_t frame = SSI0_DR_R;
+			if (rx != NULL && wide)
+			{
+				rx[received << 1] = frame >> 8;
+				rx[(received << 1) + 1] = frame & 0xFF;
+			}
+			else if (rx != NULL)
+				rx[received] = frame & 0xFF;
+			received++;
+		}
+	}
+}
+
+#ifdef SPI_PACK16
+/*
+ * The frame size can only be changed with the SSI idle and disabled.
+ * With SPO = 1 and the clock pin pulled up, the clock stays idle high meanwhile so the Flash sees no edges.
+ */
+static void spiFrameSize(const uint32_t size)
+{
+	while ((SSI0_SR_R & SSI_SR_BSY) != 0);
+	SSI0_CR1_R = 0;
+	SSI0_CR0_R = (SSI0_CR0_R & ~SSI_CR0_DSS_M) | size;
+	SSI0_CR1_R = SSI_CR1_SSE;
+}
+#endif
+
+/* Sends dataLen bytes as pairs in 16-bit frames if built with SPI_PACK16, halving the FIFO traffic */
+static void spiBlock(const uint8_t *tx, uint8_t *rx, size_t dataLen)
+{
+#ifdef SPI_PACK16
+	if (dataLen >= SPI_PACK_MIN)
+	{
+		const size_t pairs = dataLen >> 1;
+		spiFrameSize(SSI_CR0_DSS_16);
+		spiBurst(tx, rx, pairs, true);
+		spiFrameSize(SSI_CR0_DSS_8);
+		if (tx != NULL)
+			tx += pairs << 1;
+		if (rx != NULL)
+			rx += pairs << 1;
+		dataLen &= 1;
+	}
+#endif
+	spiBurst(tx, rx, dataLen, false);
+}
+
+void spiWriteBlock(const uint8_t *data, size_t dataLen)
+{
+	spiBlock(data, NULL, dataLen);
+}
+
+void spiReadBlock(uint8_t *data, size_t dataLen)
+{
+	spiBlock(NULL, data, dataLen);
+}
+
+static void dmaSetup(const uint8_t channel, const uint32_t src, const uint32_t dst, const uint32_t inc, const size_t dataLen)
+{
+	dmaControl[channel].srcEnd = src;
+	dmaControl[channel].dstEnd = dst;
+	dmaControl[channel].control = inc | UDMA_CHCTL_SRCSIZE_8 | UDMA_CHCTL_DSTSIZE_8 | UDMA_CHCTL_ARBSIZE_4 |
+		((dataLen - 1) << UDMA_CHCTL_XFERSIZE_S) | UDMA_CHCTL_XFERMODE_BASIC;
+}
+
+/*
+ * Hands the block to the uDMA, which feeds TX and drains RX on SSI0's FIFO requests, the RX completion interrupt
+ * then marking it done. This always runs with 8-bit frames, as with the CPU out of the loop packing buys nothing.
+ * Blocks the uDMA can't do in one go, or that come from the MCU's Flash and don't fit the bounce buffer,
+ * are done by the CPU before returning.
+ */
+void spiBlockStart(const uint8_t *tx, uint8_t *rx, size_t dataLen)
+{
+	if (tx != NULL && (uint32_t)tx < SRAM_BASE && dataLen <= sizeof(spiBounce))
+	{
+		size_t i;
+		for (i = 0; i < dataLen; i++)
+			spiBounce[i] = tx[i];
+		tx = spiBounce;
+	}
+	if (dataLen == 0 || dataLen > SPI_DMA_MAX || (tx != NULL && (uint32_t)tx < SRAM_BASE))
+	{
+		spiBlock(tx, rx, dataLen);
+		return;
+	}
+
+	if (tx != NULL)
+		dmaSetup(DMA_CH_SSI0TX, (uint32_t)(tx + dataLen - 1), (uint32_t)&SSI0_DR_R,
+			UDMA_CHCTL_SRCINC_8 | UDMA_CHCTL_DSTINC_NONE, dataLen);
+	else
+		dmaSetup(DMA_CH_SSI0TX, (uint32_t)&spiZero, (uint32_t)&SSI0_DR_R,
+			UDMA_CHCTL_SRCINC_NONE | UDMA_CHCTL_DSTINC_NONE, dataLen);
+	if (rx != NULL)
+		dmaSetup(DMA_CH_SSI0RX, (uint32_t)&SSI0_DR_R, (uint32_t)(rx + dataLen - 1),
+			UDMA_CHCTL_SRCINC_NONE | UDMA_CHCTL_DSTINC_8, dataLen);
+	else
+		dmaSetup(DMA_CH_SSI0RX, (uint32_t)&SSI0_DR_R, (uint32_t)&spiSink,
+			UDMA_CHCTL_SRCINC_NONE | UDMA_CHCTL_DSTINC_NONE, dataLen);
+
+	spiDMABusy = true;
+	UDMA_ENASET_R = DMA_CHANNELS;
+	/* Turning on the SSI's DMA requests sets it going */
+	SSI0_DMACTL_R = SSI_DMACTL_TXDMAE | SSI_DMACTL_RXDMAE;
+}
+
+bool spiBlockDone()
+{
+	return !spiDMABusy;
+}
+
 void spiChipSelect(bool select)
 {
 	if (select)
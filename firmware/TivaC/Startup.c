@@ -18,6 +18,8 @@
 
 /* The startup code for the TivaC */
 #include <stdint.h>
+#include <tm4c123gh6pm.h>
+#include "Clock.h"
 
 #ifndef NULL
 #define NULL	(void *)0
@@ -28,6 +30,10 @@ void irqReset();
 void irqNMI();
 void irqEmptyDef();
 void irqHardFault() __attribute__((naked));
+extern void irqSSI0();
+/* Only one of UART.c and USB.c is built in, so whichever host link isn't falls back to the default handler */
+void irqUART0() __attribute__((weak, alias("irqEmptyDef")));
+void irqUSB0() __attribute__((weak, alias("irqEmptyDef")));
 
 extern uint32_t _stack_top;
 extern uint32_t _start_text, _end_text;
@@ -62,9 +68,9 @@ irqFunction vectorTable[] __attribute__((section(".nvic_table"))) =
 	irqEmptyDef, /* GPIO Port C */
 	irqEmptyDef, /* GPIO Port D */
 	irqEmptyDef, /* GPIO Port E */
-	irqEmptyDef, /* UART 0 */
+	irqUART0, /* UART 0 */
 	irqEmptyDef, /* UART 1 */
-	irqEmptyDef, /* SSI 0 */
+	irqSSI0, /* SSI 0 */
 	irqEmptyDef, /* I2C 0 */
 	irqEmptyDef, /* PWM 0 Fault */
 	irqEmptyDef, /* PWM 0 Gen 0 */
@@ -101,7 +107,7 @@ irqFunction vectorTable[] __attribute__((section(".nvic_table"))) =
 	NULL, /* Reserved */
 	NULL, /* Reserved */
 	irqEmptyDef, /* Hibernation Module */
-	irqEmptyDef, /* USB */
+	irqUSB0, /* USB */
 	NULL, /* Reserved */
 	irqEmptyDef, /* UDMA SW */
 	irqEmptyDef, /* UDMA Error */
@@ -198,6 +204,63 @@ irqFunction vectorTable[] __attribute__((section(".nvic_table"))) =
 	NULL /* Reserved */
 };
 
+/* We come out of reset on the 16MHz PIOSC */
+#define CLOCK_PIOSC		16000000
+/* The PLL runs at 400MHz off the LaunchPad's 16MHz crystal, which we divide by 5 for 80MHz */
+#define CLOCK_PLL		80000000
+#define CLOCK_SYSDIV	5
+/* How many times we poll for the oscillator or PLL coming up before giving up and staying where we are */
+#define CLOCK_TIMEOUT	100000
+
+/* The Cortex-M4's cycle counter in the Data Watchpoint and Trace unit, which TRCENA in DEMCR powers up */
+#define NVIC_DBG_INT_TRCENA	0x01000000
+#define DWT_CTRL_R			(*((volatile uint32_t *)0xE0001000))
+#define DWT_CTRL_CYCCNTENA	0x00000001
+#define DWT_CYCCNT_R		(*((volatile uint32_t *)0xE0001004))
+
+static uint32_t clockHz = CLOCK_PIOSC;
+
+void clockInit()
+{
+	uint32_t timeout;
+	/* Start the cycle counter clockTicks() reads, which counts whatever the clock ends up running at */
+	NVIC_DBG_INT_R |= NVIC_DBG_INT_TRCENA;
+	DWT_CYCCNT_R = 0;
+	DWT_CTRL_R |= DWT_CTRL_CYCCNTENA;
+	/* Take over with RCC2, running straight from the oscillator until the PLL is locked */
+	SYSCTL_RCC2_R |= SYSCTL_RCC2_USERCC2 | SYSCTL_RCC2_BYPASS2;
+	/* Start the main oscillator, and only switch over to it once it's up */
+	SYSCTL_MISC_R = SYSCTL_MISC_MOSCPUPMIS | SYSCTL_MISC_PLLLMIS;
+	SYSCTL_RCC_R = (SYSCTL_RCC_R & ~(SYSCTL_RCC_XTAL_M | SYSCTL_RCC_MOSCDIS)) | SYSCTL_RCC_XTAL_16MHZ;
+	for (timeout = CLOCK_TIMEOUT; (SYSCTL_RIS_R & SYSCTL_RIS_MOSCPUPRIS) == 0; timeout--)
+	{
+		if (timeout == 0)
+			return;
+	}
+	/* Both of these run at 16MHz, so the clock rate doesn't change until the PLL's in */
+	SYSCTL_RCC2_R = (SYSCTL_RCC2_R & ~(SYSCTL_RCC2_OSCSRC2_M | SYSCTL_RCC2_PWRDN2)) | SYSCTL_RCC2_OSCSRC2_MO;
+	/* With DIV400, SYSDIV2 and SYSDIV2LSB together hold the divisor less one */
+	SYSCTL_RCC2_R = (SYSCTL_RCC2_R & ~(SYSCTL_RCC2_SYSDIV2_M | SYSCTL_RCC2_SYSDIV2LSB)) | SYSCTL_RCC2_DIV400 |
+		((CLOCK_SYSDIV - 1) << 22);
+	for (timeout = CLOCK_TIMEOUT; (SYSCTL_RIS_R & SYSCTL_RIS_PLLLRIS) == 0; timeout--)
+	{
+		if (timeout == 0)
+			return;
+	}
+	SYSCTL_RCC2_R &= ~SYSCTL_RCC2_BYPASS2;
+	clockHz = CLOCK_PLL;
+}
+
+uint32_t clockSystem()
+{
+	return clockHz;
+}
+
+uint32_t clockTicks()
+{
+	return DWT_CYCCNT_R;
+}
+
 void irqReset()
 {
 	uint32_t *src, *dst;
@@ -213,6 +276,7 @@ void irqReset()
 		while (dst < &_end_bss)
 			*dst++ = 0;
 
+		clockInit();
 		main();
 	}
 }
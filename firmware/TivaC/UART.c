@@ -17,7 +17,22 @@
  */
 
 #include <tm4c123gh6pm.h>
+#include "USBInterface.h"
 #include "UART.h"
+#include "Clock.h"
+
+/* How far off the requested rate we allow the divided clock to be, in tenths of a percent */
+#define UART_BAUD_ERROR	20
+
+/*
+ * The UART's interrupt moves what it receives out of its 16 byte FIFO and into this ring,
+ * so bytes keep landing while we're busy with the Flash rather than overrunning the FIFO.
+ * It holds more than the host's whole credit window of pages, so it can't overrun either.
+ */
+#define UART_RX_LEN		4096
+uint8_t uartRxRing[UART_RX_LEN];
+volatile uint16_t uartRxHead;
+uint16_t uartRxTail;
 
 void uartInit()
 {
@@ -32,16 +47,31 @@ void uartInit()
 	GPIO_PORTA_PCTL_R |= GPIO_PCTL_PA1_U0TX | GPIO_PCTL_PA0_U0RX;
 	GPIO_PORTA_DR2R_R |= 0x03;
 	GPIO_PORTA_PUR_R |= 0x02;
+	/* Run the UART off the system clock, set up for 8-bit operation with one stop bit + FIFOs at the default rate */
+	UART0_CC_R = UART_CC_CS_SYSCLK;
+	uartSetBaud(BAUD_DEFAULT);
 	/*
-	 * Set the UART up for 8-bit, 115200 baud operation with one stop bit + FIFOs
-	 * BRD = 16MHz / (16 * 115200) = 8.68055*
-	 * IBRD = 8
-	 * FBRD = 0.68055* * 64 = 43.555 ~= 44
+	 * Interrupt when the RX FIFO is half full, or when what's in it has sat there for 32 bit periods,
+	 * which picks up the tail end of a message that doesn't fill the FIFO that far
 	 */
-	UART0_IBRD_R = 8;
-	UART0_FBRD_R = 44;
-	UART0_LCRH_R = UART_LCRH_WLEN_8 | UART_LCRH_FEN;
-	UART0_CTL_R = UART_CTL_RXE | UART_CTL_TXE | UART_CTL_UARTEN;
+	uartRxHead = 0;
+	uartRxTail = 0;
+	UART0_IFLS_R = UART_IFLS_RX4_8 | UART_IFLS_TX4_8;
+	UART0_IM_R = UART_IM_RXIM | UART_IM_RTIM;
+	NVIC_EN0_R = 1 << (INT_UART0 - 16);
+}
+
+void irqUART0()
+{
+	uint16_t head = uartRxHead;
+	/* Clear the interrupts before draining, so a byte landing meanwhile raises them afresh */
+	UART0_ICR_R = UART_ICR_RXIC | UART_ICR_RTIC;
+	while ((UART0_FR_R & UART_FR_RXFE) == 0)
+	{
+		uartRxRing[head] = UART0_DR_R & 0xFF;
+		head = (head + 1) % UART_RX_LEN;
+	}
+	uartRxHead = head;
 }
 
 void uartWrite(uint8_t data)
@@ -52,17 +82,88 @@ void uartWrite(uint8_t data)
 
 uint8_t uartRead()
 {
-	while ((UART0_FR_R & UART_FR_RXFE) != 0);
-	return UART0_DR_R & 0xFF;
+	uint8_t data;
+	while (uartRxTail == uartRxHead);
+	data = uartRxRing[uartRxTail];
+	uartRxTail = (uartRxTail + 1) % UART_RX_LEN;
+	return data;
 }
 
 bool uartHaveData()
 {
-	return (UART0_FR_R & UART_FR_RXFE) == 0;
+	return uartRxTail != uartRxHead;
 }
 
 uint8_t uartPeak()
 {
-	return UART0_DR_R & 0xFF;
+	/* As reading the data register used to, this consumes the byte */
+	return uartRead();
 }
 
+/*
+ * BRD = clock / (16 * baud), with IBRD its integer part and FBRD its fractional part * 64, rounded.
+ * Worked in 64ths that's (clock * 4) / baud, and for 115200 baud off 80MHz gives 43.40277*, so IBRD = 43 and FBRD = 26.
+ * Rates too fast for that divide by 8 instead with the UART in high-speed mode, which doubles each term.
+ * Returns the divisor in 64ths, or 0 if the rate can't be made closely enough.
+ */
+static uint32_t uartDivisor(const uint32_t baud, uint32_t *ctl)
+{
+	const uint32_t clock = clockSystem();
+	uint32_t divisor, actual;
+	if (baud == 0)
+		return 0;
+	divisor = ((clock * 4) + (baud / 2)) / baud;
+	*ctl = UART_CTL_RXE | UART_CTL_TXE | UART_CTL_UARTEN;
+	if (divisor < 64)
+	{
+		divisor = ((clock * 8) + (baud / 2)) / baud;
+		*ctl |= UART_CTL_HSE;
+		actual = divisor == 0 ? 0 : (clock * 8) / divisor;
+	}
+	else
+		actual = (clock * 4) / divisor;
+	if (divisor < 64 || (divisor >> 6) > 0xFFFF ||
+		(actual > baud ? actual - baud : baud - actual) > (baud / 1000) * UART_BAUD_ERROR)
+		return 0;
+	return divisor;
+}
+
+bool uartBaudSupported(uint32_t baud)
+{
+	uint32_t ctl;
+	return uartDivisor(baud, &ctl) != 0;
+}
+
+bool uartSetBaud(uint32_t baud)
+{
+	uint32_t ctl;
+	const uint32_t divisor = uartDivisor(baud, &ctl);
+	if (divisor == 0)
+		return false;
+
+	/* Let anything still going out at the old rate finish, then reprogram with the UART disabled */
+	while ((UART0_FR_R & UART_FR_BUSY) != 0);
+	UART0_CTL_R = 0;
+	UART0_IBRD_R = divisor >> 6;
+	UART0_FBRD_R = divisor & 0x3F;
+	/* The divisors only take effect on a write to LCRH */
+	UART0_LCRH_R = UART_LCRH_WLEN_8 | UART_LCRH_FEN;
+	UART0_CTL_R = ctl;
+	return true;
+}
+
+/* SysTick counts the milliseconds off, as nothing else uses it */
+bool uartWaitData(uint16_t timeout)
+{
+	bool ready;
+	NVIC_ST_RELOAD_R = (clockSystem() / 1000) - 1;
+	NVIC_ST_CURRENT_R = 0;
+	NVIC_ST_CTRL_R = NVIC_ST_CTRL_CLK_SRC | NVIC_ST_CTRL_ENABLE;
+	while (!(ready = uartHaveData()) && timeout != 0)
+	{
+		if ((NVIC_ST_CTRL_R & NVIC_ST_CTRL_COUNT) != 0)
+			timeout--;
+	}
+	NVIC_ST_CTRL_R = 0;
+	return ready;
+}
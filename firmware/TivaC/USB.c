@@ -0,0 +1,509 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs the host link over the TM4C's own full-speed USB device controller rather than UART0 and the ICDI.
+ * Built in place of UART.c with NATIVEUSB=1, it presents the same UART.h interface on top of a
+ * vendor specific interface with one bulk endpoint each way, so the rest of the firmware doesn't know the difference.
+ */
+
+#include <tm4c123gh6pm.h>
+#include "USBInterface.h"
+#include "UART.h"
+#include "Clock.h"
+
+#define USB_EP0_LEN		64
+#define USB_EP1_LEN		64
+
+#define USB_DESCRIPTOR_DEVICE			1
+#define USB_DESCRIPTOR_CONFIGURATION	2
+#define USB_DESCRIPTOR_STRING			3
+#define USB_DESCRIPTOR_INTERFACE		4
+#define USB_DESCRIPTOR_ENDPOINT			5
+
+#define USB_REQUEST_GET_STATUS			0
+#define USB_REQUEST_CLEAR_FEATURE		1
+#define USB_REQUEST_SET_FEATURE			3
+#define USB_REQUEST_SET_ADDRESS			5
+#define USB_REQUEST_GET_DESCRIPTOR		6
+#define USB_REQUEST_GET_CONFIGURATION	8
+#define USB_REQUEST_SET_CONFIGURATION	9
+#define USB_REQUEST_GET_INTERFACE		10
+#define USB_REQUEST_SET_INTERFACE		11
+
+#define USB_REQUEST_TYPE_MASK		0x60
+#define USB_RECIPIENT_ENDPOINT		0x02
+#define USB_FEATURE_ENDPOINT_HALT	0
+
+/* The FIFOs are byte wide as far as the packets go, while the register definitions are for whole words */
+#define USB0_FIFO0_8	(*((volatile uint8_t *)&USB0_FIFO0_R))
+#define USB0_FIFO1_8	(*((volatile uint8_t *)&USB0_FIFO1_R))
+
+static const uint8_t usbDeviceDesc[18] =
+{
+	18, USB_DESCRIPTOR_DEVICE,
+	0x00, 0x02, /* USB 2.00, running at full speed */
+	0x00, 0x00, 0x00, /* The class is given by the interface */
+	USB_EP0_LEN,
+	SPIFP_USB_VID & 0xFF, SPIFP_USB_VID >> 8,
+	SPIFP_USB_PID & 0xFF, SPIFP_USB_PID >> 8,
+	0x01, 0x00, /* BCD encoded device version */
+	0x01, /* Manufacturer string index */
+	0x02, /* Product string index */
+	0x00, /* There's no unique ID on the part to make a serial number from */
+	0x01 /* One configuration only */
+};
+
+static const uint8_t usbConfigDesc[32] =
+{
+	9, USB_DESCRIPTOR_CONFIGURATION,
+	32, 0, /* Total length of this and the descriptors that follow */
+	0x01, /* One interface */
+	0x01, /* This is the first configuration */
+	0x00, /* No string to describe this configuration */
+	0x80, /* Bus powered */
+	50, /* 100mA max */
+
+	9, USB_DESCRIPTOR_INTERFACE,
+	0x00, /* 0th interface, by which we mean 1st */
+	0x00, /* Alternate 0 */
+	0x02, /* Two endpoints to the interface */
+	0xFF, SPIFP_USB_SUBCLASS, SPIFP_USB_PROTOCOL, /* Vendor specific - it carries USBInterface.h's protocol as is */
+	0x00, /* No string to describe this interface */
+
+	7, USB_DESCRIPTOR_ENDPOINT,
+	0x81, /* EP1 IN */
+	0x02, /* Bulk */
+	USB_EP1_LEN, 0,
+	0x00,
+
+	7, USB_DESCRIPTOR_ENDPOINT,
+	0x01, /* EP1 OUT */
+	0x02, /* Bulk */
+	USB_EP1_LEN, 0,
+	0x00
+};
+
+typedef struct
+{
+	uint8_t length;
+	uint8_t type;
+} usbStringDescBase_t;
+
+static const struct
+{
+	usbStringDescBase_t header;
+	uint16_t ids[1];
+} usbStringLangIDs =
+{
+	{
+		sizeof(usbStringLangIDs),
+		USB_DESCRIPTOR_STRING
+	},
+	{ 0x0409 } /* This encodes the ID code for US English so we work nicely with windows */
+};
+
+static const struct
+{
+	usbStringDescBase_t header;
+	uint16_t strMfr[11];
+} usbStringMfr =
+{
+	{
+		sizeof(usbStringMfr),
+		USB_DESCRIPTOR_STRING
+	},
+	{
+		/* Manufacturer string is "Rachel Mant" */
+		'R', 'a', 'c', 'h', 'e', 'l', ' ', 'M', 'a', 'n', 't'
+	}
+};
+
+static const struct
+{
+	usbStringDescBase_t header;
+	uint16_t strProduct[18];
+} usbStringProduct =
+{
+	{
+		sizeof(usbStringProduct),
+		USB_DESCRIPTOR_STRING
+	},
+	{
+		/* Product string is "SPIFlashProgrammer" */
+		'S', 'P', 'I', 'F', 'l', 'a', 's', 'h', 'P', 'r', 'o', 'g',
+		'r', 'a', 'm', 'm', 'e', 'r'
+	}
+};
+
+#define USB_NUM_STRING_DESC	3
+static const usbStringDescBase_t *const usbStrings[USB_NUM_STRING_DESC] =
+{
+	&usbStringLangIDs.header,
+	&usbStringMfr.header,
+	&usbStringProduct.header
+};
+
+/*
+ * As with UART.c, what arrives on EP1 OUT is moved into this ring by the interrupt.
+ * A packet that won't fit is left in the FIFO, which NAKs the host until uartRead() makes room and drains it.
+ */
+#define UART_RX_LEN		4096
+uint8_t uartRxRing[UART_RX_LEN];
+volatile uint16_t uartRxHead;
+uint16_t uartRxTail;
+volatile bool usbRxHeld;
+
+/* How much of the IN packet being built has been written, and whether the last one sent was a full one */
+uint8_t usbTxCount;
+bool usbTxFull;
+
+uint8_t usbConfiguration;
+/* SET_ADDRESS only takes effect once its status stage is over */
+uint8_t usbAddress;
+bool usbAddressPending;
+
+/* Must be called with the USB interrupt masked, if not from it */
+static void usbReceive()
+{
+	uint16_t head = uartRxHead;
+	while ((USB0_RXCSRL1_R & USB_RXCSRL1_RXRDY) != 0)
+	{
+		uint16_t count = USB0_RXCOUNT1_R;
+		const uint16_t space = (uint16_t)(uartRxTail - head - 1) % UART_RX_LEN;
+		if (count > space)
+		{
+			usbRxHeld = true;
+			break;
+		}
+		while (count-- != 0)
+		{
+			uartRxRing[head] = USB0_FIFO1_8;
+			head = (head + 1) % UART_RX_LEN;
+		}
+		USB0_RXCSRL1_R &= ~USB_RXCSRL1_RXRDY;
+		usbRxHeld = false;
+	}
+	uartRxHead = head;
+}
+
+static void usbConfigure(const uint8_t configuration)
+{
+	usbConfiguration = configuration;
+	usbTxCount = 0;
+	usbTxFull = false;
+	if (configuration == 0)
+	{
+		USB0_RXIE_R = 0;
+		return;
+	}
+	/* The FIFOs are already set up, so just reset the endpoints and let the interrupt fill in behind OUT */
+	USB0_TXMAXP1_R = USB_EP1_LEN;
+	USB0_TXCSRH1_R = USB_TXCSRH1_AUTOSET | USB_TXCSRH1_MODE;
+	USB0_TXCSRL1_R = USB_TXCSRL1_CLRDT | USB_TXCSRL1_FLUSH;
+	USB0_RXMAXP1_R = USB_EP1_LEN;
+	USB0_RXCSRH1_R = 0;
+	USB0_RXCSRL1_R = USB_RXCSRL1_CLRDT;
+	USB0_RXIE_R = USB_RXIE_EP1;
+}
+
+/* Answers the setup packet with data, cutting it short if the host asked for less */
+static void usbEP0Send(const void *data, uint16_t dataLen, const uint16_t length)
+{
+	const uint8_t *buffer = data;
+	if (dataLen > length)
+		dataLen = length;
+	/* Everything we send fits a single packet */
+	if (dataLen > USB_EP0_LEN)
+		dataLen = USB_EP0_LEN;
+	USB0_CSRL0_R = USB_CSRL0_RXRDYC;
+	while (dataLen-- != 0)
+		USB0_FIFO0_8 = *buffer++;
+	USB0_CSRL0_R = USB_CSRL0_TXRDY | USB_CSRL0_DATAEND;
+}
+
+static void usbEP0Ack()
+{
+	USB0_CSRL0_R = USB_CSRL0_RXRDYC | USB_CSRL0_DATAEND;
+}
+
+static void usbEP0Stall()
+{
+	USB0_CSRL0_R = USB_CSRL0_RXRDYC | USB_CSRL0_STALL;
+}
+
+static void usbGetDescriptor(const uint16_t value, const uint16_t length)
+{
+	const uint8_t index = value & 0xFF;
+	switch (value >> 8)
+	{
+		case USB_DESCRIPTOR_DEVICE:
+			usbEP0Send(usbDeviceDesc, sizeof(usbDeviceDesc), length);
+			break;
+		case USB_DESCRIPTOR_CONFIGURATION:
+			if (index != 0)
+				usbEP0Stall();
+			else
+				usbEP0Send(usbConfigDesc, sizeof(usbConfigDesc), length);
+			break;
+		case USB_DESCRIPTOR_STRING:
+			if (index >= USB_NUM_STRING_DESC)
+				usbEP0Stall();
+			else
+				usbEP0Send(usbStrings[index], usbStrings[index]->length, length);
+			break;
+		default:
+			usbEP0Stall();
+	}
+}
+
+static void usbSetupRequest()
+{
+	uint8_t setup[8], i;
+	uint16_t value, index, length;
+	const uint8_t zero[2] = {0, 0};
+
+	if (USB0_COUNT0_R != sizeof(setup))
+	{
+		usbEP0Stall();
+		return;
+	}
+	for (i = 0; i < sizeof(setup); i++)
+		setup[i] = USB0_FIFO0_8;
+	value = setup[2] | (setup[3] << 8);
+	index = setup[4] | (setup[5] << 8);
+	length = setup[6] | (setup[7] << 8);
+
+	/* We only speak the standard requests - everything else goes over the bulk endpoints */
+	if ((setup[0] & USB_REQUEST_TYPE_MASK) != 0)
+	{
+		usbEP0Stall();
+		return;
+	}
+
+	switch (setup[1])
+	{
+		case USB_REQUEST_GET_STATUS:
+			usbEP0Send(zero, sizeof(zero), length);
+			break;
+		case USB_REQUEST_CLEAR_FEATURE:
+			/* The only feature worth clearing is an endpoint halt, which resets its data toggle */
+			if ((setup[0] & 0x1F) == USB_RECIPIENT_ENDPOINT && value == USB_FEATURE_ENDPOINT_HALT)
+			{
+				if (index == 0x81)
+					USB0_TXCSRL1_R = USB_TXCSRL1_CLRDT;
+				else if (index == 0x01)
+					USB0_RXCSRL1_R = USB_RXCSRL1_CLRDT;
+			}
+			usbEP0Ack();
+			break;
+		case USB_REQUEST_SET_ADDRESS:
+			usbAddress = value & 0x7F;
+			usbAddressPending = true;
+			usbEP0Ack();
+			break;
+		case USB_REQUEST_GET_DESCRIPTOR:
+			usbGetDescriptor(value, length);
+			break;
+		case USB_REQUEST_GET_CONFIGURATION:
+			usbEP0Send(&usbConfiguration, 1, length);
+			break;
+		case USB_REQUEST_SET_CONFIGURATION:
+			if (value > 1)
+				usbEP0Stall();
+			else
+			{
+				usbConfigure(value);
+				usbEP0Ack();
+			}
+			break;
+		case USB_REQUEST_GET_INTERFACE:
+			usbEP0Send(zero, 1, length);
+			break;
+		case USB_REQUEST_SET_INTERFACE:
+			if (value != 0)
+				usbEP0Stall();
+			else
+				usbEP0Ack();
+			break;
+		default:
+			usbEP0Stall();
+	}
+}
+
+static void usbHandleEP0()
+{
+	const uint8_t status = USB0_CSRL0_R;
+	if ((status & USB_CSRL0_STALLED) != 0)
+	{
+		USB0_CSRL0_R = 0;
+		return;
+	}
+	/* The host gave up on the last transfer early, so forget about it */
+	if ((status & USB_CSRL0_SETEND) != 0)
+		USB0_CSRL0_R = USB_CSRL0_SETENDC;
+	if (usbAddressPending)
+	{
+		USB0_FADDR_R = usbAddress;
+		usbAddressPending = false;
+	}
+	if ((status & USB_CSRL0_RXRDY) != 0)
+		usbSetupRequest();
+}
+
+void irqUSB0()
+{
+	/* These are all cleared by reading them */
+	const uint8_t status = USB0_IS_R;
+	const uint16_t txStatus = USB0_TXIS_R;
+	const uint16_t rxStatus = USB0_RXIS_R;
+
+	if ((status & USB_IS_RESET) != 0)
+	{
+		usbAddressPending = false;
+		usbConfigure(0);
+	}
+	if ((txStatus & USB_TXIS_EP0) != 0)
+		usbHandleEP0();
+	if ((rxStatus & USB_RXIS_EP1) != 0)
+		usbReceive();
+}
+
+void uartInit()
+{
+	/* Enable the USB controller and port D, which has its data lines */
+	SYSCTL_RCGCGPIO_R |= SYSCTL_RCGCGPIO_R3;
+	SYSCTL_RCGCUSB_R |= SYSCTL_RCGCUSB_R0;
+	/* The controller runs from its own PLL, which comes out of reset powered down */
+	SYSCTL_RCC2_R &= ~SYSCTL_RCC2_USBPWRDN;
+	while ((SYSCTL_PRUSB_R & SYSCTL_PRUSB_R0) != SYSCTL_PRUSB_R0);
+	/* USB0DM and USB0DP on PD4 and PD5 are analogue functions */
+	GPIO_PORTD_DEN_R &= ~0x30;
+	GPIO_PORTD_AMSEL_R |= 0x30;
+	/* Device only, whatever the ID pin says */
+	USB0_GPCS_R = USB_GPCS_DEVMODOTG | USB_GPCS_DEVMOD;
+
+	/*
+	 * EP0 has the first 64 bytes of FIFO RAM to itself. EP1's IN and OUT FIFOs follow it, each double-buffered
+	 * so one packet can be on the wire while we fill or drain the other. The addresses count in 8 byte units.
+	 */
+	USB0_EPIDX_R = 1;
+	USB0_TXFIFOSZ_R = USB_TXFIFOSZ_SIZE_64 | USB_TXFIFOSZ_DPB;
+	USB0_TXFIFOADD_R = USB_EP0_LEN >> 3;
+	USB0_RXFIFOSZ_R = USB_RXFIFOSZ_SIZE_64 | USB_RXFIFOSZ_DPB;
+	USB0_RXFIFOADD_R = (USB_EP0_LEN + (USB_EP1_LEN * 2)) >> 3;
+	USB0_EPIDX_R = 0;
+
+	uartRxHead = 0;
+	uartRxTail = 0;
+	usbRxHeld = false;
+	usbAddressPending = false;
+	usbConfigure(0);
+	USB0_TXIE_R = USB_TXIE_EP0;
+	USB0_IE_R = USB_IE_RESET;
+	NVIC_EN1_R = 1 << (INT_USB0 - 48);
+	/* And finally let the host see us */
+	USB0_POWER_R |= USB_POWER_SOFTCONN;
+}
+
+/*
+ * Sends whatever of an IN packet has been written. A transfer that ends on a whole packet needs a
+ * zero length one after it, or the host would go on waiting for more.
+ */
+static void usbFlush()
+{
+	if (usbTxCount != 0)
+	{
+		USB0_TXCSRL1_R = USB_TXCSRL1_TXRDY;
+		usbTxCount = 0;
+	}
+	else if (usbTxFull && (USB0_TXCSRL1_R & USB_TXCSRL1_TXRDY) == 0)
+	{
+		USB0_TXCSRL1_R = USB_TXCSRL1_TXRDY;
+		usbTxFull = false;
+	}
+}
+
+void uartWrite(uint8_t data)
+{
+	/* Wait for one of the two packet buffers to be free before starting a new packet */
+	if (usbTxCount == 0)
+		while ((USB0_TXCSRL1_R & USB_TXCSRL1_TXRDY) != 0);
+	USB0_FIFO1_8 = data;
+	/* Writing the last byte of a packet sends it, courtesy of AUTOSET */
+	usbTxFull = ++usbTxCount == USB_EP1_LEN;
+	if (usbTxFull)
+		usbTxCount = 0;
+}
+
+uint8_t uartRead()
+{
+	uint8_t data;
+	/* Whatever we've said so far has to go out before the host can reply to it */
+	while (uartRxTail == uartRxHead)
+		usbFlush();
+	data = uartRxRing[uartRxTail];
+	uartRxTail = (uartRxTail + 1) % UART_RX_LEN;
+	if (usbRxHeld)
+	{
+		NVIC_DIS1_R = 1 << (INT_USB0 - 48);
+		usbReceive();
+		NVIC_EN1_R = 1 << (INT_USB0 - 48);
+	}
+	return data;
+}
+
+bool uartHaveData()
+{
+	usbFlush();
+	return uartRxTail != uartRxHead;
+}
+
+uint8_t uartPeak()
+{
+	return uartRead();
+}
+
+/* There's no line rate to change, so any rate the host asks for is fine and changes nothing */
+bool uartBaudSupported(uint32_t baud)
+{
+	(void)baud;
+	return true;
+}
+
+bool uartSetBaud(uint32_t baud)
+{
+	(void)baud;
+	return true;
+}
+
+/* SysTick counts the milliseconds off, as nothing else uses it */
+bool uartWaitData(uint16_t timeout)
+{
+	bool ready;
+	NVIC_ST_RELOAD_R = (clockSystem() / 1000) - 1;
+	NVIC_ST_CURRENT_R = 0;
+	NVIC_ST_CTRL_R = NVIC_ST_CTRL_CLK_SRC | NVIC_ST_CTRL_ENABLE;
+	while (!(ready = uartHaveData()) && timeout != 0)
+	{
+		if ((NVIC_ST_CTRL_R & NVIC_ST_CTRL_COUNT) != 0)
+			timeout--;
+	}
+	NVIC_ST_CTRL_R = 0;
+	return ready;
+}
@@ -0,0 +1,31 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+/* Brings the system clock up on the PLL, which the startup code does before calling main() */
+extern void clockInit();
+/* The rate in Hz the core and the peripherals the drivers divide down from are running at */
+extern uint32_t clockSystem();
+/* A free running count of clockSystem() ticks, for timing things - it wraps, so only differences between reads mean anything */
+extern uint32_t clockTicks();
+
+#endif /*CLOCK_H*/
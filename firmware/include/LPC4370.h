@@ -120,11 +120,116 @@ typedef struct
 	volatile uint32_t INT;
 } lpcSPI_t;
 
+typedef struct
+{
+	volatile uint32_t CTRL;
+	volatile uint32_t CMD;
+	volatile uint32_t ADDR;
+	volatile uint32_t IDATA;
+	volatile uint32_t CLIMIT;
+	union
+	{
+		volatile uint32_t DATA;
+		volatile uint8_t DATA8;
+	};
+	volatile uint32_t MCMD;
+	volatile uint32_t STAT;
+} lpcSPIFI_t;
+
+typedef struct
+{
+	volatile uint32_t SRCADDR;
+	volatile uint32_t DESTADDR;
+	volatile uint32_t LLI;
+	volatile uint32_t CONTROL;
+	volatile uint32_t CONFIG;
+	volatile uint32_t reserved[3];
+} lpcGPDMAChannel_t;
+
+typedef struct
+{
+	volatile uint32_t INTSTAT;
+	volatile uint32_t INTTCSTAT;
+	volatile uint32_t INTTCCLEAR;
+	volatile uint32_t INTERRSTAT;
+	volatile uint32_t INTERRCLR;
+	volatile uint32_t RAWINTTCSTAT;
+	volatile uint32_t RAWINTERRSTAT;
+	volatile uint32_t ENBLDCHNS;
+	volatile uint32_t SOFTBREQ;
+	volatile uint32_t SOFTSREQ;
+	volatile uint32_t SOFTLBREQ;
+	volatile uint32_t SOFTLSREQ;
+	volatile uint32_t CONFIG;
+	volatile uint32_t SYNC;
+	volatile uint32_t reserved[50];
+	lpcGPDMAChannel_t CH[8];
+} lpcGPDMA_t;
+
+typedef struct
+{
+	volatile uint32_t MODE;
+	volatile uint32_t SEED;
+	/* SUM reads back, the WR_DATA forms write in */
+	union
+	{
+		volatile uint32_t SUM;
+		volatile uint32_t WR_DATA;
+		volatile uint8_t WR_DATA8;
+	};
+} lpcCRC_t;
+
+/* Slices are lettered A to P, numbered here from 0 in that order */
+typedef struct
+{
+	volatile uint32_t OUT_MUX_CFG[16];
+	volatile uint32_t SGPIO_MUX_CFG[16];
+	volatile uint32_t SLICE_MUX_CFG[16];
+	volatile uint32_t REG[16];
+	volatile uint32_t REG_SS[16];
+	volatile uint32_t PRESET[16];
+	volatile uint32_t COUNT[16];
+	volatile uint32_t POS[16];
+	volatile uint32_t MASK_A;
+	volatile uint32_t MASK_H;
+	volatile uint32_t MASK_I;
+	volatile uint32_t MASK_P;
+	volatile uint32_t GPIO_INREG;
+	volatile uint32_t GPIO_OUTREG;
+	volatile uint32_t GPIO_OENREG;
+	volatile uint32_t CTRL_ENABLE;
+	volatile uint32_t CTRL_DISABLE;
+} lpcSGPIO_t;
+
 #define USB0				((lpcUSB_t *)0x40006000)
 
 #define SYSCTL_CREG0		*((volatile uint32_t *)0x40043004)
 #define SYSCTL_M4MMAP		*((volatile uint32_t *)0x40043100)
 #define SYSCTL_CREG5		*((volatile uint32_t *)0x40043118)
+/* Writing 0 clears the event the M4 raises on the M0APP core with SEV */
+#define SYSCTL_M4TXEVENT	*((volatile uint32_t *)0x40043130)
+/* Where the M0APP core's address 0 is shadowed from, which must be a 4K boundary */
+#define SYSCTL_M0APPMMAP	*((volatile uint32_t *)0x40043404)
+
+/* RGU stands for Reset Generation Unit */
+#define RGU_RESET_CTRL1		*((volatile uint32_t *)0x40053104)
+#define RGU_RESET_ACTIVE_STATUS1	*((volatile uint32_t *)0x40053154)
+#define RGU_RESET_M0APP		0x01000000
+
+/* CGU stands for Clock Generation Unit */
+#define CGU_XTAL_OSC_CTRL	*((volatile uint32_t *)0x40050018)
+#define CGU_PLL0USB_STAT	*((volatile uint32_t *)0x4005001C)
+#define CGU_PLL0USB_CTRL	*((volatile uint32_t *)0x40050020)
+#define CGU_PLL0USB_MDIV	*((volatile uint32_t *)0x40050024)
+#define CGU_PLL0USB_NP_DIV	*((volatile uint32_t *)0x40050028)
+#define CGU_PLL1_STAT		*((volatile uint32_t *)0x40050040)
+#define CGU_PLL1_CTRL		*((volatile uint32_t *)0x40050044)
+#define CGU_BASE_USB0_CLK	*((volatile uint32_t *)0x40050060)
+#define CGU_BASE_PERIPH_CLK	*((volatile uint32_t *)0x40050064)
+#define CGU_BASE_M4_CLK		*((volatile uint32_t *)0x4005006C)
+#define CGU_BASE_SPI_CLK	*((volatile uint32_t *)0x40050074)
+#define CGU_IDIVE_CTRL		*((volatile uint32_t *)0x40050058)
+#define CGU_BASE_SPIFI_CLK	*((volatile uint32_t *)0x40050070)
 
 #define Timer0				((lpcTimer_t *)0x40084000)
 #define Timer1				((lpcTimer_t *)0x40085000)
@@ -213,6 +318,20 @@ typedef struct
 #define GPIO_PORT7_TGL		*((volatile uint32_t *)0x400F631C)
 
 #define SPI					((lpcSPI_t *)0x40100000)
+#define SGPIO				((lpcSGPIO_t *)0x40101000)
+#define CRC					((lpcCRC_t *)0x40000000)
+#define GPDMA				((lpcGPDMA_t *)0x40002000)
+#define SPIFI				((lpcSPIFI_t *)0x40003000)
+/* Where the SPIFI maps the Flash in its memory mode */
+#define SPIFI_WINDOW		0x14000000
+#define SPIFI_WINDOW_SIZE	0x04000000
+
+/* The M4 core's cycle counter, in the Data Watchpoint and Trace unit that TRCENA powers up */
+#define DEMCR				*((volatile uint32_t *)0xE000EDFC)
+#define DEMCR_TRCENA		0x01000000
+#define DWT_CTRL			*((volatile uint32_t *)0xE0001000)
+#define DWT_CTRL_CYCCNTENA	0x00000001
+#define DWT_CYCCNT			*((volatile uint32_t *)0xE0001004)
 
 #define NVIC_SETIE0			*((volatile uint32_t *)0xE000E100)
 #define NVIC_SETIE1			*((volatile uint32_t *)0xE000E104)
@@ -349,6 +468,7 @@ typedef struct
 #define USB_SC1_FPR				0x00000040
 #define USB_SC1_PFSC_ANY		0x00000000
 #define USB_SC1_PFSC_FSONLY		0x01000000
+#define USB_SC1_PSPD_MASK		0x0C000000
 #define USB_SC1_PSPD_FS			0x00000000
 #define USB_SC1_PSPD_LS			0x04000000
 #define USB_SC1_PSPD_HS			0x08000000
@@ -430,6 +550,42 @@ typedef struct
 #define TIMER_CTCR_SEL_CAP2		0x00000008
 #define TIMER_CTCR_SEL_CAP3		0x0000000C
 
+#define CGU_XTAL_OSC_CTRL_PD	0x00000001 /* Crystal oscillator powered down */
+#define CGU_XTAL_OSC_CTRL_BYPASS	0x00000002
+#define CGU_XTAL_OSC_CTRL_HF	0x00000004 /* Crystal is 15 to 25MHz */
+
+#define CGU_PLL0USB_STAT_LOCK	0x00000001
+
+#define CGU_PLL0USB_CTRL_PD		0x00000001
+#define CGU_PLL0USB_CTRL_BYPASS	0x00000002
+#define CGU_PLL0USB_CTRL_DIRECTI	0x00000004
+#define CGU_PLL0USB_CTRL_DIRECTO	0x00000008
+#define CGU_PLL0USB_CTRL_CLKEN	0x00000010
+
+#define CGU_PLL1_STAT_LOCK		0x00000001
+
+#define CGU_PLL1_CTRL_PD		0x00000001
+#define CGU_PLL1_CTRL_BYPASS	0x00000002
+#define CGU_PLL1_CTRL_FBSEL		0x00000040
+#define CGU_PLL1_CTRL_DIRECT	0x00000080
+#define CGU_PLL1_CTRL_PSEL_M	0x00000300
+#define CGU_PLL1_CTRL_NSEL_M	0x00003000
+#define CGU_PLL1_CTRL_MSEL_M	0x00FF0000
+#define CGU_PLL1_CTRL_MSEL_S	16
+
+/* These are common to the PLL and base clock control registers */
+#define CGU_CTRL_AUTOBLOCK		0x00000800
+#define CGU_CTRL_CLK_SEL_M		0x1F000000
+#define CGU_CTRL_CLK_SEL_IRC	0x01000000
+#define CGU_CTRL_CLK_SEL_XTAL	0x06000000
+#define CGU_CTRL_CLK_SEL_PLL0USB	0x07000000
+#define CGU_CTRL_CLK_SEL_PLL1	0x09000000
+#define CGU_CTRL_CLK_SEL_IDIVE	0x10000000
+
+/* The integer dividers divide by one more than their IDIV field */
+#define CGU_IDIVE_CTRL_IDIV_M	0x000003FC
+#define CGU_IDIVE_CTRL_IDIV_S	2
+
 #define SCU_SFS_EHD_4			0x00000000
 #define SCU_SFS_EHD_8			0x00000100
 #define SCU_SFS_EHD_14			0x00000200
@@ -468,5 +624,85 @@ typedef struct
 #define SPI_SR_WCOL				0x00000040 /* SPI write collision */
 #define SPI_SR_SPIF				0x00000080 /* SPI transfer completed */
 
+#define SPIFI_CTRL_TIMEOUT_M	0x0000FFFF
+#define SPIFI_CTRL_CSHIGH_S		16 /* Clocks less one that CS is held high between commands */
+#define SPIFI_CTRL_D_PRFTCH_DIS	0x00200000
+#define SPIFI_CTRL_INTEN		0x00400000
+#define SPIFI_CTRL_MODE3		0x00800000
+#define SPIFI_CTRL_PRFTCH_DIS	0x08000000
+#define SPIFI_CTRL_DUAL			0x10000000 /* The wide fields go over 2 lines rather than 4 */
+#define SPIFI_CTRL_RFCLK		0x20000000
+#define SPIFI_CTRL_FBCLK		0x40000000 /* Sample read data off the clock fed back from the pin */
+#define SPIFI_CTRL_DMAEN		0x80000000
+
+#define SPIFI_CMD_DATALEN_M		0x00003FFF
+#define SPIFI_CMD_POLL			0x00004000 /* Repeat until DATALEN bit 3 matches the bit DATALEN bits 0-2 pick out */
+#define SPIFI_CMD_DOUT			0x00008000
+#define SPIFI_CMD_INTLEN_S		16
+#define SPIFI_CMD_FIELDFORM_SERIAL	0x00000000
+#define SPIFI_CMD_FIELDFORM_DATA	0x00080000 /* Just the data goes wide */
+#define SPIFI_CMD_FIELDFORM_ADDR	0x00100000 /* All but the opcode go wide */
+#define SPIFI_CMD_FRAMEFORM_OP	0x00200000 /* Opcode only */
+#define SPIFI_CMD_FRAMEFORM_OP3	0x00800000 /* Opcode and a 3 byte address */
+#define SPIFI_CMD_FRAMEFORM_OP4	0x00A00000 /* Opcode and a 4 byte address */
+#define SPIFI_CMD_OPCODE_S		24
+
+#define SPIFI_STAT_MCINIT		0x00000001
+#define SPIFI_STAT_CMD			0x00000002
+#define SPIFI_STAT_RESET		0x00000010
+#define SPIFI_STAT_INTRQ		0x00000020
+
+#define GPDMA_CONFIG_E			0x00000001
+
+#define GPDMA_CONTROL_TRANSFERSIZE_M	0x00000FFF /* In units of the source width */
+#define GPDMA_CONTROL_SWIDTH_S	18
+#define GPDMA_CONTROL_DWIDTH_S	21
+#define GPDMA_WIDTH_8			0
+#define GPDMA_WIDTH_16			1
+#define GPDMA_WIDTH_32			2
+#define GPDMA_CONTROL_S			0x01000000 /* Source on AHB master 1 rather than 0 */
+#define GPDMA_CONTROL_D			0x02000000 /* Destination on AHB master 1 rather than 0 */
+#define GPDMA_CONTROL_SI		0x04000000
+#define GPDMA_CONTROL_DI		0x08000000
+
+#define GPDMA_CH_CONFIG_E		0x00000001
+#define GPDMA_CH_CONFIG_FLOW_M2M	0x00000000
+
+#define SGPIO_SLICE_A			0
+#define SGPIO_SLICE_B			1
+#define SGPIO_SLICE_C			2
+#define SGPIO_SLICE_D			3
+#define SGPIO_SLICE_E			4
+#define SGPIO_SLICE_F			5
+#define SGPIO_SLICE_G			6
+#define SGPIO_SLICE_H			7
+#define SGPIO_SLICE_I			8
+#define SGPIO_SLICE_J			9
+#define SGPIO_SLICE_K			10
+#define SGPIO_SLICE_L			11
+#define SGPIO_SLICE_M			12
+#define SGPIO_SLICE_N			13
+#define SGPIO_SLICE_O			14
+#define SGPIO_SLICE_P			15
+
+#define SGPIO_MUX_CFG_EXT_CLK_ENABLE	0x00000001
+#define SGPIO_MUX_CFG_CLK_SOURCE_PIN_S	1 /* 0 to 3 for SGPIO8 to SGPIO11 */
+#define SGPIO_MUX_CFG_QUALIFIER_ENABLE	0x00000000
+
+#define SGPIO_SLICE_CLK_CAPTURE_FALLING	0x00000002
+#define SGPIO_SLICE_CLKGEN_EXTERNAL		0x00000004
+#define SGPIO_SLICE_PARALLEL_1BIT		0x00000000
+
+#define SGPIO_POS_S				0
+#define SGPIO_POS_RESET_S		8
+
+#define CRC_MODE_POLY_CCITT		0x00000000
+#define CRC_MODE_POLY_16		0x00000001
+#define CRC_MODE_POLY_32		0x00000002
+#define CRC_MODE_BIT_RVS_WR		0x00000004
+#define CRC_MODE_CMPL_WR		0x00000008
+#define CRC_MODE_BIT_RVS_SUM	0x00000010
+#define CRC_MODE_CMPL_SUM		0x00000020
+
 #endif /*__LPC4370_H__*/
 
@@ -20,12 +20,89 @@
 #define SPI_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 
+/* The clock the SPI comes up at, slow enough for any board to carry cleanly */
+#define SPI_RATE_SAFE	2000000
+
 extern void spiInit();
+/* Sets the SPI clock as close to rate as the divider gets without going over, returning the rate it got */
+extern uint32_t spiSetRate(uint32_t rate);
 extern void spiWrite(uint8_t data);
 extern uint8_t spiRead();
+/* Block transfers keep the SPI FIFO full rather than waiting out each byte before sending the next */
+extern void spiWriteBlock(const uint8_t *data, size_t dataLen);
+extern void spiReadBlock(uint8_t *data, size_t dataLen);
+/*
+ * Starts a block transfer in the background where the SPI driver has DMA to hand it to, so the caller can
+ * get on with something else until spiBlockDone(). tx or rx may be NULL to send 0s or throw away what
+ * comes back, and neither buffer may be touched until the transfer is done. Without DMA, this completes
+ * before returning.
+ */
+extern void spiBlockStart(const uint8_t *tx, uint8_t *rx, size_t dataLen);
+extern bool spiBlockDone();
 extern void spiChipSelect(bool select);
 
+#ifdef SPI_COMMANDS
+/*
+ * A driver built with SPI_COMMANDS also has a command engine that runs a whole Flash instruction in hardware -
+ * selecting the device, sending the instruction and address, clocking the wait cycles and moving the data -
+ * over more than one data line where the device and the board allow. This is how the LPC4370's SPIFI gets
+ * the Flash its quad reads and programs, and polls the status register without us.
+ */
+
+/* Which lines each part of a command goes over - the instruction, then the address and wait clocks, then the data */
+#define SPI_LINES_1_1_1	0
+#define SPI_LINES_1_1_2	1
+#define SPI_LINES_1_2_2	2
+#define SPI_LINES_1_1_4	3
+#define SPI_LINES_1_4_4	4
+
+typedef struct
+{
+	uint8_t opcode;
+	/* 0, 3 or 4 */
+	uint8_t addrBytes;
+	/* The mode and dummy clocks between the address and the data, which must make whole bytes on the address lines */
+	uint8_t waitClocks;
+	uint8_t lines;
+} spiCommand_t;
+
+extern void spiCommandRead(const spiCommand_t *command, uint32_t addr, uint8_t *data, size_t dataLen);
+extern void spiCommandWrite(const spiCommand_t *command, uint32_t addr, const uint8_t *data, size_t dataLen);
+/*
+ * Has the engine read the status register with opcode over and over until the given bit reads back as value,
+ * leaving the CPU free until spiPollDone() says it has. spiPollStop() gives up on a poll that is taking too long.
+ */
+extern void spiPollStart(uint8_t opcode, uint8_t bit, bool value);
+extern bool spiPollDone();
+extern void spiPollStop();
+#endif
+
+#ifdef SPI_MAPPED
+/*
+ * A driver built with SPI_MAPPED can also map the device into the address space, the command engine running
+ * command for whatever is read of the window. spiMap() returns the window, or NULL for a device too big to fit,
+ * and until spiUnmap() nothing else may be sent to the device.
+ */
+extern const uint8_t *spiMap(const spiCommand_t *command, uint32_t size);
+extern void spiUnmap();
+/* Copies dataLen bytes out of the window into data by DMA, returning once they are there */
+extern void spiMapRead(const uint8_t *window, uint8_t *data, size_t dataLen);
+/* Carries the CRC32 (IEEE 802.3, reflected, not inverted) crc on over dataLen bytes of the window in hardware */
+extern uint32_t spiMapCRC(uint32_t crc, const uint8_t *window, size_t dataLen);
+#endif
+
+#ifdef SPI_LANES
+/*
+ * A driver built with SPI_LANES drives that many devices in lockstep, for programming them all with the same image.
+ * The clock, chip select and whatever we send go to every one of them, while each answers on a lane of its own.
+ * Lane 0 is what the calls above read, and spiLanesRead() reads dataLen bytes from every lane at once,
+ * lane n's landing at data + n * dataLen.
+ */
+extern void spiLanesRead(uint8_t *data, size_t dataLen);
+#endif
+
 #endif /*SPI_H*/
 
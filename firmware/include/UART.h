@@ -20,6 +20,7 @@
 #define UART_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 
 extern void uartInit();
@@ -29,5 +30,21 @@ extern uint8_t uartRead();
 extern bool uartHaveData();
 extern uint8_t uartPeak();
 
+/* uartInit() starts the UART at BAUD_DEFAULT. uartSetBaud() switches once anything already written has gone. */
+extern bool uartBaudSupported(uint32_t baud);
+extern bool uartSetBaud(uint32_t baud);
+/* Waits up to timeout ms for a byte to arrive */
+extern bool uartWaitData(uint16_t timeout);
+
+#ifdef UART_BUFFERS
+/*
+ * A driver built with UART_BUFFERS sends from buffers of its own, which can be filled in place (by DMA, say)
+ * rather than through uartWrite(). uartWriteBuffer() returns where the next bytes go, cutting dataLen down to
+ * what fits there, and uartWriteCommit() sends dataLen of them on once they have been written.
+ */
+extern uint8_t *uartWriteBuffer(size_t *dataLen);
+extern void uartWriteCommit(size_t dataLen);
+#endif
+
 #endif /*UART_H*/
 
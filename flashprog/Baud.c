@@ -0,0 +1,103 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Baud rate negotiation for programmers that sit behind a UART, such as the Tiva C Launchpad's.
+ * The fastest rate that worked for each device is remembered in $XDG_CACHE_HOME/flashprog/baud
+ * (~/.cache/flashprog/baud by default), one "identity rate" line per device, so later runs go straight to it.
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "Transport.h"
+#include "Cache.h"
+#include "Baud.h"
+#include "USBInterface.h"
+
+/* Fastest first, and each one the Tiva C can divide its UART clock down to closely enough */
+static const uint32_t baudRates[] = { 2000000, 1000000, 921600, 460800, 230400, 0 };
+static const uint8_t baudProbe[BAUD_PROBE_LEN] = BAUD_PROBE_PATTERN;
+
+/* Waits out the device's fallback after a failed attempt, then throws away anything it sent meanwhile */
+void baudResync()
+{
+	uint8_t junk[64];
+	usleep(BAUD_PROBE_TIMEOUT * 2 * 1000);
+	while (transportReadTimeout(junk, sizeof(junk), BAUD_PROBE_TIMEOUT / 5) != 0);
+}
+
+/* Attempts the CMD_BAUD exchange, leaving both ends at BAUD_DEFAULT if it doesn't go through */
+bool baudTry(const uint32_t baud)
+{
+	uint8_t reply[BAUD_PROBE_LEN];
+	const uint8_t request[5] = { CMD_BAUD, (baud >> 24) & 0xFF, (baud >> 16) & 0xFF, (baud >> 8) & 0xFF, baud & 0xFF };
+
+	transportWrite(request, sizeof(request));
+	if (transportReadTimeout(reply, 2, BAUD_PROBE_TIMEOUT * 2) != 2 || reply[0] != CMD_BAUD)
+	{
+		/* Not a clean answer, so the device may not have been at the rate we thought */
+		baudResync();
+		return false;
+	}
+	else if (reply[1] != RPL_OK)
+		return false;
+
+	if (transportSetBaud(baud))
+	{
+		transportWrite(baudProbe, BAUD_PROBE_LEN);
+		if (transportReadTimeout(reply, BAUD_PROBE_LEN, BAUD_PROBE_TIMEOUT) == BAUD_PROBE_LEN &&
+			memcmp(reply, baudProbe, BAUD_PROBE_LEN) == 0)
+		{
+			transportWriteByte(RPL_OK);
+			transportFlush();
+			return true;
+		}
+		transportSetBaud(BAUD_DEFAULT);
+	}
+	baudResync();
+	return false;
+}
+
+uint32_t baudNegotiate(const uint32_t baud)
+{
+	const char *identity;
+	uint32_t cached;
+	uint8_t i;
+
+	if (!transportHasBaud())
+		return 0;
+	else if (baud == BAUD_DEFAULT)
+		return BAUD_DEFAULT;
+	else if (baud != 0)
+		return baudTry(baud) ? baud : BAUD_DEFAULT;
+
+	identity = transportIdentity();
+	cached = cacheRead("baud", identity);
+	/* Whatever worked last time most likely still does, and if nothing did, don't spend time finding that out again */
+	if (cached == BAUD_DEFAULT || (cached != 0 && baudTry(cached)))
+		return cached;
+	for (i = 0; baudRates[i] != 0; i++)
+	{
+		if (baudRates[i] != cached && baudTry(baudRates[i]))
+			break;
+	}
+	cached = baudRates[i] != 0 ? baudRates[i] : BAUD_DEFAULT;
+	cacheWrite("baud", identity, cached);
+	return cached;
+}
@@ -0,0 +1,14 @@
+#ifndef FLASHPROG_BAUD_H
+#define FLASHPROG_BAUD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Moves the link to the programmer off BAUD_DEFAULT for the session about to start, returning the rate it settled on.
+ * A baud of 0 finds the fastest rate that works (or uses the cached one), anything else tries just that rate.
+ * Links with no UART in them, such as sockets or a programmer that is its own USB device, give 0.
+ */
+uint32_t baudNegotiate(const uint32_t baud);
+
+#endif /*FLASHPROG_BAUD_H*/
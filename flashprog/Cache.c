@@ -0,0 +1,112 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Small per-device caches of what worked last time, kept in $XDG_CACHE_HOME/flashprog
+ * (~/.cache/flashprog by default) as one "identity value" line per device in a file per thing cached.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "strUtils.h"
+#include "Cache.h"
+
+/* Where the cache lives, making the directories for it if asked to. NULL if there's nowhere to put it. */
+static char *cachePath(const char *name, const bool create)
+{
+	const char *cacheHome = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+	char *base, *dir, *path = NULL;
+
+	if (cacheHome != NULL && cacheHome[0] == '/')
+		base = strdup(cacheHome);
+	else if (home != NULL)
+		base = formatString("%s/.cache", home);
+	else
+		return NULL;
+	dir = formatString("%s/flashprog", base);
+	if (!create || ((mkdir(base, 0755) == 0 || errno == EEXIST) && (mkdir(dir, 0755) == 0 || errno == EEXIST)))
+		path = formatString("%s/%s", dir, name);
+	free(dir);
+	free(base);
+	return path;
+}
+
+/* Splits a cache line into its identity and value, returning the value or 0 if the line is malformed */
+static uint32_t cacheLine(char *line)
+{
+	char *value = strrchr(line, ' ');
+	if (value == NULL)
+		return 0;
+	*value++ = 0;
+	return strtoul(value, NULL, 10);
+}
+
+uint32_t cacheRead(const char *name, const char *identity)
+{
+	char *path = cachePath(name, false), line[1024];
+	uint32_t value = 0;
+	FILE *cache;
+
+	cache = path == NULL ? NULL : fopen(path, "r");
+	free(path);
+	if (cache == NULL)
+		return 0;
+	while (value == 0 && fgets(line, sizeof(line), cache) != NULL)
+	{
+		const uint32_t lineValue = cacheLine(line);
+		if (lineValue != 0 && strcmp(line, identity) == 0)
+			value = lineValue;
+	}
+	fclose(cache);
+	return value;
+}
+
+/* Rewrites the cache with the other devices' lines kept as they were, via a rename so it's never left half written */
+void cacheWrite(const char *name, const char *identity, const uint32_t value)
+{
+	char *path = cachePath(name, true), *newPath, line[1024];
+	FILE *cache, *newCache;
+
+	if (path == NULL)
+		return;
+	newPath = formatString("%s.new", path);
+	newCache = fopen(newPath, "w");
+	if (newCache != NULL)
+	{
+		cache = fopen(path, "r");
+		while (cache != NULL && fgets(line, sizeof(line), cache) != NULL)
+		{
+			const uint32_t lineValue = cacheLine(line);
+			if (lineValue != 0 && strcmp(line, identity) != 0)
+				fprintf(newCache, "%s %u\n", line, lineValue);
+		}
+		if (cache != NULL)
+			fclose(cache);
+		fprintf(newCache, "%s %u\n", identity, value);
+		if (fclose(newCache) != 0 || rename(newPath, path) != 0)
+			unlink(newPath);
+	}
+	free(newPath);
+	free(path);
+}
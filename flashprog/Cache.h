@@ -0,0 +1,11 @@
+#ifndef FLASHPROG_CACHE_H
+#define FLASHPROG_CACHE_H
+
+#include <stdint.h>
+
+/* What was last remembered in the named cache for the device with this identity, or 0 if nothing was */
+uint32_t cacheRead(const char *name, const char *identity);
+/* Remembers value for the device with this identity, replacing what the named cache held for it */
+void cacheWrite(const char *name, const char *identity, const uint32_t value);
+
+#endif /*FLASHPROG_CACHE_H*/
@@ -0,0 +1,362 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Byte stream transports for flashprog - serial ports, and UNIX and TCP sockets.
+ * These suit programmers that show up as a tty rather than through libusb, and local stand-ins
+ * for the programmer such as the firmware's Host (emulator) build.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "strUtils.h"
+#include "Stream.h"
+
+/*
+ * Serial ports only take a few kB at a time, but sockets will take as much as we give them,
+ * so for those we ask the kernel for buffers deep enough to hold several chunks each way.
+ */
+#define TTY_CHUNK_LEN		4096
+#define SOCKET_CHUNK_LEN	65536
+#define SOCKET_BUFFER_LEN	(1 << 20)
+/* How long a read waits for data before giving up, which has to cover the device erasing just in time */
+#define STREAM_RX_TIMEOUT	5000
+
+int streamFD = -1;
+/* What transportIdentity() reports for the stream, such as the serial port's real path */
+char *streamName;
+/* Writes are gathered up to a chunk before going to the kernel */
+uint8_t streamBuffer[SOCKET_CHUNK_LEN];
+int32_t streamChunkLen, streamPending;
+uint32_t streamWrites;
+/* Set if an operation failed, after which all further operations fail */
+int streamError;
+
+void streamOpened(const int fd, const int32_t chunkLen, char *name)
+{
+	streamFD = fd;
+	streamName = name;
+	streamChunkLen = chunkLen;
+	streamPending = 0;
+	streamWrites = 0;
+	streamError = 0;
+	fcntl(streamFD, F_SETFL, fcntl(streamFD, F_GETFL) | O_NONBLOCK);
+}
+
+void ttyInit(const char *location)
+{
+	struct termios attrs;
+	char *path;
+	int fd;
+	if (location == NULL)
+		location = "/dev/ttyACM0";
+
+	fd = open(location, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd == -1)
+		die("Error: Could not open the serial port %s\n", location);
+	if (tcgetattr(fd, &attrs) != 0)
+	{
+		close(fd);
+		die("Error: %s is not a serial port\n", location);
+	}
+	/* 8-bit, no parity, 1 stop bit at 115200 baud, as the Tiva C firmware runs its UART */
+	cfmakeraw(&attrs);
+	cfsetispeed(&attrs, B115200);
+	cfsetospeed(&attrs, B115200);
+	attrs.c_cflag |= CLOCAL | CREAD;
+	tcsetattr(fd, TCSANOW, &attrs);
+	/* Throw away anything left over from a previous session */
+	tcflush(fd, TCIOFLUSH);
+	/* Several names can lead to the same port, so go by where they end up */
+	path = realpath(location, NULL);
+	streamOpened(fd, TTY_CHUNK_LEN, formatString("tty:%s", path == NULL ? location : path));
+	free(path);
+}
+
+/* The rates flashprog can put a serial port at, and the termios names for them */
+static const struct
+{
+	uint32_t baud;
+	speed_t speed;
+} ttySpeeds[] =
+{
+	{ 115200, B115200 },
+	{ 230400, B230400 },
+#ifdef B460800
+	{ 460800, B460800 },
+#endif
+#ifdef B921600
+	{ 921600, B921600 },
+#endif
+#ifdef B1000000
+	{ 1000000, B1000000 },
+#endif
+#ifdef B2000000
+	{ 2000000, B2000000 },
+#endif
+	{ 0, B0 }
+};
+
+bool ttySetBaud(uint32_t baud)
+{
+	struct termios attrs;
+	uint8_t i;
+	for (i = 0; ttySpeeds[i].baud != 0 && ttySpeeds[i].baud != baud; i++);
+	if (ttySpeeds[i].baud == 0 || tcgetattr(streamFD, &attrs) != 0)
+		return false;
+	cfsetispeed(&attrs, ttySpeeds[i].speed);
+	cfsetospeed(&attrs, ttySpeeds[i].speed);
+	/* Anything still going out has to go at the old rate */
+	return tcsetattr(streamFD, TCSADRAIN, &attrs) == 0;
+}
+
+void socketOpened(const int fd, char *name)
+{
+	const int bufferLen = SOCKET_BUFFER_LEN;
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufferLen, sizeof(bufferLen));
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferLen, sizeof(bufferLen));
+	streamOpened(fd, SOCKET_CHUNK_LEN, name);
+}
+
+void unixInit(const char *location)
+{
+	struct sockaddr_un addr;
+	int fd;
+	if (location == NULL || strlen(location) >= sizeof(addr.sun_path))
+		die("Error: UNIX sockets must be given as unix:/path\n");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, location);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+		die("Error: Could not connect to %s\n", location);
+	socketOpened(fd, formatString("unix:%s", location));
+}
+
+void tcpInit(const char *location)
+{
+	struct addrinfo hints, *addrs, *addr;
+	char *host, *port;
+	int fd = -1;
+	const int noDelay = 1;
+
+	port = location == NULL ? NULL : strrchr(location, ':');
+	if (port == NULL)
+		die("Error: TCP sockets must be given as tcp:host:port\n");
+	host = strndup(location, port - location);
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port + 1, &hints, &addrs) != 0)
+		die("Error: Could not look up %s\n", location);
+	free(host);
+	for (addr = addrs; addr != NULL && fd == -1; addr = addr->ai_next)
+	{
+		fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+		if (fd != -1 && connect(fd, addr->ai_addr, addr->ai_addrlen) != 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(addrs);
+	if (fd == -1)
+		die("Error: Could not connect to %s\n", location);
+	/* We do our own batching, so don't let Nagle hold replies back */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	socketOpened(fd, formatString("tcp:%s", location));
+}
+
+void streamDeinit()
+{
+	if (streamFD == -1)
+		return;
+	streamFlush();
+	close(streamFD);
+	streamFD = -1;
+	free(streamName);
+	streamName = NULL;
+}
+
+const char *streamIdentity()
+{
+	return streamName;
+}
+
+int32_t streamCheckError(const char *op)
+{
+	if (streamError != 0)
+		printf("Error: %s failed: %s\n", op, strerror(streamError));
+	return streamError;
+}
+
+/* Waits up to timeout milliseconds for the stream to become ready for events, returning false if it timed out */
+bool streamWait(const short events, const int timeout)
+{
+	struct pollfd pollFD = { streamFD, events, 0 };
+	int res = poll(&pollFD, 1, timeout);
+	if (res == -1 && errno != EINTR)
+		streamError = errno;
+	else if (res == 1 && (pollFD.revents & (POLLIN | POLLOUT)) == 0 && (pollFD.revents & (POLLERR | POLLHUP)) != 0)
+		streamError = EIO;
+	return res != 0;
+}
+
+void streamFlush()
+{
+	int32_t written = 0;
+	if (streamPending == 0 || streamError != 0)
+		return;
+	while (written < streamPending && streamError == 0)
+	{
+		ssize_t res = write(streamFD, streamBuffer + written, streamPending - written);
+		if (res > 0)
+			written += res;
+		else if (res == -1 && errno != EAGAIN && errno != EINTR)
+			streamError = errno;
+		else if (!streamWait(POLLOUT, STREAM_RX_TIMEOUT))
+			streamError = ETIMEDOUT;
+	}
+	streamPending = 0;
+	streamWrites++;
+}
+
+uint32_t streamTransferCount()
+{
+	return streamWrites;
+}
+
+int32_t streamWrite(const void *data, int32_t dataLen)
+{
+	const uint8_t *buffer = data;
+	int32_t written = 0;
+
+	if (streamCheckError("write") != 0)
+		return 0;
+	while (written < dataLen)
+	{
+		int32_t chunkLen = streamChunkLen - streamPending;
+		if (chunkLen > dataLen - written)
+			chunkLen = dataLen - written;
+		memcpy(streamBuffer + streamPending, buffer + written, chunkLen);
+		streamPending += chunkLen;
+		written += chunkLen;
+		if (streamPending == streamChunkLen)
+			streamFlush();
+	}
+	return written;
+}
+
+int32_t streamReadTimeout(void *data, int32_t dataLen, uint32_t timeout)
+{
+	uint8_t *buffer = data;
+	int32_t recvLen = 0;
+
+	/* Anything we've written so far must go out if we're to get a reply to it */
+	streamFlush();
+	while (recvLen < dataLen)
+	{
+		ssize_t res;
+		if (streamCheckError("read") != 0)
+			return recvLen;
+		res = read(streamFD, buffer + recvLen, dataLen - recvLen);
+		if (res > 0)
+			recvLen += res;
+		else if (res == 0)
+			streamError = ECONNRESET;
+		else if (errno != EAGAIN && errno != EINTR)
+			streamError = errno;
+		else if (!streamWait(POLLIN, timeout))
+			break;
+	}
+	return recvLen;
+}
+
+int32_t streamRead(void *data, int32_t dataLen)
+{
+	const int32_t recvLen = streamReadTimeout(data, dataLen, STREAM_RX_TIMEOUT);
+	if (recvLen < dataLen && streamError == 0)
+	{
+		streamError = ETIMEDOUT;
+		streamCheckError("read");
+	}
+	return recvLen;
+}
+
+const transport_t ttyTransport =
+{
+	"tty",
+	ttyInit,
+	streamDeinit,
+	streamWrite,
+	streamRead,
+	streamReadTimeout,
+	streamFlush,
+	streamTransferCount,
+	ttySetBaud,
+	NULL,
+	streamIdentity,
+	TTY_CHUNK_LEN,
+	2
+};
+
+const transport_t unixTransport =
+{
+	"unix",
+	unixInit,
+	streamDeinit,
+	streamWrite,
+	streamRead,
+	streamReadTimeout,
+	streamFlush,
+	streamTransferCount,
+	NULL,
+	NULL,
+	streamIdentity,
+	SOCKET_CHUNK_LEN,
+	SOCKET_BUFFER_LEN / SOCKET_CHUNK_LEN
+};
+
+const transport_t tcpTransport =
+{
+	"tcp",
+	tcpInit,
+	streamDeinit,
+	streamWrite,
+	streamRead,
+	streamReadTimeout,
+	streamFlush,
+	streamTransferCount,
+	NULL,
+	NULL,
+	streamIdentity,
+	SOCKET_CHUNK_LEN,
+	SOCKET_BUFFER_LEN / SOCKET_CHUNK_LEN
+};
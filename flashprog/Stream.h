@@ -0,0 +1,24 @@
+#ifndef FLASHPROG_STREAM_H
+#define FLASHPROG_STREAM_H
+
+#include <stdint.h>
+#include "Transport.h"
+
+void ttyInit(const char *location);
+void unixInit(const char *location);
+void tcpInit(const char *location);
+void streamDeinit();
+
+int32_t streamWrite(const void *data, int32_t dataLen);
+int32_t streamRead(void *data, int32_t dataLen);
+int32_t streamReadTimeout(void *data, int32_t dataLen, uint32_t timeout);
+void streamFlush();
+uint32_t streamTransferCount();
+bool ttySetBaud(uint32_t baud);
+const char *streamIdentity();
+
+extern const transport_t ttyTransport;
+extern const transport_t unixTransport;
+extern const transport_t tcpTransport;
+
+#endif /*FLASHPROG_STREAM_H*/
@@ -0,0 +1,139 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "strUtils.h"
+#include "Transport.h"
+#include "Stream.h"
+#ifndef NOLIBUSB
+#include "USB.h"
+#endif
+
+static const transport_t *transports[] =
+{
+#ifndef NOLIBUSB
+	&usbTransport,
+#endif
+	&ttyTransport,
+	&unixTransport,
+	&tcpTransport,
+	NULL
+};
+
+static const transport_t *transport;
+
+/* spec is "name" or "name:location", or a bare path for a serial port. NULL picks the first transport. */
+void transportInit(const char *spec)
+{
+	const char *location = NULL;
+	size_t nameLen;
+	uint8_t i;
+
+	if (spec == NULL)
+		spec = transports[0]->name;
+	if (spec[0] == '/')
+	{
+		transport = &ttyTransport;
+		transport->init(spec);
+		return;
+	}
+
+	location = strchr(spec, ':');
+	nameLen = location == NULL ? strlen(spec) : (size_t)(location - spec);
+	if (location != NULL)
+		location++;
+	for (i = 0; transports[i] != NULL; i++)
+	{
+		if (strlen(transports[i]->name) == nameLen && strncmp(transports[i]->name, spec, nameLen) == 0)
+		{
+			transport = transports[i];
+			transport->init(location);
+			return;
+		}
+	}
+	die("Error: %s is not a transport this flashprog knows\n", spec);
+}
+
+void transportDeinit()
+{
+	if (transport != NULL)
+		transport->deinit();
+	transport = NULL;
+}
+
+int32_t transportWrite(const void *data, int32_t dataLen)
+{
+	return transport->write(data, dataLen);
+}
+
+int32_t transportWriteByte(uint8_t data)
+{
+	return transport->write(&data, 1);
+}
+
+int32_t transportRead(void *data, int32_t dataLen)
+{
+	return transport->read(data, dataLen);
+}
+
+int32_t transportReadByte(uint8_t *data)
+{
+	return transport->read(data, 1);
+}
+
+int32_t transportReadTimeout(void *data, int32_t dataLen, uint32_t timeout)
+{
+	return transport->readTimeout(data, dataLen, timeout);
+}
+
+void transportFlush()
+{
+	transport->flush();
+}
+
+uint32_t transportTransferCount()
+{
+	return transport->transferCount();
+}
+
+bool transportHasBaud()
+{
+	return transport->setBaud != NULL && (transport->hasBaud == NULL || transport->hasBaud());
+}
+
+bool transportSetBaud(uint32_t baud)
+{
+	return transportHasBaud() && transport->setBaud(baud);
+}
+
+const char *transportIdentity()
+{
+	return transport->identity();
+}
+
+int32_t transportChunkLen()
+{
+	return transport->chunkLen;
+}
+
+uint8_t transportQueueDepth()
+{
+	return transport->queueDepth;
+}
@@ -0,0 +1,55 @@
+#ifndef FLASHPROG_TRANSPORT_H
+#define FLASHPROG_TRANSPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * A way of talking to the programmer. flashprog picks one from the --port specification:
+ *   usb[:vid:pid]     libusb, to a programmer that is its own USB device or else the Tiva C Launchpad's ICDI by default
+ *   tty:/dev/ttyACM0  A serial port - a bare path starting with / does the same
+ *   unix:/path        A UNIX domain socket, such as the Host emulator's
+ *   tcp:host:port     A TCP socket
+ */
+typedef struct transport_t
+{
+	/* The prefix that selects this transport */
+	const char *name;
+	/* location is whatever followed "name:" in the specification, or NULL */
+	void (*init)(const char *location);
+	void (*deinit)();
+	/* Writes may be gathered until a flush or read, and reads wait for all dataLen bytes or an error */
+	int32_t (*write)(const void *data, int32_t dataLen);
+	int32_t (*read)(void *data, int32_t dataLen);
+	/* Like read, but quietly gives up after timeout ms without data, returning how much did arrive */
+	int32_t (*readTimeout)(void *data, int32_t dataLen, uint32_t timeout);
+	void (*flush)();
+	uint32_t (*transferCount)();
+	/* For transports that end in a UART, changes the rate it runs at - NULL for those that don't */
+	bool (*setBaud)(uint32_t baud);
+	/* For transports that only sometimes do, whether the device found does - NULL if setBaud says it all */
+	bool (*hasBaud)();
+	/* Names the device on the other end in a way that stays the same from run to run */
+	const char *(*identity)();
+	/* The transfer size the backend moves data best in, and how many transfers it can keep in flight */
+	int32_t chunkLen;
+	uint8_t queueDepth;
+} transport_t;
+
+void transportInit(const char *spec);
+void transportDeinit();
+
+int32_t transportWrite(const void *data, int32_t dataLen);
+int32_t transportWriteByte(uint8_t data);
+int32_t transportRead(void *data, int32_t dataLen);
+int32_t transportReadByte(uint8_t *data);
+int32_t transportReadTimeout(void *data, int32_t dataLen, uint32_t timeout);
+void transportFlush();
+uint32_t transportTransferCount();
+bool transportHasBaud();
+bool transportSetBaud(uint32_t baud);
+const char *transportIdentity();
+int32_t transportChunkLen();
+uint8_t transportQueueDepth();
+
+#endif /*FLASHPROG_TRANSPORT_H*/
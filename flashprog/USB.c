@@ -17,9 +17,15 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
 #include <libusb.h>
 #include "USB.h"
+#include "USBInterface.h"
+#include "strUtils.h"
 
 typedef struct libusb_device_descriptor libusb_device_descriptor;
 typedef struct libusb_config_descriptor libusb_config_descriptor;
@@ -70,22 +76,79 @@ typedef struct usbCDCConfig
 #pragma pack(pop)
 
 /*
+ * By default we look for a programmer that is its own USB device (SPIFP_USB_VID:SPIFP_USB_PID),
+ * and failing that the Tiva C Launchpad's ICDI:
  * VID = 0x1CBE
  * PID = 0x00FD
  * REV = 0x0100
  * MI = 0x00
  */
+#define USB_DEFAULT_VID	0x1CBE
+#define USB_DEFAULT_PID	0x00FD
+
 libusb_context *usbContext;
 libusb_device_handle *usbDevice;
 
 int ctrlInterface, dataInterface;
 uint8_t ctrlEndpoint, inEndpoint, outEndpoint;
+/* Whether the device is the programmer itself, with bulk endpoints straight to the firmware, rather than a virtual serial port */
+bool usbNative;
 
 #define CDC_SET_LINE_CODING 0x20
 #define CDC_GET_LINE_CODING 0x21
 #define CDC_SET_CONTROL_LINE_STATE 0x22
 #define CTRL_LEN 32
 uint8_t ctrlData[CTRL_LEN];
+/* The VID:PID and serial number of the device, for transportIdentity() */
+char *usbName;
+
+/*
+ * The asynchronous transfer engine keeps several URBs queued in each direction
+ * and has a single event thread run their completion callbacks.
+ * Writes are coalesced into the current OUT URB until it fills or something
+ * needs a reply, and every IN URB is kept submitted, feeding the receive ring.
+ */
+#define USB_OUT_URBS	4
+#define USB_IN_URBS		4
+#define USB_URB_LEN		4096
+/*
+ * Straight to the programmer, reads can be much larger - a read back streams in whole,
+ * and only finishes a URB early on a short or zero length packet
+ */
+#define USB_NATIVE_URB_LEN	65536
+#define USB_RX_LEN		(1 << 20)
+/*
+ * How long usbRead() will wait without receiving anything before giving up, in ms.
+ * This has to cover the device erasing a sector just in time, which can take seconds.
+ */
+#define USB_RX_TIMEOUT	5000
+
+typedef struct usbURB
+{
+	struct libusb_transfer *transfer;
+	uint8_t buffer[USB_NATIVE_URB_LEN];
+	bool busy;
+} usbURB;
+
+usbURB outURBs[USB_OUT_URBS];
+usbURB inURBs[USB_IN_URBS];
+/* The OUT URB currently being filled by usbWrite(), or NULL */
+usbURB *outPending;
+/* How much each IN URB asks for */
+int usbInLen;
+
+uint8_t rxRing[USB_RX_LEN];
+size_t rxHead, rxTail, rxCount;
+
+pthread_t eventThread;
+pthread_mutex_t usbLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t usbEvent = PTHREAD_COND_INITIALIZER;
+volatile int usbStop;
+int usbError;
+uint32_t usbOutTransfers;
+
+void usbEngineInit();
+void usbInComplete(struct libusb_transfer *transfer);
 
 void usbInitCleanup()
 {
@@ -93,41 +156,53 @@ void usbInitCleanup()
 	libusb_exit(usbContext);
 }
 
-void usbInit()
+/*
+ * Looks for the programmer's own vendor specific interface, with its pair of bulk endpoints (and anything else it has).
+ * Only on our own VID:PID is any such interface the programmer's - elsewhere it has to carry our subclass and protocol.
+ */
+bool usbFindNative(const libusb_config_descriptor *usbConfigDesc, const bool ours)
+{
+	uint8_t i, j;
+	for (i = 0; i < usbConfigDesc->bNumInterfaces; i++)
+	{
+		const libusb_interface_descriptor *usbIface = usbConfigDesc->interface[i].altsetting;
+		if (usbIface->bInterfaceClass != LIBUSB_CLASS_VENDOR_SPEC || usbIface->bNumEndpoints < 2)
+			continue;
+		if (!ours && (usbIface->bInterfaceSubClass != SPIFP_USB_SUBCLASS || usbIface->bInterfaceProtocol != SPIFP_USB_PROTOCOL))
+			continue;
+		inEndpoint = outEndpoint = 0;
+		for (j = 0; j < usbIface->bNumEndpoints; j++)
+		{
+			const libusb_endpoint_descriptor *usbEndpointDesc = &usbIface->endpoint[j];
+			if ((usbEndpointDesc->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) != LIBUSB_TRANSFER_TYPE_BULK)
+				continue;
+			if ((usbEndpointDesc->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN)
+				inEndpoint = usbEndpointDesc->bEndpointAddress;
+			else
+				outEndpoint = usbEndpointDesc->bEndpointAddress;
+		}
+		if (inEndpoint != 0 && outEndpoint != 0)
+		{
+			dataInterface = usbIface->bInterfaceNumber;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Picks the control and data interfaces of a CDC ACM virtual serial port, such as the ICDI's or an LPC4370's,
+ * out of the configuration. The ICDI has its debug interfaces alongside, so there can be more than the two.
+ */
+void usbFindCDC(libusb_config_descriptor *usbConfigDesc)
 {
-	int res, actualLen;
-	libusb_device *usbRawDevice;
-	libusb_device_descriptor usbDevDesc;
-	libusb_config_descriptor *usbConfigDesc;
 	const libusb_interface_descriptor *usbIface;
 	const libusb_endpoint_descriptor *usbEndpointDesc;
 	const usbIfaceAssoc *usbInterfaceAssoc;
 	const usbCDCConfig *usbCDCDesc;
 
-	if (libusb_init(&usbContext) != 0)
-		die("Error: Could not initialise libusb-1.0\n");
-
-	usbDevice = libusb_open_device_with_vid_pid(usbContext, 0x1CBE, 0x00FD);
-	if (usbDevice == NULL)
-	{
-		libusb_exit(usbContext);
-		die("Error: Could not find a Tiva C Launchpad to connect to\n");
-	}
-	usbRawDevice = libusb_get_device(usbDevice);
-
-	if (libusb_get_device_descriptor(usbRawDevice, &usbDevDesc) != 0 || usbDevDesc.bNumConfigurations != 1)
-	{
-		usbInitCleanup();
-		die("Error: libusb could not get the device descriptor for the Tiva C Launchpad\n");
-	}
-
-	if (libusb_get_config_descriptor(usbRawDevice, 0, &usbConfigDesc) != 0)
-	{
-		usbInitCleanup();
-		die("Error: libusb could not get the configuration descriptor for the Tiva C Launchpad\n");
-	}
-	else if (usbConfigDesc->bLength != 9 || usbConfigDesc->bDescriptorType != 2 ||
-		usbConfigDesc->bNumInterfaces != 4 || usbConfigDesc->extra_length != sizeof(usbIfaceAssoc))
+	if (usbConfigDesc->bLength != 9 || usbConfigDesc->bDescriptorType != 2 ||
+		usbConfigDesc->bNumInterfaces < 2 || usbConfigDesc->extra_length != sizeof(usbIfaceAssoc))
 	{
 		libusb_free_config_descriptor(usbConfigDesc);
 		usbInitCleanup();
@@ -176,28 +251,38 @@ void usbInit()
 
 	ctrlInterface = usbInterfaceAssoc->bFirstInterface;
 	dataInterface = usbCDCDesc->iDataInterface;
-	libusb_set_configuration(usbDevice, usbConfigDesc->bConfigurationValue);
-	libusb_free_config_descriptor(usbConfigDesc);
+}
 
-	libusb_set_auto_detach_kernel_driver(usbDevice, true);
-	if (libusb_claim_interface(usbDevice, ctrlInterface) != 0 ||
-		libusb_claim_interface(usbDevice, dataInterface) != 0)
+/*
+ * Switches the device to the configuration we want. When that means leaving the one it's in,
+ * the kernel drivers bound to that one's interfaces (such as cdc_acm) have to let go of them first.
+ */
+void usbSetConfiguration(const uint8_t value)
+{
+	libusb_config_descriptor *activeDesc;
+	uint8_t i;
+
+	if (libusb_get_active_config_descriptor(libusb_get_device(usbDevice), &activeDesc) == 0)
 	{
-		usbDeinit();
-		die("Error: Could not claim the Tiva C Launchpad virtual serial port interface\n");
+		if (activeDesc->bConfigurationValue != value)
+		{
+			for (i = 0; i < activeDesc->bNumInterfaces; i++)
+				libusb_detach_kernel_driver(usbDevice, i);
+		}
+		libusb_free_config_descriptor(activeDesc);
 	}
+	libusb_set_configuration(usbDevice, value);
+}
 
-	/* Set the port baud rate */
-	*((uint32_t *)ctrlData) = 115200;
-	/* 1 stop bit, no parity, 8-bit */
-	ctrlData[4] = 0;
-	ctrlData[5] = 0;
-	ctrlData[6] = 8;
-	res = libusb_control_transfer(usbDevice, 0x21, CDC_SET_LINE_CODING, 0, ctrlInterface, ctrlData, 7, 10);
-	if (res != 7)
+/* Sets up the virtual serial port at BAUD_DEFAULT with its control lines up */
+void usbInitCDC()
+{
+	int res;
+
+	if (!usbSetBaud(BAUD_DEFAULT))
 	{
 		usbDeinit();
-		die("libusb returned %d: %s\n", res, libusb_strerror(res));
+		die("Error: Could not set the Tiva C Launchpad virtual serial port's baud rate\n");
 	}
 
 	res = libusb_control_transfer(usbDevice, 0xA1, CDC_GET_LINE_CODING, 0, ctrlInterface, ctrlData, 7, 10);
@@ -215,52 +300,471 @@ void usbInit()
 	}
 }
 
+/*
+ * location is an optional "vid:pid" in hex, picking a device other than the defaults.
+ * Whichever device it is, it's driven as the programmer itself if it has the programmer's vendor specific bulk interface,
+ * and as a CDC virtual serial port to the programmer's UART otherwise.
+ */
+void usbInit(const char *location)
+{
+	uint16_t vid = SPIFP_USB_VID, pid = SPIFP_USB_PID;
+	libusb_device *usbRawDevice;
+	libusb_device_descriptor usbDevDesc;
+	libusb_config_descriptor *usbConfigDesc;
+	unsigned char serial[64] = "";
+	uint8_t config;
+
+	if (location != NULL)
+	{
+		char *end;
+		vid = strtoul(location, &end, 16);
+		if (*end != ':')
+			die("Error: USB devices are given as vid:pid in hex, not %s\n", location);
+		pid = strtoul(end + 1, NULL, 16);
+	}
+	if (libusb_init(&usbContext) != 0)
+		die("Error: Could not initialise libusb-1.0\n");
+
+	usbDevice = libusb_open_device_with_vid_pid(usbContext, vid, pid);
+	if (usbDevice == NULL && location == NULL)
+	{
+		vid = USB_DEFAULT_VID;
+		pid = USB_DEFAULT_PID;
+		usbDevice = libusb_open_device_with_vid_pid(usbContext, vid, pid);
+	}
+	if (usbDevice == NULL)
+	{
+		libusb_exit(usbContext);
+		die("Error: Could not find a programmer or Tiva C Launchpad to connect to\n");
+	}
+	usbRawDevice = libusb_get_device(usbDevice);
+
+	if (libusb_get_device_descriptor(usbRawDevice, &usbDevDesc) != 0 || usbDevDesc.bNumConfigurations == 0)
+	{
+		usbInitCleanup();
+		die("Error: libusb could not get the device descriptor for the programmer\n");
+	}
+	/* Each Launchpad has its own serial number, which tells them apart when more than one has been used */
+	if (usbDevDesc.iSerialNumber != 0)
+		libusb_get_string_descriptor_ascii(usbDevice, usbDevDesc.iSerialNumber, serial, sizeof(serial));
+	usbName = formatString("usb:%04x:%04x:%s", vid, pid, serial);
+
+	/* The programmer's own interface may be in a configuration other than the first, such as beside a CDC one */
+	usbNative = false;
+	for (config = 0; config < usbDevDesc.bNumConfigurations && !usbNative; config++)
+	{
+		if (libusb_get_config_descriptor(usbRawDevice, config, &usbConfigDesc) != 0)
+		{
+			usbInitCleanup();
+			die("Error: libusb could not get the configuration descriptor for the programmer\n");
+		}
+		usbNative = usbFindNative(usbConfigDesc, usbDevDesc.idVendor == SPIFP_USB_VID && usbDevDesc.idProduct == SPIFP_USB_PID);
+		if (!usbNative)
+			libusb_free_config_descriptor(usbConfigDesc);
+	}
+	if (!usbNative)
+	{
+		if (libusb_get_config_descriptor(usbRawDevice, 0, &usbConfigDesc) != 0)
+		{
+			usbInitCleanup();
+			die("Error: libusb could not get the configuration descriptor for the programmer\n");
+		}
+		usbFindCDC(usbConfigDesc);
+	}
+	usbSetConfiguration(usbConfigDesc->bConfigurationValue);
+	libusb_free_config_descriptor(usbConfigDesc);
+
+	libusb_set_auto_detach_kernel_driver(usbDevice, true);
+	if (usbNative)
+	{
+		if (libusb_claim_interface(usbDevice, dataInterface) != 0)
+		{
+			usbDeinit();
+			die("Error: Could not claim the programmer's USB interface\n");
+		}
+	}
+	else
+	{
+		if (libusb_claim_interface(usbDevice, ctrlInterface) != 0 ||
+			libusb_claim_interface(usbDevice, dataInterface) != 0)
+		{
+			usbDeinit();
+			die("Error: Could not claim the Tiva C Launchpad virtual serial port interface\n");
+		}
+		usbInitCDC();
+	}
+
+	usbEngineInit();
+}
+
+/* Sets the rate the virtual serial port runs its UART at */
+bool usbSetBaud(uint32_t baud)
+{
+	uint8_t lineCoding[7];
+	lineCoding[0] = baud & 0xFF;
+	lineCoding[1] = (baud >> 8) & 0xFF;
+	lineCoding[2] = (baud >> 16) & 0xFF;
+	lineCoding[3] = (baud >> 24) & 0xFF;
+	/* 1 stop bit, no parity, 8-bit */
+	lineCoding[4] = 0;
+	lineCoding[5] = 0;
+	lineCoding[6] = 8;
+	return libusb_control_transfer(usbDevice, 0x21, CDC_SET_LINE_CODING, 0, ctrlInterface, lineCoding, 7, 100) == 7;
+}
+
+/* Only a virtual serial port has a rate to set - the programmer's own USB device runs as fast as the bus does */
+bool usbHasBaud()
+{
+	return !usbNative;
+}
+
+const char *usbIdentity()
+{
+	return usbName;
+}
+
+void usbOutComplete(struct libusb_transfer *transfer)
+{
+	usbURB *urb = transfer->user_data;
+	pthread_mutex_lock(&usbLock);
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED && usbError == 0)
+		usbError = transfer->status == LIBUSB_TRANSFER_TIMED_OUT ? LIBUSB_ERROR_TIMEOUT : LIBUSB_ERROR_IO;
+	urb->busy = false;
+	pthread_cond_broadcast(&usbEvent);
+	pthread_mutex_unlock(&usbLock);
+}
+
+/* Must be called with usbLock held */
+void usbSubmitIn(usbURB *urb)
+{
+	int error;
+	libusb_fill_bulk_transfer(urb->transfer, usbDevice, inEndpoint, urb->buffer, usbInLen, usbInComplete, urb, 0);
+	error = libusb_submit_transfer(urb->transfer);
+	if (error != 0)
+	{
+		if (usbError == 0)
+			usbError = error;
+		urb->busy = false;
+	}
+	else
+		urb->busy = true;
+}
+
+/*
+ * Whether the ring has room for everything the IN URBs already in flight could bring back and one more's worth,
+ * so that it is safe to submit another. Must be called with usbLock held.
+ */
+bool usbInRoom()
+{
+	size_t busy = 0;
+	uint8_t i;
+	for (i = 0; i < USB_IN_URBS; i++)
+	{
+		if (inURBs[i].busy)
+			busy++;
+	}
+	return (USB_RX_LEN - rxCount) >= (busy + 1) * usbInLen;
+}
+
+void usbInComplete(struct libusb_transfer *transfer)
+{
+	usbURB *urb = transfer->user_data;
+	size_t i;
+	pthread_mutex_lock(&usbLock);
+	urb->busy = false;
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
+	{
+		for (i = 0; i < (size_t)transfer->actual_length; i++)
+		{
+			rxRing[rxHead] = urb->buffer[i];
+			rxHead = (rxHead + 1) % USB_RX_LEN;
+		}
+		rxCount += transfer->actual_length;
+		/* Only requeue if there's guaranteed room for what it could bring back - usbRead() requeues otherwise */
+		if (!usbStop && usbInRoom())
+			usbSubmitIn(urb);
+	}
+	else if (transfer->status != LIBUSB_TRANSFER_CANCELLED && usbError == 0)
+		usbError = LIBUSB_ERROR_IO;
+	pthread_cond_broadcast(&usbEvent);
+	pthread_mutex_unlock(&usbLock);
+}
+
+void *usbEventLoop(void *unused __attribute__((unused)))
+{
+	while (!usbStop)
+		libusb_handle_events_completed(usbContext, (int *)&usbStop);
+	return NULL;
+}
+
+void usbEngineInit()
+{
+	uint8_t i;
+	for (i = 0; i < USB_OUT_URBS; i++)
+	{
+		outURBs[i].transfer = libusb_alloc_transfer(0);
+		outURBs[i].busy = false;
+	}
+	for (i = 0; i < USB_IN_URBS; i++)
+		inURBs[i].transfer = libusb_alloc_transfer(0);
+	outPending = NULL;
+	usbInLen = usbNative ? USB_NATIVE_URB_LEN : USB_URB_LEN;
+	rxHead = rxTail = rxCount = 0;
+	usbStop = 0;
+	usbError = 0;
+
+	pthread_mutex_lock(&usbLock);
+	for (i = 0; i < USB_IN_URBS; i++)
+		usbSubmitIn(&inURBs[i]);
+	pthread_mutex_unlock(&usbLock);
+
+	if (pthread_create(&eventThread, NULL, usbEventLoop, NULL) != 0)
+	{
+		usbDeinit();
+		die("Error: Could not start the USB event thread\n");
+	}
+}
+
+void usbEngineDeinit()
+{
+	uint8_t i;
+	bool busy = true;
+	struct timespec timeout;
+
+	usbFlush();
+	/* Give any outstanding writes a chance to complete before cancelling everything */
+	clock_gettime(CLOCK_REALTIME, &timeout);
+	timeout.tv_sec++;
+	pthread_mutex_lock(&usbLock);
+	usbStop = 1;
+	while (busy)
+	{
+		busy = false;
+		for (i = 0; i < USB_OUT_URBS; i++)
+			busy |= outURBs[i].busy;
+		if (busy && pthread_cond_timedwait(&usbEvent, &usbLock, &timeout) == ETIMEDOUT)
+			break;
+	}
+	for (i = 0; i < USB_OUT_URBS; i++)
+	{
+		if (outURBs[i].busy)
+			libusb_cancel_transfer(outURBs[i].transfer);
+	}
+	for (i = 0; i < USB_IN_URBS; i++)
+	{
+		if (inURBs[i].busy)
+			libusb_cancel_transfer(inURBs[i].transfer);
+	}
+	/* Wait for the cancellations to be delivered so the transfers can be freed */
+	busy = true;
+	while (busy)
+	{
+		busy = false;
+		for (i = 0; i < USB_OUT_URBS; i++)
+			busy |= outURBs[i].busy;
+		for (i = 0; i < USB_IN_URBS; i++)
+			busy |= inURBs[i].busy;
+		if (busy)
+		{
+			pthread_mutex_unlock(&usbLock);
+			libusb_handle_events_completed(usbContext, NULL);
+			pthread_mutex_lock(&usbLock);
+		}
+	}
+	pthread_mutex_unlock(&usbLock);
+
+	libusb_interrupt_event_handler(usbContext);
+	pthread_join(eventThread, NULL);
+	for (i = 0; i < USB_OUT_URBS; i++)
+		libusb_free_transfer(outURBs[i].transfer);
+	for (i = 0; i < USB_IN_URBS; i++)
+	{
+		libusb_free_transfer(inURBs[i].transfer);
+		inURBs[i].transfer = NULL;
+	}
+}
+
 void usbDeinit()
 {
+	if (inURBs[0].transfer != NULL)
+		usbEngineDeinit();
 	libusb_release_interface(usbDevice, dataInterface);
-	libusb_release_interface(usbDevice, ctrlInterface);
+	if (!usbNative)
+		libusb_release_interface(usbDevice, ctrlInterface);
 	libusb_close(usbDevice);
 	libusb_exit(usbContext);
+	free(usbName);
+	usbName = NULL;
 }
 
-/* TODO: check for errors in libusb_bulk_transfer() */
-int32_t usbWrite(void *data, int32_t dataLen)
+/* Must be called with usbLock held */
+int32_t usbCheckError(const char *op)
 {
-	int32_t actualLen, error;
-	error = libusb_bulk_transfer(usbDevice, outEndpoint, data, dataLen, &actualLen, 10);
+	int32_t error = usbError;
 	if (error != 0)
 	{
-		printf("Error: libusb_bulk_transfer(%d => %s) write failed\n", error, libusb_strerror(error));
-		return 0;
+		printf("Error: libusb transfer(%d => %s) %s failed\n", error, libusb_strerror(error), op);
+		usbError = 0;
 	}
-	return actualLen;
+	return error;
 }
 
-int32_t usbWriteByte(uint8_t data)
+/* Submits the OUT URB being filled, if there is one */
+void usbFlush()
 {
-	return usbWrite(&data, 1);
+	usbURB *urb = outPending;
+	int error;
+	if (urb == NULL)
+		return;
+	outPending = NULL;
+	libusb_fill_bulk_transfer(urb->transfer, usbDevice, outEndpoint, urb->buffer,
+		urb->transfer->length, usbOutComplete, urb, 0);
+	pthread_mutex_lock(&usbLock);
+	urb->busy = true;
+	usbOutTransfers++;
+	error = libusb_submit_transfer(urb->transfer);
+	if (error != 0)
+	{
+		urb->busy = false;
+		if (usbError == 0)
+			usbError = error;
+	}
+	pthread_mutex_unlock(&usbLock);
 }
 
-/* TODO: check for errors in libusb_bulk_transfer() */
-int32_t usbRead(void *data, int32_t dataLen)
+uint32_t usbTransferCount()
+{
+	return usbOutTransfers;
+}
+
+int32_t usbWrite(const void *data, int32_t dataLen)
+{
+	const uint8_t *buffer = data;
+	int32_t written = 0;
+	uint8_t i;
+
+	pthread_mutex_lock(&usbLock);
+	if (usbCheckError("write") != 0)
+	{
+		pthread_mutex_unlock(&usbLock);
+		return 0;
+	}
+	pthread_mutex_unlock(&usbLock);
+
+	while (written < dataLen)
+	{
+		int32_t chunkLen;
+		if (outPending == NULL)
+		{
+			/* Grab the next free OUT URB, waiting for one to complete if they're all in flight */
+			pthread_mutex_lock(&usbLock);
+			while (outPending == NULL)
+			{
+				for (i = 0; i < USB_OUT_URBS && outPending == NULL; i++)
+				{
+					if (!outURBs[i].busy)
+						outPending = &outURBs[i];
+				}
+				if (outPending == NULL)
+					pthread_cond_wait(&usbEvent, &usbLock);
+			}
+			pthread_mutex_unlock(&usbLock);
+			outPending->transfer->length = 0;
+		}
+
+		chunkLen = USB_URB_LEN - outPending->transfer->length;
+		if (chunkLen > dataLen - written)
+			chunkLen = dataLen - written;
+		memcpy(outPending->buffer + outPending->transfer->length, buffer + written, chunkLen);
+		outPending->transfer->length += chunkLen;
+		written += chunkLen;
+		if (outPending->transfer->length == USB_URB_LEN)
+			usbFlush();
+	}
+	return written;
+}
+
+/* Reads until dataLen bytes arrive or timeoutMs passes without any, which is an error unless quiet */
+int32_t usbReceive(void *data, int32_t dataLen, const uint32_t timeoutMs, const bool quiet)
 {
-	int32_t actualLen, recvLen, error;
-	recvLen = 0;
+	uint8_t *buffer = data;
+	int32_t recvLen = 0;
+	uint8_t i;
+
+	/* Anything we've written so far must go out if we're to get a reply to it */
+	usbFlush();
+	pthread_mutex_lock(&usbLock);
 	while (recvLen < dataLen)
 	{
-		error = libusb_bulk_transfer(usbDevice, inEndpoint, data + recvLen, dataLen - recvLen, &actualLen, 100);
-		if (error != 0)
+		struct timespec timeout;
+		if (usbCheckError("read") != 0)
+		{
+			pthread_mutex_unlock(&usbLock);
+			return recvLen;
+		}
+
+		while (rxCount != 0 && recvLen < dataLen)
+		{
+			buffer[recvLen++] = rxRing[rxTail];
+			rxTail = (rxTail + 1) % USB_RX_LEN;
+			rxCount--;
+		}
+		/* Requeue any IN URBs that were parked for lack of room in the ring */
+		for (i = 0; i < USB_IN_URBS; i++)
 		{
-			printf("Error: libusb_bulk_transfer(%d => %s) read failed\n", error, libusb_strerror(error));
-			return 0;
+			if (!inURBs[i].busy && usbInRoom())
+				usbSubmitIn(&inURBs[i]);
 		}
-		recvLen += actualLen;
+		if (recvLen == dataLen)
+			break;
+
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_sec += timeoutMs / 1000;
+		timeout.tv_nsec += (timeoutMs % 1000) * 1000000;
+		if (timeout.tv_nsec >= 1000000000)
+		{
+			timeout.tv_sec++;
+			timeout.tv_nsec -= 1000000000;
+		}
+		while (rxCount == 0 && usbError == 0)
+		{
+			if (pthread_cond_timedwait(&usbEvent, &usbLock, &timeout) == ETIMEDOUT)
+			{
+				if (!quiet)
+					usbError = LIBUSB_ERROR_TIMEOUT;
+				break;
+			}
+		}
+		if (rxCount == 0 && usbError == 0)
+			break;
 	}
+	pthread_mutex_unlock(&usbLock);
 	return recvLen;
 }
 
-int32_t usbReadByte(uint8_t *data)
+int32_t usbRead(void *data, int32_t dataLen)
+{
+	return usbReceive(data, dataLen, USB_RX_TIMEOUT, false);
+}
+
+int32_t usbReadTimeout(void *data, int32_t dataLen, uint32_t timeoutMs)
 {
-	return usbRead(data, 1);
+	return usbReceive(data, dataLen, timeoutMs, true);
 }
 
+const transport_t usbTransport =
+{
+	"usb",
+	usbInit,
+	usbDeinit,
+	usbWrite,
+	usbRead,
+	usbReadTimeout,
+	usbFlush,
+	usbTransferCount,
+	usbSetBaud,
+	usbHasBaud,
+	usbIdentity,
+	USB_URB_LEN,
+	USB_OUT_URBS
+};
@@ -2,13 +2,20 @@
 #define FLASHPROG_USB_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "Transport.h"
 
-void usbInit();
+void usbInit(const char *location);
 void usbDeinit();
 
-int32_t usbWrite(void *data, int32_t dataLen);
-int32_t usbWriteByte(uint8_t data);
+int32_t usbWrite(const void *data, int32_t dataLen);
 int32_t usbRead(void *data, int32_t dataLen);
-int32_t usbReadByte(uint8_t *data);
+int32_t usbReadTimeout(void *data, int32_t dataLen, uint32_t timeoutMs);
+void usbFlush();
+uint32_t usbTransferCount();
+bool usbSetBaud(uint32_t baud);
+const char *usbIdentity();
+
+extern const transport_t usbTransport;
 
 #endif /*FLASHPROG_USB_H*/
@@ -0,0 +1,164 @@
+/*
+ * This file is part of SPI Flash Programmer (SPIFP)
+ * Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+ *
+ * SPIFP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SPIFP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "crc32.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CRC32_SIMD
+#endif
+
+/* Reflected form of the IEEE 802.3 polynomial 0x04C11DB7 */
+#define CRC32_POLY	0xEDB88320
+
+uint32_t crcTable[256];
+
+void crc32TableInit()
+{
+	uint32_t i, j, crc;
+	for (i = 0; i < 256; i++)
+	{
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+		crcTable[i] = crc;
+	}
+}
+
+/* The byte-at-a-time fallback, which also mops up whatever the SIMD kernel leaves over */
+uint32_t crc32Table(uint32_t crc, const uint8_t *data, size_t dataLen)
+{
+	size_t i;
+	for (i = 0; i < dataLen; i++)
+		crc = (crc >> 8) ^ crcTable[(crc ^ data[i]) & 0xFF];
+	return crc;
+}
+
+#ifdef CRC32_SIMD
+/*
+ * Folds the data down 64 bytes at a time with carry-less multiplies, then reduces the result
+ * to 32 bits with a Barrett reduction, as described in Intel's "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction". The constants are the bit-reflected ones given there.
+ * dataLen must be at least 64 and a multiple of 16, and crc is the raw (uninverted) CRC state.
+ */
+__attribute__((target("pclmul,sse4.1")))
+uint32_t crc32SIMD(uint32_t crc, const uint8_t *data, size_t dataLen)
+{
+	static const uint64_t k1k2[2] __attribute__((aligned(16))) = { 0x0154442BD4, 0x01C6E41596 };
+	static const uint64_t k3k4[2] __attribute__((aligned(16))) = { 0x01751997D0, 0x00CCAA009E };
+	static const uint64_t k5k0[2] __attribute__((aligned(16))) = { 0x0163CD6124, 0x0000000000 };
+	static const uint64_t poly[2] __attribute__((aligned(16))) = { 0x01DB710641, 0x01F7011641 };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	data += 64;
+	dataLen -= 64;
+
+	/* Fold four lanes of 128 bits in parallel */
+	while (dataLen >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(data + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(data + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(data + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(data + 0x30)));
+		data += 64;
+		dataLen -= 64;
+	}
+
+	/* Fold the four lanes into one */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* Then fold in whatever 16 byte blocks are left */
+	while (dataLen >= 16)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)data)), x5);
+		data += 16;
+		dataLen -= 16;
+	}
+
+	/* Fold 128 bits down to 64 */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* And Barrett reduce that to 32 */
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return _mm_extract_epi32(x1, 1);
+}
+#endif
+
+uint32_t crc32(uint32_t crc, const void *data, size_t dataLen)
+{
+	const uint8_t *bytes = data;
+#ifdef CRC32_SIMD
+	static int haveSIMD = -1;
+	if (haveSIMD == -1)
+	{
+		__builtin_cpu_init();
+		haveSIMD = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+	}
+#endif
+	if (crcTable[1] == 0)
+		crc32TableInit();
+
+	crc = ~crc;
+#ifdef CRC32_SIMD
+	if (haveSIMD && dataLen >= 64)
+	{
+		const size_t blockLen = dataLen & ~(size_t)0x0F;
+		crc = crc32SIMD(crc, bytes, blockLen);
+		bytes += blockLen;
+		dataLen -= blockLen;
+	}
+#endif
+	return ~crc32Table(crc, bytes, dataLen);
+}
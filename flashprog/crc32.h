@@ -0,0 +1,13 @@
+#ifndef FLASHPROG_CRC32_H
+#define FLASHPROG_CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * CRC32 (IEEE 802.3, as used by zlib) of data, continuing on from crc.
+ * Start with a crc of 0, and feed the result back in to checksum data in pieces.
+ */
+uint32_t crc32(uint32_t crc, const void *data, size_t dataLen);
+
+#endif /*FLASHPROG_CRC32_H*/
@@ -17,14 +17,24 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "strUtils.h"
-#include "USB.h"
+#include "Transport.h"
+#include "Baud.h"
+#include "Cache.h"
+#include "crc32.h"
 #include "USBInterface.h"
+#include "FlashDevices.h"
 
 #ifdef _MSC_VER
 #define _usleep _sleep
@@ -41,17 +51,47 @@
 /*
  * USB transfer protocol:
  *
- * CMD_START + 4 bytes => uint32_t length of data total
+ * CMD_START + 9 bytes => uint32_t length of data total, uint8_t START_FLAG_* flags, uint32_t SPI clock hint
+ *   Device replies RPL_FAIL if the image is bigger than the Flash. Otherwise it replies RPL_OK
+ *   with an extra byte giving the number of pages it can buffer - our credits,
+ *   the uint32_t SPI clock it calibrated to, starting from the hint, the Flash's 3 byte JEDEC ID and uint32_t size,
+ *   and the uint32_t typical times to program a page (in us), erase the chip up front and erase as it goes (in ms).
  * CMD_PAGE + 1 bytes + up to 256 bytes => uint8_t page length (0 == 256), page data
+ *   We may have as many pages in flight as we have credits, each reply returns one credit.
+ * CMD_FRAME + 1 byte + CMD_PAGE messages => uint8_t number of pages packed into this bulk transfer
+ *   Each page in the frame gets its own reply as if it had been sent on its own.
+ * CMD_SKIP + 1 byte => uint8_t number of blank (all 0xFF) pages to skip over (0 == 256)
+ *   Takes one credit and gets one CMD_PAGE reply for the whole run, and may be sent bare or in a frame.
+ * CMD_READ + 12 bytes => uint32_t address, uint32_t length (0 == to the end of the device), uint32_t SPI clock hint
+ *   Device replies with the uint32_t SPI clock it calibrated to and the uint32_t length it will send,
+ *   followed by that much of the Flash's contents.
+ * CMD_BAUD + 4 bytes => uint32_t baud rate to run the UART at for the next session, checked with a probe pattern
  * CMD_ABORT => Sent to indicate user requested to abort
  * CMD_STOP => Sent at the end of transfering all the data to indicate we think we've finished.
  *   Device replies with some data indicating the status of the flash device and if there are any remaining expected bytes.
+ *   With START_FLAG_CRC, the reply is followed by the CRC32 of the data the device received and of the data in Flash.
+ *   With START_FLAG_LANES, after that comes the number of devices the programmer drove and a mask of those that failed.
  *
  * After sending each command, including CMD_STOP, the device must respond with the command code and a byte indicating whether
  * it could execute it correctly - 1 for OK, 0 for error.
  */
 int dataFD;
 size_t dataLen;
+uint8_t credits;
+/* The --credits limit on how many of the programmer's credits to use, or 0 to use them all */
+uint8_t creditLimit;
+uint32_t skippedPages;
+uint8_t startFlags;
+/* The --port specification of the transport to reach the programmer through */
+const char *port;
+/* The --baud rate to run the link at, or 0 to find the fastest that works */
+uint32_t baud;
+/* The SPI clock the programmer calibrated to for this session, and the one it settled on last time as its hint */
+uint32_t spiClock, spiClockHint;
+/* What the programmer found on the other end, and its typical page program (us) and erase (ms) times */
+uint8_t flashID[3];
+uint32_t flashSize, pageTime, chipEraseTime, blockEraseTime;
+uint32_t imageCRC;
 
 /* Reserve enough space for a page of data */
 unsigned char data[256];
@@ -60,10 +100,54 @@ static const uint8_t numProgChars = 4;
 static const char *progressChars = "|/-\\";
 uint8_t progChar;
 
+/* The names of the devices the firmware knows, to tell the user which they have */
+typedef struct
+{
+	const char *name;
+	uint8_t id[3];
+} flashName_t;
+
+#define FLASH_DEVICE(name, manufacturer, type, capacity, size, pageSize, eraseSizes, clockMax, \
+	tPP, tPPMax, tSSE, tSSEMax, tBE32, tBE32Max, tSE, tSEMax, tBE, tBEMax, protect, relock, sfdp) \
+	{ #name, { manufacturer, type, capacity } },
+static const flashName_t flashNames[] =
+{
+	FLASH_DEVICES
+	{ NULL, { 0, 0, 0 } }
+};
+#undef FLASH_DEVICE
+
+/* Says which of the devices a gang programmer drove failed, lane 0 being the one the rest of the report is about */
+void reportLanes(const uint8_t lanes, const uint8_t failed)
+{
+	uint8_t lane;
+	if (failed == 0)
+	{
+		printf("\rAll %u lanes were programmed\n", lanes);
+		return;
+	}
+	printf("\rLanes that failed (of %u):", lanes);
+	for (lane = 0; lane < lanes && lane < 8; lane++)
+	{
+		if (failed & (1 << lane))
+			printf(" %u", lane);
+	}
+	printf("\n");
+}
+
 int usage(char *prog)
 {
 	printf("Usage:\n"
-		"\t%s binfile.bin\n", prog);
+		"\t%s [--port spec] [--baud rate] [--crc] [--lanes] [--credits n] binfile.bin\n"
+		"\t%s dump [--port spec] [--baud rate] [--offset address] [--length bytes] outfile.bin\n\n"
+		"\t--port\tHow to reach the programmer (default $FLASHPROG_PORT, else usb):\n"
+		"\t\tusb[:vid:pid], tty:/dev/ttyACM0 or just /dev/ttyACM0, unix:/path, tcp:host:port\n"
+		"\t--baud\tRate to run a UART link at (default the fastest that works, remembered per device)\n"
+		"\t--crc\tVerify with a CRC32 of the whole image rather than reading back each page\n"
+		"\t--lanes\tReport how each device fared on a programmer that gang programs several\n"
+		"\t--credits\tKeep at most n pages in flight, fewer than the programmer offers (default all of them)\n"
+		"\t--offset\tAddress in the Flash to start dumping from (default 0)\n"
+		"\t--length\tNumber of bytes to dump (default to the end of the Flash)\n", prog, prog);
 	return 1;
 }
 
@@ -74,26 +158,153 @@ void tick()
 	progChar = ++progChar % numProgChars;
 }
 
+/*
+ * Returns non-zero if the block is entirely 0xFF, which the device's erase already leaves it as.
+ * This runs over every page of the image so it's done 16 bytes at a time where we can.
+ */
+int pageBlank(const uint8_t *block, const size_t len)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i ones = _mm_set1_epi8(0xFF);
+	__m128i acc = ones;
+	for (; (i + 16) <= len; i += 16)
+		acc = _mm_and_si128(acc, _mm_loadu_si128((const __m128i *)(block + i)));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, ones)) != 0xFFFF)
+		return 0;
+#else
+	uint64_t acc = UINT64_MAX, word;
+	for (; (i + 8) <= len; i += 8)
+	{
+		memcpy(&word, block + i, 8);
+		acc &= word;
+	}
+	if (acc != UINT64_MAX)
+		return 0;
+#endif
+	for (; i < len; i++)
+	{
+		if (block[i] != 0xFF)
+			return 0;
+	}
+	return 1;
+}
+
+/* Tells the user what the programmer found, going by the name we know it by if we do */
+void describeFlash()
+{
+	const flashName_t *device;
+	for (device = flashNames; device->name != NULL; device++)
+	{
+		if (memcmp(device->id, flashID, 3) == 0)
+			break;
+	}
+	if (device->name != NULL)
+		printf("Found a %s (%ukB)\n", device->name, flashSize >> 10);
+	else
+		printf("Found a device with ID %02X%02X%02X, going by its SFDP tables (%ukB)\n", flashID[0], flashID[1], flashID[2],
+			flashSize >> 10);
+}
+
+/*
+ * Works out roughly how long programming will take in seconds - the device programs each page while the next comes
+ * over the link, so it's whichever of the two is slower, plus any erasing done along the way
+ */
+double programmingTime()
+{
+	const uint32_t pages = (dataLen + 255) / 256;
+	const double flashTime = pages * (pageTime / 1e6), linkTime = baud != 0 ? (dataLen + (pages * 2)) * 10.0 / baud : 0;
+	return (flashTime > linkTime ? flashTime : linkTime) + (blockEraseTime / 1e3);
+}
+
 void processFile()
 {
-	int32_t res, blockLen = -1;
-	uint32_t pageNum = 0;
+	int32_t res, blockLen = -1, frameLen, maxFrameLen;
+	uint32_t pageNum = 0, inFlight = 0, skipAt = 0, skipLen;
+	/*
+	 * Wait for at least this many credits to come back before sending the next frame, spreading them
+	 * across as many frames as the transport can keep in flight so it always has another one queued -
+	 * but never fewer than half of them, or a deep queue (such as a socket's) gets a frame per page
+	 */
+	const uint32_t queued = credits / transportQueueDepth(), batch = queued > (credits + 1U) / 2 ? queued : (credits + 1U) / 2;
+	uint8_t records, *frame;
+	/* The page just read from the image, which waits here for a credit if it turns out to need one */
+	uint8_t page[256];
+	int pageHeld = 0;
+
+	maxFrameLen = transportChunkLen();
+	frame = memMalloc(maxFrameLen);
 	progChar = 0;
-	printf("Programming: ");
-	while (blockLen != 0)
+	printf("Programming (about %.1fs): ", programmingTime());
+	while (blockLen != 0 || inFlight != 0)
 	{
-		blockLen = read(dataFD, data, 256);
-		if (blockLen == -1)
+		/* Pack as many pages as we have credits for into the next frame */
+		if (blockLen != 0 && (inFlight == 0 || (credits - inFlight) >= batch))
 		{
-			usbWriteByte(CMD_ABORT);
-			die("\rError: read() returned an error.. cannot continue..\n");
-		}
-		else if (blockLen == 0)
+			frame[0] = CMD_FRAME;
+			frameLen = FRAME_HEADER_LEN;
+			records = 0;
+			skipLen = 0;
+			while (records < 0xFF && (frameLen + FRAME_RECORD_LEN(256)) <= maxFrameLen)
+			{
+				/* Out of credits, the skip run we're building can still grow as it costs none more */
+				const int haveCredit = (inFlight + records) < credits;
+				if (!haveCredit && (skipLen == 0 || skipLen == 256))
+					break;
+				if (!pageHeld)
+				{
+					blockLen = read(dataFD, page, 256);
+					if (blockLen == -1)
+					{
+						transportWriteByte(CMD_ABORT);
+						die("\rError: read() returned an error.. cannot continue..\n");
+					}
+					else if (blockLen == 0)
+						break;
+					imageCRC = crc32(imageCRC, page, blockLen);
+					pageHeld = 1;
+				}
+				if (pageBlank(page, blockLen))
+				{
+					/* Extend the skip run we're building if it has room, otherwise start a new one */
+					if (skipLen != 0 && skipLen < 256)
+						frame[skipAt + 1] = ++skipLen & 0xFF;
+					else
+					{
+						skipAt = frameLen;
+						skipLen = 1;
+						frame[frameLen] = CMD_SKIP;
+						frame[frameLen + 1] = skipLen;
+						frameLen += SKIP_RECORD_LEN;
+						records++;
+					}
+					skippedPages++;
+					pageHeld = 0;
+					continue;
+				}
+				/* A page with data needs a credit of its own, so keep it for the next frame */
+				if (!haveCredit)
+					break;
+				skipLen = 0;
+				frame[frameLen] = CMD_PAGE;
+				frame[frameLen + 1] = blockLen & 0xFF;
+				memcpy(frame + frameLen + FRAME_RECORD_LEN(0), page, blockLen);
+				frameLen += FRAME_RECORD_LEN(blockLen);
+				records++;
+				pageHeld = 0;
+			}
+			if (records != 0)
+			{
+				frame[1] = records;
+				transportWrite(frame, frameLen);
+				transportFlush();
+				inFlight += records;
+			}
 			continue;
-		usbWriteByte(CMD_PAGE);
-		usbWriteByte(blockLen & 0xFF);
-		usbWrite(data, blockLen);
-		res = usbRead(data, 2);
+		}
+
+		/* Short of credits or out of data, so collect the oldest record's reply */
+		res = transportRead(data, 2);
 		if (res != 2 || data[0] != CMD_PAGE || data[1] != RPL_OK)
 		{
 			printf("\rError: Programming a data page failed\n");
@@ -101,25 +312,32 @@ void processFile()
 		}
 		else
 		{
+			inFlight--;
 			pageNum++;
 			if ((pageNum % 4) == 0)
 				tick();
 		}
 	}
+	free(frame);
 }
 
 void waitForErase()
 {
 	int32_t res;
 	progChar = 0;
-	printf("Erasing: ");
+	if (chipEraseTime != 0)
+		printf("Erasing (about %.1fs): ", chipEraseTime / 1e3);
+	else
+		printf("Erasing: ");
 	fflush(stdout);
 	do
 	{
-		usbWriteByte(CMD_ERASE);
-		res = usbRead(data, 2);
+		transportWriteByte(CMD_ERASE);
+		res = transportRead(data, 2);
 		if (res != 2 || data[0] != CMD_ERASE)
 			die("\rError: Erase cycle interrupted, cannot continue..\n");
+		else if (data[1] == RPL_FAIL)
+			die("\rError: The Flash did not finish erasing in the time its datasheet allows\n");
 		else if (data[1] == RPL_OK)
 			break;
 		tick();
@@ -129,59 +347,246 @@ void waitForErase()
 	printf("Done!\n");
 }
 
+uint32_t readUInt32(const uint8_t *buffer)
+{
+	return ((uint32_t)buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
+}
+
+void writeUInt32(const uint32_t value)
+{
+	data[0] = (value >> 24) & 0xFF;
+	data[1] = (value >> 16) & 0xFF;
+	data[2] = (value >> 8) & 0xFF;
+	data[3] = value & 0xFF;
+	transportWrite(data, 4);
+}
+
 void writeLength()
 {
-	data[0] = (dataLen >> 24) & 0xFF;
-	data[1] = (dataLen >> 16) & 0xFF;
-	data[2] = (dataLen >> 8) & 0xFF;
-	data[3] = dataLen & 0xFF;
-	usbWrite(data, 4);
+	writeUInt32(dataLen);
+}
+
+/* Picks up the SPI clock the programmer settled on for this fixture last time, to hint it at where to start */
+void spiClockLoad()
+{
+	spiClockHint = cacheRead("spiclock", transportIdentity());
+}
+
+/* Remembers the SPI clock the programmer calibrated to, if it's moved on from last time */
+void spiClockSave()
+{
+	if (spiClock != 0 && spiClock != spiClockHint)
+		cacheWrite("spiclock", transportIdentity(), spiClock);
+}
+
+/* Reads the Flash back into a file that's sized up front and mapped, so the data lands straight in the page cache */
+int dumpFlash(int argc, char **argv, char *prog)
+{
+	uint32_t offset = 0, length = 0, done;
+	int arg, outFD;
+	uint8_t *dump;
+	struct timespec start, end;
+	double secs;
+
+	for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++)
+	{
+		if (strcmp(argv[arg], "--port") == 0 && (arg + 1) < argc)
+			port = argv[++arg];
+		else if (strcmp(argv[arg], "--baud") == 0 && (arg + 1) < argc)
+			baud = strtoul(argv[++arg], NULL, 0);
+		else if (strcmp(argv[arg], "--offset") == 0 && (arg + 1) < argc)
+			offset = strtoul(argv[++arg], NULL, 0);
+		else if (strcmp(argv[arg], "--length") == 0 && (arg + 1) < argc)
+			length = strtoul(argv[++arg], NULL, 0);
+		else
+			return usage(prog);
+	}
+	if (arg != argc - 1)
+		return usage(prog);
+	outFD = open(argv[arg], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (outFD == -1)
+		die("Error: Could not open the file specified\n");
+	transportInit(port);
+	baud = baudNegotiate(baud);
+	spiClockLoad();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	transportWriteByte(CMD_READ);
+	writeUInt32(offset);
+	writeUInt32(length);
+	writeUInt32(spiClockHint);
+	if (transportRead(data, 10) != 10 || data[0] != CMD_READ || data[1] != RPL_OK)
+	{
+		printf("Tiva C Launchpad said it could not read that part of the Flash\n");
+		close(outFD);
+		transportDeinit();
+		return 1;
+	}
+	spiClock = readUInt32(data + 2);
+	spiClockSave();
+	length = readUInt32(data + 6);
+	if (posix_fallocate(outFD, 0, length) != 0 || ftruncate(outFD, length) != 0)
+	{
+		transportDeinit();
+		die("Error: Could not allocate %u bytes for the dump\n", length);
+	}
+	dump = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, outFD, 0);
+	if (dump == MAP_FAILED)
+	{
+		transportDeinit();
+		die("Error: Could not map the dump file\n");
+	}
+
+	progChar = 0;
+	printf("Dumping: ");
+	for (done = 0; done < length; )
+	{
+		/* Pull 64kB at a time so we can show progress */
+		int32_t res, chunk = (length - done) < 0x10000 ? length - done : 0x10000;
+		res = transportRead(dump + done, chunk);
+		if (res != chunk)
+		{
+			munmap(dump, length);
+			transportDeinit();
+			die("\rError: The Flash contents stopped arriving after %u bytes\n", done);
+		}
+		done += chunk;
+		tick();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	munmap(dump, length);
+	close(outFD);
+	transportDeinit();
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("Done!\nRead %u bytes from 0x%06X in %.2fs (%.1f kB/s)", length, offset, secs,
+		secs != 0 ? length / secs / 1024 : 0.0);
+	if (baud != 0)
+		printf(" at %u baud", baud);
+	printf(", %.1fMHz SPI\n", spiClock / 1e6);
+	return 0;
 }
 
 int main(int argc, char **argv)
 {
-	int32_t res;
+	int32_t res, replyLen;
+	int arg;
+	const char *fileName;
 	struct stat dataStat;
+	struct timespec start, programStart, end;
+	double estimate, programSecs;
 
-	if (argc != 2)
+	port = getenv("FLASHPROG_PORT");
+	if (argc >= 2 && strcmp(argv[1], "dump") == 0)
+		return dumpFlash(argc - 1, argv + 1, argv[0]);
+	for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++)
+	{
+		if (strcmp(argv[arg], "--crc") == 0)
+			startFlags |= START_FLAG_CRC;
+		else if (strcmp(argv[arg], "--lanes") == 0)
+			startFlags |= START_FLAG_LANES;
+		else if (strcmp(argv[arg], "--credits") == 0 && (arg + 1) < argc)
+			creditLimit = strtoul(argv[++arg], NULL, 0);
+		else if (strcmp(argv[arg], "--port") == 0 && (arg + 1) < argc)
+			port = argv[++arg];
+		else if (strcmp(argv[arg], "--baud") == 0 && (arg + 1) < argc)
+			baud = strtoul(argv[++arg], NULL, 0);
+		else
+			return usage(argv[0]);
+	}
+	if (arg != argc - 1)
 		return usage(argv[0]);
-	usbInit();
-	dataFD = open(argv[1], O_RDONLY | O_EXCL);
+	fileName = argv[arg];
+	transportInit(port);
+	dataFD = open(fileName, O_RDONLY | O_EXCL);
 	if (dataFD == -1)
 	{
-		usbDeinit();
+		transportDeinit();
 		die("Error: Could not open the file specified\n");
 	}
-	if (stat(argv[1], &dataStat) != 0)
+	if (stat(fileName, &dataStat) != 0)
 	{
 		close(dataFD);
-		usbDeinit();
+		transportDeinit();
 		die("Error: Could not determine the size of the file specified\n");
 	}
 	dataLen = dataStat.st_size;
+	baud = baudNegotiate(baud);
+	spiClockLoad();
 
-	// Send the start command + 4 bytes indicating how long the data file is
-	usbWriteByte(CMD_START);
+	// Send the start command + 4 bytes indicating how long the data file is, how to verify it, and the SPI clock hint
+	transportWriteByte(CMD_START);
 	writeLength();
+	transportWriteByte(startFlags);
+	writeUInt32(spiClockHint);
 	// Now wait for the return code
-	res = usbRead(data, 2);
-	if (res != 2 || data[0] != CMD_START || data[1] != RPL_OK)
+	res = transportRead(data, 2);
+	if (res == 2 && data[0] == CMD_START && data[1] == RPL_FAIL)
+		printf("Tiva C Launchpad refused the image as too big for the Flash it found\n");
+	else if (res != 2 || data[0] != CMD_START || data[1] != RPL_OK)
 		printf("Tiva C Launchpad said it could not start a transfer\n");
+	else if (transportRead(&credits, 1) != 1 || credits == 0)
+		printf("Tiva C Launchpad did not give us any credits to transfer with\n");
+	else if (transportRead(data, 23) != 23)
+		printf("Tiva C Launchpad did not say what SPI clock it is running at, or what Flash it found\n");
 	else
 	{
+		if (creditLimit != 0 && creditLimit < credits)
+			credits = creditLimit;
+		spiClock = readUInt32(data);
+		spiClockSave();
+		memcpy(flashID, data + 4, 3);
+		flashSize = readUInt32(data + 7);
+		pageTime = readUInt32(data + 11);
+		chipEraseTime = readUInt32(data + 15);
+		blockEraseTime = readUInt32(data + 19);
+		describeFlash();
+		/* The programmer should have refused it already, but an image that doesn't fit would wrap over the start */
+		if (dataLen > flashSize)
+		{
+			transportWriteByte(CMD_ABORT);
+			close(dataFD);
+			transportDeinit();
+			die("Error: The image (%zukB) is bigger than the Flash (%ukB)\n", dataLen >> 10, flashSize >> 10);
+		}
+		estimate = (chipEraseTime / 1e3) + programmingTime();
+		clock_gettime(CLOCK_MONOTONIC, &start);
 		waitForErase();
+		clock_gettime(CLOCK_MONOTONIC, &programStart);
 		processFile();
-		usbWriteByte(CMD_STOP);
-		res = usbRead(data, 6);
-		if (res != 6 || data[4] != CMD_STOP || data[5] != RPL_OK)
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		programSecs = (end.tv_sec - programStart.tv_sec) + (end.tv_nsec - programStart.tv_nsec) / 1e9;
+		transportWriteByte(CMD_STOP);
+		replyLen = 6 + ((startFlags & START_FLAG_CRC) ? 8 : 0) + ((startFlags & START_FLAG_LANES) ? 2 : 0);
+		res = transportRead(data, replyLen);
+		if (res == replyLen && (startFlags & START_FLAG_LANES))
+			reportLanes(data[replyLen - 2], data[replyLen - 1]);
+		if (res == replyLen && (startFlags & START_FLAG_CRC) && readUInt32(data + 6) != imageCRC)
+			printf("\rThe image was corrupted on its way to the Tiva C Launchpad, please try again\n");
+		else if (res == replyLen && (startFlags & START_FLAG_CRC) && readUInt32(data + 10) != imageCRC)
+			printf("\rThe Flash does not match the image (CRC %08X, expected %08X), please try again\n",
+				readUInt32(data + 10), imageCRC);
+		else if (res != replyLen || data[4] != CMD_STOP || data[5] != RPL_OK)
 			printf("\rTiva C Launchpad encountered errors during programming, please try again\n");
 		else if (*((uint32_t *)data) != 0)
 			printf("\rTiva C Launchpad did not receieve whole file\n");
 		else
 			printf("Done!\n");
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		printf("Took %.1fs, against an estimate of %.1fs\n",
+			(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, estimate);
+		/* Less any erasing up front, which is what the link and the pages in flight make a difference to */
+		printf("Programming took %.2fs (%.1fkB/s)\n", programSecs, programSecs != 0 ? dataLen / programSecs / 1024 : 0.0);
+		if (skippedPages != 0)
+			printf("Skipped %u blank pages\n", skippedPages);
+		printf("Used %u transfers (%.1f per MB)", transportTransferCount(),
+			dataLen != 0 ? transportTransferCount() * 1048576.0 / dataLen : 0.0);
+		if (baud != 0)
+			printf(" at %u baud", baud);
+		printf(", %.1fMHz SPI\n", spiClock / 1e6);
 	}
 
 	close(dataFD);
-	usbDeinit();
+	transportDeinit();
 	return 0;
 }
@@ -0,0 +1,86 @@
+#!/bin/sh
+# This file is part of SPI Flash Programmer (SPIFP)
+# Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+#
+# SPIFP is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# SPIFP is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Checks that devices past 16MB are programmed without wrapping, and that images too big for the device are refused.
+# A 32MB W25Q256JV is programmed with an image that has data at its start, across the 16MB boundary and at its end,
+# once using its 4-byte instructions and once switched to 4-byte addresses with EN4B, and each time the whole device
+# has to match the image and dump back from past 16MB. Blank pages in between are skipped, so the link and the
+# model's timings are run flat out to keep this quick. The device answers with an ID the firmware doesn't know,
+# so that it goes by the SFDP tables and their shortened times, not the W25Q256JV's real erase times.
+
+. "$(dirname "$0")/lib.sh"
+
+SPIFP_BAUD=0
+SPIFP_SPI_HZ=0
+SPIFP_TPP=10
+SPIFP_TSSE=10
+SPIFP_TBE32=10
+SPIFP_TSE=10
+SPIFP_TBE=10
+export SPIFP_BAUD SPIFP_SPI_HZ SPIFP_TPP SPIFP_TSSE SPIFP_TBE32 SPIFP_TSE SPIFP_TBE
+
+MB=1048576
+
+# Appends $2 bytes of 0xFF to $1
+blank()
+{
+	head -c "$2" /dev/zero | tr '\0' '\377' >>"$1"
+}
+
+build
+image=$WORK/image.bin
+: >"$image"
+randomImage "$WORK/part" 65536; cat "$WORK/part" >>"$image"
+blank "$image" $((16 * MB - 65536 - 32768))
+randomImage "$WORK/part" 65536; cat "$WORK/part" >>"$image"
+blank "$image" $((16 * MB - 32768 - 65536))
+randomImage "$WORK/part" 65536; cat "$WORK/part" >>"$image"
+[ "$(wc -c <"$image")" -eq $((32 * MB)) ] || fail "the test image came out the wrong size"
+
+SPIFP_FLASH=W25Q256JV
+SPIFP_FLASH_ID=0xEF4099
+export SPIFP_FLASH SPIFP_FLASH_ID
+for mode in 4BAIT EN4B; do
+	if [ $mode = EN4B ]; then
+		SPIFP_NO_4BAIT=1
+		export SPIFP_NO_4BAIT
+	fi
+	rm -f "$WORK/flash.bin"
+	emuStart
+	flashprog --crc "$image"
+	grep -q "^Programming.*Done!$" "$WORK/flashprog.log" || fail "programming 32MB with $mode: $(cat "$WORK/flashprog.log")"
+	cmp -s "$image" "$WORK/flash.bin" || fail "the Flash does not hold the 32MB image programmed with $mode"
+	# Read the top of the device back through the programmer too
+	flashprog dump --offset $((32 * MB - 65536)) "$WORK/dump.bin"
+	emuStop
+	tail -c 65536 "$image" | cmp -s - "$WORK/dump.bin" || fail "the top of the device dumped back wrong with $mode: $(cat "$WORK/flashprog.log")"
+	echo "$mode: 32MB programmed and dumped back without wrapping"
+done
+unset SPIFP_NO_4BAIT SPIFP_FLASH_ID
+
+# One page more than a 4MB device holds must be refused before anything is written
+SPIFP_FLASH=W25Q32JV
+rm -f "$WORK/flash.bin"
+randomImage "$image" $((4 * MB + 256))
+emuStart
+flashprog "$image"
+emuStop
+grep -q "refused the image" "$WORK/flashprog.log" || fail "an image too big for the device was not refused: $(cat "$WORK/flashprog.log")"
+blank "$WORK/erased.bin" $((4 * MB))
+cmp -s "$WORK/erased.bin" "$WORK/flash.bin" || fail "refusing an image too big for the device still wrote to it"
+echo "An image bigger than the device was refused"
+echo "PASS"
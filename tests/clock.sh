@@ -0,0 +1,81 @@
+#!/bin/sh
+# This file is part of SPI Flash Programmer (SPIFP)
+# Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+#
+# SPIFP is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# SPIFP is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Checks what the firmware's SPI clock calibration reads back on a blank device, whose contents can't show up a
+# misread, with the modelled board garbling reads past 20MHz. Programming has the firmware write a pattern into
+# the image's first block to read back, which the image then has to replace. Dumping must leave the device as it
+# was, calibrating against its SFDP tables, or on a device without those staying at the safe 2MHz.
+
+. "$(dirname "$0")/lib.sh"
+
+SPIFP_BAUD=0
+SPIFP_SPI_MAX_HZ=20000000
+SPIFP_TRACE=1
+SPIFP_TPP=10
+SPIFP_TSSE=10
+SPIFP_TBE32=10
+SPIFP_TSE=10
+SPIFP_TBE=10
+export SPIFP_BAUD SPIFP_SPI_MAX_HZ SPIFP_TRACE SPIFP_TPP SPIFP_TSSE SPIFP_TBE32 SPIFP_TSE SPIFP_TBE
+
+# The SPI clock in MHz flashprog said the programmer ran at
+spiMHz()
+{
+	sed -n 's/.*, \([0-9.]*\)MHz SPI$/\1/p' "$WORK/flashprog.log"
+}
+
+# Checks that the Flash is blank from offset $1 to $2
+flashBlank()
+{
+	[ "$(tail -c +$(($1 + 1)) "$WORK/flash.bin" | head -c $(($2 - $1)) | tr -d '\377' | wc -c)" -eq 0 ]
+}
+
+build
+randomImage "$WORK/image.bin" 1000
+
+SPIFP_FLASH=W25Q32JV
+SPIFP_FLASH_ID=0xEF4099
+export SPIFP_FLASH SPIFP_FLASH_ID
+rm -f "$WORK/flash.bin"
+emuStart
+flashprog "$WORK/image.bin"
+emuStop
+grep -q "^Programming.*Done!$" "$WORK/flashprog.log" || fail "programming a blank device: $(cat "$WORK/flashprog.log")"
+grep -q "^SPIFP: 02 000A00 " "$WORK/emulator.log" || fail "no check pattern was programmed into the blank device"
+flashHolds "$WORK/image.bin" || fail "the Flash does not hold the image"
+flashBlank 1000 4096 || fail "the check pattern was left in the Flash past the image"
+mhz=$(spiMHz)
+awk "BEGIN { exit !($mhz > 2 && $mhz <= 20) }" || fail "programming a blank device ran the SPI at ${mhz}MHz"
+echo "Programming a blank device checked the clock against a pattern, and ran at ${mhz}MHz"
+unset SPIFP_FLASH_ID
+
+for SPIFP_FLASH in W25Q32JV M25P16; do
+	rm -f "$WORK/flash.bin" "$WORK/cache/flashprog/spiclock"
+	emuStart
+	flashprog dump --length 4096 "$WORK/dump.bin"
+	emuStop
+	grep -q "^Dumping.*Done!$" "$WORK/flashprog.log" || fail "dumping a blank $SPIFP_FLASH: $(cat "$WORK/flashprog.log")"
+	flashBlank 0 "$(wc -c <"$WORK/flash.bin")" || fail "dumping a blank $SPIFP_FLASH wrote to it"
+	mhz=$(spiMHz)
+	if [ $SPIFP_FLASH = M25P16 ]; then
+		awk "BEGIN { exit !($mhz == 2) }" || fail "dumping a blank $SPIFP_FLASH, without SFDP, ran the SPI at ${mhz}MHz"
+	else
+		awk "BEGIN { exit !($mhz > 2 && $mhz <= 20) }" || fail "dumping a blank $SPIFP_FLASH ran the SPI at ${mhz}MHz"
+	fi
+	echo "Dumping a blank $SPIFP_FLASH left it blank, and ran at ${mhz}MHz"
+done
+echo "PASS"
@@ -0,0 +1,58 @@
+#!/bin/sh
+# This file is part of SPI Flash Programmer (SPIFP)
+# Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+#
+# SPIFP is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# SPIFP is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Programs the same image with flashprog keeping 1, 2, 4 and 8 pages in flight, and checks that programming
+# gets faster as it does. The emulator's UART runs at 2Mbaud, where a page takes about as long to send as the
+# model takes to program it, so with one credit the two take turns and with more they overlap.
+# The firmware waits out the times in its own table for a part it knows, whatever the model's are, so the device
+# answers with an ID it doesn't know and the firmware goes by the times in the model's SFDP tables instead.
+# Only the programming phase is timed, as flashprog reports it, leaving out erasing up front.
+
+. "$(dirname "$0")/lib.sh"
+
+IMAGE_LEN=131072
+SPIFP_FLASH=W25Q32JV
+SPIFP_FLASH_ID=0xEF4099
+SPIFP_BAUD=2000000
+SPIFP_TPP=1000
+SPIFP_TSSE=1000
+SPIFP_TBE32=1000
+SPIFP_TSE=1000
+SPIFP_TBE=1000
+export SPIFP_FLASH SPIFP_FLASH_ID SPIFP_BAUD SPIFP_TPP SPIFP_TSSE SPIFP_TBE32 SPIFP_TSE SPIFP_TBE
+
+build
+randomImage "$WORK/image.bin" $IMAGE_LEN
+last=0
+for credits in 1 2 4 8; do
+	rm -f "$WORK/flash.bin"
+	emuStart
+	flashprog --credits $credits "$WORK/image.bin"
+	emuStop
+	grep -q "^Programming.*Done!$" "$WORK/flashprog.log" || fail "programming with $credits credits: $(cat "$WORK/flashprog.log")"
+	flashHolds "$WORK/image.bin" || fail "the Flash does not hold the image programmed with $credits credits"
+	secs=$(sed -n 's/^Programming took \([0-9.]*\)s.*/\1/p' "$WORK/flashprog.log")
+	[ -n "$secs" ] || fail "flashprog did not say how long programming took with $credits credits"
+	rate=$(awk "BEGIN { printf \"%d\", $IMAGE_LEN / 1024 / $secs }")
+	echo "$credits credits: ${secs}s, ${rate}kB/s"
+	# Past the first doubling the link and the Flash already overlap, so allow for a little noise
+	[ $((rate * 100)) -ge $((last * 95)) ] || fail "$credits credits ran at ${rate}kB/s, slower than ${last}kB/s"
+	[ $credits -ne 1 ] || first=$rate
+	last=$rate
+done
+[ $((last * 100)) -ge $((first * 120)) ] || fail "8 credits ran at ${last}kB/s, not much faster than 1 at ${first}kB/s"
+echo "PASS"
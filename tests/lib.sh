@@ -0,0 +1,84 @@
+# This file is part of SPI Flash Programmer (SPIFP)
+# Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+#
+# SPIFP is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# SPIFP is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Shared by the tests: builds the Host emulator and a libusb-free flashprog, and runs the two against each other
+# over a unix socket in a scratch directory. Each test sets the emulator's SPIFP_* variables before emuStart.
+
+TESTS=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$TESTS")
+EMULATOR=$ROOT/firmware/SPIFlashEmulator
+FLASHPROG=$ROOT/flashprog/flashprog
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/spifp-test.XXXXXX")
+SOCKET=$WORK/uart
+EMU_PID=
+
+fail()
+{
+	echo "FAIL: $*"
+	exit 1
+}
+
+cleanup()
+{
+	emuStop
+	rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+build()
+{
+	make -s -C "$ROOT/firmware" TARGET=Host NOCONFIG=1 >/dev/null || fail "could not build the emulator"
+	make -s -C "$ROOT/flashprog" NOLIBUSB=1 >/dev/null || fail "could not build flashprog"
+}
+
+# Starts the emulator on the socket with its Flash in $WORK/flash.bin, and waits for it to listen
+emuStart()
+{
+	rm -f "$SOCKET"
+	SPIFP_SOCKET=unix:$SOCKET SPIFP_FLASH_FILE=$WORK/flash.bin "$EMULATOR" 2>"$WORK/emulator.log" &
+	EMU_PID=$!
+	while [ ! -S "$SOCKET" ]; do
+		kill -0 $EMU_PID 2>/dev/null || fail "the emulator did not start: $(cat "$WORK/emulator.log")"
+		sleep 0.05
+	done
+}
+
+emuStop()
+{
+	if [ -n "$EMU_PID" ]; then
+		kill $EMU_PID 2>/dev/null
+		wait $EMU_PID 2>/dev/null
+	fi
+	EMU_PID=
+}
+
+# Runs flashprog against the emulator with the given arguments, leaving what it said in $WORK/flashprog.log
+flashprog()
+{
+	FLASHPROG_PORT=unix:$SOCKET XDG_CACHE_HOME=$WORK/cache timeout 600 "$FLASHPROG" "$@" 2>&1 | tr '\r' '\n' >"$WORK/flashprog.log"
+}
+
+# Makes an image of $2 random bytes at $1
+randomImage()
+{
+	head -c "$2" /dev/urandom >"$1"
+}
+
+# Checks that the Flash holds the image $1 from offset $2 (default 0)
+flashHolds()
+{
+	cmp -s -i "0:${2:-0}" -n "$(wc -c <"$1")" "$1" "$WORK/flash.bin"
+}
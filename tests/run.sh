@@ -0,0 +1,24 @@
+#!/bin/sh
+# This file is part of SPI Flash Programmer (SPIFP)
+# Copyright © 2014 Rachel Mant (dx-mon@users.sourceforge.net)
+#
+# SPIFP is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# SPIFP is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Runs each of the tests in turn against the Host emulator, stopping at the first to fail
+
+cd "$(dirname "$0")" || exit 1
+for test in credits.sh bigflash.sh clock.sh; do
+	echo "== $test"
+	sh "./$test" || exit 1
+done